@@ -94,6 +94,14 @@ class FunctionCall : public ExprTree
 
 	static bool RegisterSharedLibraryFunctions(const char *shared_library_path);
 
+	/** Counters of the process-wide cache of compiled patterns used by
+	 * 	regexp(), regexpMember() and regexps()
+	 * 	@param hits		Lookups that found the pattern already compiled
+	 * 	@param misses	Lookups that had to compile it
+	 * 	@param entries	Patterns currently in the cache
+	 */
+	static void GetRegexCacheStats( int &hits, int &misses, int &entries );
+
  protected:
 	/// Constructor
 	FunctionCall ();
@@ -183,6 +191,7 @@ class FunctionCall : public ExprTree
 
 	static bool matchPatternMember(const char*,const ArgumentList &argList,EvalState &state,
                               Value &result);
+	static void regexp_precompile( FunctionCall *fc );
 
 	// type conversion
 	static bool convInt(const char*,const ArgumentList&,EvalState&,Value&);
@@ -106,6 +106,12 @@ class Literal : public ExprTree
 		 * 	@param v The value encapsulated by the literal
 		 */
 		void GetValue( Value& v ) const;
+
+		/** Replace the encapsulated value in place, so that an ad can be
+		 * 	re-evaluated with new values without rebuilding its expressions.
+		 * 	@param v The new value. (Cannot be a classad or list value.)
+		 */
+		void SetValue( const Value& v );
 		
 		/* Takes the number of seconds since the epoch as argument - epochsecs, 
 		 *and returns the timezone offset(relative to GMT) in the currect locality
@@ -47,6 +47,8 @@
 #include <dlfcn.h>
 #endif
 
+#include <list>
+
 using namespace std;
 
 BEGIN_NAMESPACE( classad )
@@ -403,6 +405,11 @@ MakeFunctionCall( const string &str, vector<ExprTree*> &args )
 	for( ArgumentList::iterator i = args.begin(); i != args.end( ); i++ ) {
 		fc->arguments.push_back( *i );
 	}
+
+#if defined USE_POSIX_REGEX || defined USE_PCRE
+	regexp_precompile( fc );
+#endif
+
 	return( fc );
 }
 
@@ -2313,6 +2320,185 @@ interval( const char* /* name */,const ArgumentList &argList,EvalState &state,
 }
 
 #if defined USE_POSIX_REGEX || defined USE_PCRE
+
+// Compiled patterns are cached process-wide, keyed by the pattern and
+// its compile options, so that a constraint evaluated over and over
+// does not compile the same patterns every time.  The cache is
+// bounded; the least recently used pattern goes when it is full.
+
+struct CompiledRegex {
+#if defined (USE_POSIX_REGEX)
+	regex_t	re;
+#elif defined (USE_PCRE)
+	pcre	*re;
+	int		group_count;
+#endif
+	list<pair<string,int> >::iterator	lru;
+};
+
+typedef pair<string,int> RegexKey;
+typedef map<RegexKey, CompiledRegex*> RegexCache;
+
+static const size_t REGEX_CACHE_MAX = 128;
+
+static RegexCache		regexCache;
+static list<RegexKey>	regexLru;	// most recently used first
+static int				regexCacheHits = 0;
+static int				regexCacheMisses = 0;
+
+static void regex_free( CompiledRegex *cre )
+{
+#if defined (USE_POSIX_REGEX)
+	regfree( &cre->re );
+#elif defined (USE_PCRE)
+	pcre_free( cre->re );
+#endif
+	delete cre;
+}
+
+// Compile options for a pattern, from the options argument of the
+// regexp builtins and whether the match groups will be needed
+static int regex_options( bool have_options, const string &options_string,
+	bool want_groups )
+{
+	int options;
+
+#if defined (USE_POSIX_REGEX)
+    options = REG_EXTENDED;
+	if( !want_groups ) {
+		options |= REG_NOSUB;
+	}
+    if( have_options ){
+        // We look for the options we understand, and ignore
+        // any others that we might find, hopefully allowing
+        // forwards compatibility.
+        if ( options_string.find( 'i' ) != string::npos ) {
+            options |= REG_ICASE;
+        }
+    }
+#elif defined (USE_PCRE)
+		// PCRE always records the match groups
+	(void) want_groups;
+    options     = 0;
+    if( have_options ){
+        // We look for the options we understand, and ignore
+        // any others that we might find, hopefully allowing
+        // forwards compatibility.
+        if ( options_string.find( 'i' ) != string::npos ) {
+            options |= PCRE_CASELESS;
+        } 
+        if ( options_string.find( 'm' ) != string::npos ) {
+            options |= PCRE_MULTILINE;
+        }
+        if ( options_string.find( 's' ) != string::npos ) {
+            options |= PCRE_DOTALL;
+        }
+        if ( options_string.find( 'x' ) != string::npos ) {
+            options |= PCRE_EXTENDED;
+        }
+    }
+#endif
+
+	return options;
+}
+
+// Find a compiled pattern in the cache, compiling it on a miss.
+// Returns NULL if the pattern is in error; those are not cached.
+static CompiledRegex *regex_lookup( const char *pattern, int options,
+	bool count )
+{
+	RegexKey key( pattern, options );
+	RegexCache::iterator itr = regexCache.find( key );
+
+	if( itr != regexCache.end( ) ) {
+		CompiledRegex *cre = itr->second;
+		if( count ) regexCacheHits++;
+		regexLru.splice( regexLru.begin( ), regexLru, cre->lru );
+		return cre;
+	}
+
+	if( count ) regexCacheMisses++;
+
+	CompiledRegex *cre = new CompiledRegex;
+#if defined (USE_POSIX_REGEX)
+	if( regcomp( &cre->re, pattern, options ) != 0 ) {
+		delete cre;
+		return NULL;
+	}
+#elif defined (USE_PCRE)
+    const char  *error_message;
+    int         error_offset;
+
+    cre->re = pcre_compile( pattern, options, &error_message,
+                      &error_offset, NULL );
+	if( cre->re == NULL ) {
+		delete cre;
+		return NULL;
+	}
+	pcre_fullinfo( cre->re, NULL, PCRE_INFO_CAPTURECOUNT, &cre->group_count );
+#endif
+
+	if( regexCache.size( ) >= REGEX_CACHE_MAX ) {
+		RegexCache::iterator oldest = regexCache.find( regexLru.back( ) );
+		regex_free( oldest->second );
+		regexCache.erase( oldest );
+		regexLru.pop_back( );
+	}
+
+	regexLru.push_front( key );
+	cre->lru = regexLru.begin( );
+	regexCache[key] = cre;
+	return cre;
+}
+
+// When a regexp builtin is parsed with a literal pattern, and literal
+// options if any, compile the pattern right away so that the first
+// evaluation already finds it in the cache.
+void FunctionCall::
+regexp_precompile( FunctionCall *fc )
+{
+	size_t		pattern_arg = 0, options_arg;
+	bool		want_groups;
+	Value		val;
+	const char	*pattern;
+	string		options_string;
+	bool		have_options = false;
+
+	if( fc->function == (ClassAdFunc)matchPattern ||
+		fc->function == (ClassAdFunc)matchPatternMember ) {
+		options_arg = 2;
+		want_groups = false;
+	} else if( fc->function == (ClassAdFunc)substPattern ) {
+		options_arg = 3;
+		want_groups = true;
+	} else {
+		return;
+	}
+
+	if( fc->arguments.size( ) <= pattern_arg ||
+		fc->arguments.size( ) > options_arg + 1 ||
+		fc->arguments[pattern_arg]->GetKind( ) != LITERAL_NODE ) {
+		return;
+	}
+	if( fc->arguments.size( ) == options_arg + 1 ) {
+		if( fc->arguments[options_arg]->GetKind( ) != LITERAL_NODE ) {
+			return;
+		}
+		((Literal*)fc->arguments[options_arg])->GetValue( val );
+		if( !val.IsStringValue( options_string ) ) {
+			return;
+		}
+		have_options = true;
+	}
+
+	((Literal*)fc->arguments[pattern_arg])->GetValue( val );
+	if( !val.IsStringValue( pattern ) ) {
+		return;
+	}
+	regex_lookup( pattern,
+		regex_options( have_options, options_string, want_groups ), false );
+}
+
 static bool regexp_helper(const char *pattern, const char *target,
                           const char *replace,
                           bool have_options, string options_string,
@@ -2549,41 +2735,26 @@ static bool regexp_helper(
     string     options_string,
     Value      &result)
 {
-    int         options;
 	int			status;
+	CompiledRegex *cre;
 
-#if defined (USE_POSIX_REGEX)
-	regex_t		re;
+		// find the compiled pattern
+	cre = regex_lookup( pattern,
+		regex_options( have_options, options_string, replace != NULL ), true );
 
+#if defined (USE_POSIX_REGEX)
 	const int MAX_REGEX_GROUPS=11;
 	regmatch_t pmatch[MAX_REGEX_GROUPS];
 	size_t      nmatch = MAX_REGEX_GROUPS;
 
-    options = REG_EXTENDED;
-	if( !replace ) {
-		options |= REG_NOSUB;
-	}
-    if( have_options ){
-        // We look for the options we understand, and ignore
-        // any others that we might find, hopefully allowing
-        // forwards compatibility.
-        if ( options_string.find( 'i' ) != string::npos ) {
-            options |= REG_ICASE;
-        }
-    }
-
-		// compile the patern
-	if( regcomp( &re, pattern, options ) != 0 ) {
+	if( !cre ) {
 			// error in pattern
 		result.SetErrorValue( );
 		return( true );
 	}
 
 		// test the match
-	status = regexec( &re, target, nmatch, pmatch, 0 );
-
-		// dispose memory created by regcomp()
-	regfree( &re );
+	status = regexec( &cre->re, target, nmatch, pmatch, 0 );
 
 	if( status == 0 && replace ) {
 		string group_buffers[MAX_REGEX_GROUPS];
@@ -2651,42 +2822,15 @@ static bool regexp_helper(
 		return( true );
 	}
 #elif defined (USE_PCRE)
-    const char  *error_message;
-    int         error_offset;
-    pcre        *re;
-
-    options     = 0;
-    if( have_options ){
-        // We look for the options we understand, and ignore
-        // any others that we might find, hopefully allowing
-        // forwards compatibility.
-        if ( options_string.find( 'i' ) != string::npos ) {
-            options |= PCRE_CASELESS;
-        } 
-        if ( options_string.find( 'm' ) != string::npos ) {
-            options |= PCRE_MULTILINE;
-        }
-        if ( options_string.find( 's' ) != string::npos ) {
-            options |= PCRE_DOTALL;
-        }
-        if ( options_string.find( 'x' ) != string::npos ) {
-            options |= PCRE_EXTENDED;
-        }
-    }
-
-    re = pcre_compile( pattern, options, &error_message,
-                      &error_offset, NULL );
-    if ( re == NULL ){
+    if ( cre == NULL ){
 			// error in pattern
 		result.SetErrorValue( );
     } else {
-		int group_count;
-		pcre_fullinfo(re, NULL, PCRE_INFO_CAPTURECOUNT, &group_count);
-		int oveccount = 3 * (group_count + 1); // +1 for the string itself
+		int oveccount = 3 * (cre->group_count + 1); // +1 for the string itself
 		int * ovector = (int *) malloc(oveccount * sizeof(int));
 
 
-        status = pcre_exec(re, NULL, target, strlen(target),
+        status = pcre_exec(cre->re, NULL, target, strlen(target),
                            0, 0, ovector, oveccount);
         if (status >= 0) {
             result.SetBooleanValue( true );
@@ -2694,8 +2838,6 @@ static bool regexp_helper(
             result.SetBooleanValue( false );
         }
 
-		pcre_free(re);
-
 		if( replace && status<0 ) {
 			result.SetStringValue( "" );
 		}
@@ -2747,6 +2889,18 @@ static bool regexp_helper(
 
 #endif /* defined USE_POSIX_REGEX || defined USE_PCRE */
 
+void FunctionCall::
+GetRegexCacheStats( int &hits, int &misses, int &entries )
+{
+#if defined USE_POSIX_REGEX || defined USE_PCRE
+	hits = regexCacheHits;
+	misses = regexCacheMisses;
+	entries = (int)regexCache.size( );
+#else
+	hits = misses = entries = 0;
+#endif
+}
+
 static bool 
 doSplitTime(const Value &time, ClassAd * &splitClassAd)
 {
@@ -471,6 +471,13 @@ GetValue( Value &val ) const
 }
 
 
+void Literal::
+SetValue( const Value &val )
+{
+	value.CopyFrom( val );
+	factor = Value::NO_FACTOR;
+}
+
 void Literal::
 GetComponents( Value &val, Value::NumberFactor &f ) const
 {
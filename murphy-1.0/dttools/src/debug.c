@@ -288,3 +288,8 @@ void debug_flags_restore(INT64_T fl)
 {
 	debug_flags = fl;
 }
+
+int debug_flags_active(INT64_T flags)
+{
+	return (flags & debug_flags) ? 1 : 0;
+}
@@ -100,6 +100,7 @@ transparently modify the linker namespace we are using.
 #define debug_flags_print      cctools_debug_flags_print
 #define debug_flags_clear      cctools_debug_flags_clear
 #define debug_flags_restore    cctools_debug_flags_restore
+#define debug_flags_active     cctools_debug_flags_active
 #define debug_set_flag_name    cctools_debug_set_flag_name
 
 /** Emit a debugging message.
@@ -182,4 +183,11 @@ void debug_set_flag_name(INT64_T flag, const char *name);
 */
 void debug_flags_restore(INT64_T flags);
 
+/** Check whether debugging output is enabled.
+Useful to skip building an expensive debugging message that would be discarded.
+@param flags Any of the standard debugging flags OR-ed together.
+@return One if any of the given flags are active, zero otherwise.
+*/
+int debug_flags_active(INT64_T flags);
+
 #endif
@@ -1,15 +1,26 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <math.h>
+#include <ctype.h>
+#include <time.h>
 #include "controller.h"
 #include "controller_private.h"
 #include "pfs_dispatch.h"  // for suspend_and_gdb
+#include "gremlin_log.h"
+
+extern "C" {
+#include "tracer.h"	// for SYSCALL64_*
+}
 
 // globals set in main via command-line
 extern char *gremlin_log_file;
 extern char *gremlin_replay_file;
 extern bool gremlin_replay_gdb;
 extern char *murphy_config_file;
+extern char *gremlin_schedule;
+extern char *gremlin_stats_file;
+extern bool gremlin_stats;
 
 static controller* _controller = NULL;
 
@@ -26,6 +37,7 @@ static controller* _controller = NULL;
 
 #define DLEVEL
 #define debug printf
+#define debug_flags_active(flags) 1
 
 
 int
@@ -33,43 +45,48 @@ main()
 {
 	controller c;
 	controller_context_t context;
+	gremlin_entry gremlins[GREMLIN_MAX];
 
+	memset(gremlins,0,sizeof(gremlins));
 	context.syscall_count = 1;
 	context.pid = 66;
 	context.childnum = 1;
 	context.ioctl_meta = "In foo()";
+	context.gremlins = gremlins;
 
 	c.init(NULL);
 	
 
-	controller_doevil("read",&context,NULL);
-	controller_doevil("read",&context,NULL);
-	controller_doevil("write",&context,NULL);
-	controller_doevil("write",&context,NULL);
-	controller_doevil("foo",&context,NULL);
-	controller_doevil("bar",&context,NULL);
+	controller_doevil(GREMLIN_READONE,&context,NULL);
+	controller_doevil(GREMLIN_READONE,&context,NULL);
+	controller_doevil(GREMLIN_WRITEONE,&context,NULL);
+	controller_doevil(GREMLIN_WRITEONE,&context,NULL);
+	controller_doevil(GREMLIN_EINTR,&context,NULL);
+	controller_doevil(GREMLIN_EAGAIN,&context,NULL);
 
 
 	controller_setconfig("default:80");
 
-	controller_doevil("read",&context,NULL);
-	controller_doevil("read",&context,NULL);
-	controller_doevil("write",&context,NULL);
-	controller_doevil("write",&context,NULL);
-	controller_doevil("foo",&context,NULL);
-	controller_doevil("foo",&context,NULL);
-	controller_doevil("bar",&context,NULL);
-	controller_doevil("bar",&context,NULL);
+	controller_doevil(GREMLIN_READONE,&context,NULL);
+	controller_doevil(GREMLIN_READONE,&context,NULL);
+	controller_doevil(GREMLIN_WRITEONE,&context,NULL);
+	controller_doevil(GREMLIN_WRITEONE,&context,NULL);
+	controller_doevil(GREMLIN_EINTR,&context,NULL);
+	controller_doevil(GREMLIN_EINTR,&context,NULL);
+	controller_doevil(GREMLIN_EAGAIN,&context,NULL);
+	controller_doevil(GREMLIN_EAGAIN,&context,NULL);
 
+	memset(gremlins,0,sizeof(gremlins));
 	context.pid = 67;
-	controller_doevil("read",&context,NULL);
-	controller_doevil("read",&context,NULL);
-	controller_doevil("write",&context,NULL);
-	controller_doevil("write",&context,NULL);
-	controller_doevil("foo",&context,NULL);
-	controller_doevil("foo",&context,NULL);
-	controller_doevil("bar",&context,NULL);
-	controller_doevil("bar",&context,NULL);
+	context.childnum = 2;
+	controller_doevil(GREMLIN_READONE,&context,NULL);
+	controller_doevil(GREMLIN_READONE,&context,NULL);
+	controller_doevil(GREMLIN_WRITEONE,&context,NULL);
+	controller_doevil(GREMLIN_WRITEONE,&context,NULL);
+	controller_doevil(GREMLIN_EINTR,&context,NULL);
+	controller_doevil(GREMLIN_EINTR,&context,NULL);
+	controller_doevil(GREMLIN_EAGAIN,&context,NULL);
+	controller_doevil(GREMLIN_EAGAIN,&context,NULL);
 
 	return 0;
 }
@@ -80,16 +97,16 @@ main()
 /** PUBLIC INTERFACE **/
 
 bool
-controller_doevil(const char *gremlin_name,
+controller_doevil(int gremlin,
 	const controller_context_t *context,
-	const char *classad_context)
+	controller_syscall_t *syscall_context)
 {
 	if (! _controller ) {
 		_controller = new controller;
 		_controller->init(NULL);
 	}
 
-	return _controller->doevil(gremlin_name,context,classad_context);
+	return _controller->doevil(gremlin,context,syscall_context);
 }
 
 bool
@@ -112,6 +129,243 @@ controller_init()
 	return _controller->init(NULL);
 }
 
+// indexed by gremlin_id; must stay in the same order as the enum
+static const char *gremlin_names[GREMLIN_MAX] = {
+	"readone",
+	"readone_s",
+	"readless",
+	"writeone",
+	"writeone_s",
+	"writeless",
+	"writezero",
+	"eintr",
+	"eagain",
+	"enospc",
+	"closefail",
+	"selectfdset",
+	"cwdlongpath",
+	"sleepy1",
+	"sleepy10th",
+	"sleepy100th",
+	"sleepy1000th",
+};
+
+const char *
+controller_gremlin_name(int gremlin)
+{
+	if ( gremlin < 0 || gremlin >= GREMLIN_MAX ) {
+		return "unknown";
+	}
+	return gremlin_names[gremlin];
+}
+
+int
+controller_gremlin_lookup(const char *name)
+{
+	for ( int i = 0; i < GREMLIN_MAX; i++ ) {
+		if ( strcmp(name,gremlin_names[i]) == 0 ) {
+			return i;
+		}
+	}
+	return -1;
+}
+
+void
+controller_flush_log()
+{
+	if ( _controller ) {
+		_controller->flush_log();
+	}
+}
+
+void
+controller_report()
+{
+	if ( _controller ) {
+		_controller->report();
+	}
+}
+
+void
+controller_print_stats(FILE *file)
+{
+	if ( _controller ) {
+		_controller->print_stats(file);
+	}
+}
+
+gremlin_mask_t
+controller_syscall_mask(int64_t syscall)
+{
+	if (! _controller ) {
+		_controller = new controller;
+		_controller->init(NULL);
+	}
+
+	return _controller->syscall_mask(syscall);
+}
+
+void
+controller_advance(int64_t syscall_count, bool entering)
+{
+	if ( _controller ) {
+		_controller->advance(syscall_count,entering);
+	}
+}
+
+/*
+Syscalls on which the dispatcher implements each gremlin.  The sleepy
+gremlins apply to every syscall, including ones we have no number for.
+*/
+
+#define GREMLIN_ANY_SYSCALL ( GREMLIN_BIT(GREMLIN_SLEEPY1) | \
+	GREMLIN_BIT(GREMLIN_SLEEPY10TH) | GREMLIN_BIT(GREMLIN_SLEEPY100TH) | \
+	GREMLIN_BIT(GREMLIN_SLEEPY1000TH) )
+
+#define GREMLIN_READ_GREMLINS ( GREMLIN_BIT(GREMLIN_READONE) | \
+	GREMLIN_BIT(GREMLIN_READONE_S) | GREMLIN_BIT(GREMLIN_READLESS) )
+
+#define GREMLIN_WRITE_GREMLINS ( GREMLIN_BIT(GREMLIN_WRITEONE) | \
+	GREMLIN_BIT(GREMLIN_WRITEONE_S) | GREMLIN_BIT(GREMLIN_WRITELESS) | \
+	GREMLIN_BIT(GREMLIN_WRITEZERO) )
+
+static const int read_syscalls[] = {
+	SYSCALL64_read,
+	SYSCALL64_pread,
+	SYSCALL64_recvfrom,
+	SYSCALL64_readv,
+	SYSCALL64_preadv,
+};
+
+static const int write_syscalls[] = {
+	SYSCALL64_write,
+	SYSCALL64_pwrite,
+	SYSCALL64_sendto,
+	SYSCALL64_writev,
+	SYSCALL64_pwritev,
+};
+
+static const int enospc_syscalls[] = {
+	SYSCALL64_inotify_add_watch,
+	SYSCALL64_mknod,
+	SYSCALL64_open,
+	SYSCALL64_sync_file_range,
+	SYSCALL64_symlink,
+	SYSCALL64_fsetxattr,
+	SYSCALL64_semop,
+	SYSCALL64_lsetxattr,
+	SYSCALL64_write,
+	SYSCALL64_mkdir,
+	SYSCALL64_shmget,
+	SYSCALL64_query_module,
+	SYSCALL64_shmctl,
+	SYSCALL64_setxattr,
+	SYSCALL64_msgget,
+	SYSCALL64_rename,
+	SYSCALL64_semget,
+	SYSCALL64_link,
+};
+
+static const int eintr_syscalls[] = {
+	SYSCALL64_close,
+	SYSCALL64_request_key,
+	SYSCALL64_stat,
+	SYSCALL64_futex,
+	SYSCALL64_poll,
+	SYSCALL64_chown,
+	SYSCALL64_rt_sigsuspend,
+	SYSCALL64_wait4,
+	SYSCALL64_init_module,
+	SYSCALL64_delete_module,
+	SYSCALL64_mknod,
+	SYSCALL64_unlink,
+	SYSCALL64_statfs,
+	SYSCALL64_select,
+	SYSCALL64_epoll_wait,
+	SYSCALL64_read,
+	SYSCALL64_semop,
+	SYSCALL64_utime,
+	SYSCALL64_write,
+	SYSCALL64_rt_sigtimedwait,
+	SYSCALL64_execve,
+	SYSCALL64_pause,
+	SYSCALL64_truncate,
+	SYSCALL64_flock,
+	SYSCALL64_fcntl,
+	SYSCALL64_connect,
+	SYSCALL64_nanosleep,
+	SYSCALL64_dup,
+	SYSCALL64_chroot,
+	SYSCALL64_ustat,
+	SYSCALL64_accept,
+};
+
+static const int eagain_syscalls[] = {
+	SYSCALL64_madvise,
+	SYSCALL64_getrlimit,
+	SYSCALL64_mprotect,
+	SYSCALL64_futex,
+	SYSCALL64_setuid,
+	SYSCALL64_sendfile,
+	SYSCALL64_read,
+	SYSCALL64_setresuid,
+	SYSCALL64_mlock,
+	SYSCALL64_semop,
+	SYSCALL64_io_submit,
+	SYSCALL64_write,
+	SYSCALL64_io_cancel,
+	SYSCALL64_clone,
+	SYSCALL64_tee,
+	SYSCALL64_rt_sigtimedwait,
+	SYSCALL64_execve,
+	SYSCALL64_fork,
+	SYSCALL64_truncate,
+	SYSCALL64_fcntl,
+	SYSCALL64_mmap,
+	SYSCALL64_mount,
+	SYSCALL64_timer_create,
+	SYSCALL64_mremap,
+	SYSCALL64_mincore,
+	SYSCALL64_vmsplice,
+	SYSCALL64_accept,
+	SYSCALL64_io_setup,
+	SYSCALL64_semget,
+};
+
+static const int closefail_syscalls[] = { SYSCALL64_close };
+static const int selectfdset_syscalls[] = { SYSCALL64_select };
+static const int cwdlongpath_syscalls[] = { SYSCALL64_getcwd };
+
+// gremlins implemented for each syscall, whether armed or not
+static gremlin_mask_t gremlin_eligible[SYSCALL64_MAX];
+
+static void
+eligible_add(gremlin_mask_t gremlins, const int *syscalls, int n)
+{
+	for ( int i = 0; i < n; i++ ) {
+		gremlin_eligible[syscalls[i]] |= gremlins;
+	}
+}
+
+#define ELIGIBLE_ADD(gremlins,list) \
+	eligible_add(gremlins,list,sizeof(list)/sizeof(list[0]))
+
+static void
+eligible_init()
+{
+	for ( int i = 0; i < SYSCALL64_MAX; i++ ) {
+		gremlin_eligible[i] = GREMLIN_ANY_SYSCALL;
+	}
+	ELIGIBLE_ADD(GREMLIN_READ_GREMLINS,read_syscalls);
+	ELIGIBLE_ADD(GREMLIN_WRITE_GREMLINS,write_syscalls);
+	ELIGIBLE_ADD(GREMLIN_BIT(GREMLIN_ENOSPC),enospc_syscalls);
+	ELIGIBLE_ADD(GREMLIN_BIT(GREMLIN_EINTR),eintr_syscalls);
+	ELIGIBLE_ADD(GREMLIN_BIT(GREMLIN_EAGAIN),eagain_syscalls);
+	ELIGIBLE_ADD(GREMLIN_BIT(GREMLIN_CLOSEFAIL),closefail_syscalls);
+	ELIGIBLE_ADD(GREMLIN_BIT(GREMLIN_SELECTFDSET),selectfdset_syscalls);
+	ELIGIBLE_ADD(GREMLIN_BIT(GREMLIN_CWDLONGPATH),cwdlongpath_syscalls);
+}
+
 /** IMPLEMENTATION **/
 
 int 
@@ -138,15 +392,311 @@ gremlin_config_entry::gremlin_config_entry()
 	seed = ++num_entries;
 	percent_on = 0;
 	constraint_tree = NULL;
+	attr_refs = 0;
+	skip_log = 0;
 }
 
 
 controller::controller() :
-	gremlin_table(200, hashFuncMyString,rejectDuplicateKeys),
 	gremlin_config_table(20,hashFuncMyString,updateDuplicateKeys),
-	gremlin_replay_table(200, hashFuncMyString,rejectDuplicateKeys)
+	log_meta_ids(20, hashFuncMyString,rejectDuplicateKeys)
 {
 	gremlin_log_fd = 0;
+	log_buf = NULL;
+	log_len = 0;
+	log_meta_count = 0;
+	logged_armed = 0;
+	for ( int i = 0; i < GREMLIN_MAX; i++ ) {
+		gremlin_configs[i] = NULL;
+		gremlin_eval_ads[i].bind(gremlin_names[i]);
+	}
+	eligible_init();
+	armed_gremlins = 0;
+	syscall_masks = new gremlin_mask_t[SYSCALL64_MAX];
+	memset(syscall_masks,0,SYSCALL64_MAX*sizeof(gremlin_mask_t));
+	unknown_syscall_mask = 0;
+	replay_gremlins = 0;
+	replay_arm_next = 0;
+	replay_armed = 0;
+	syscall_count = 0;
+	replay_pending = 0;
+	replay_total = replay_done = replay_divergent = replay_skipped = 0;
+	for ( int i = 0; i < GREMLIN_MAX; i++ ) {
+		gremlin_replay_index[i].fill(NULL);
+	}
+	schedule_skip = false;
+	config_gen = 0;
+	memset(stats,0,sizeof(stats));
+	stats_timing = false;
+	bind_configs();
+}
+
+static const char *eval_slot_names[EVAL_SLOT_MAX] = {
+	"Gremlin",
+	"SyscallCount",
+	"InvokedCount",
+	"EvilCount",
+	"Pid",
+	"ChildNum",
+	"SyscallName",
+	"SyscallNum",
+	"Meta",
+};
+
+static const char *gremlin_attr_names[GREMLIN_ATTR_MAX] = {
+	"FD",
+	"Name",
+	"Length",
+	"Offset",
+	"O_CREAT",
+	"PathSet",
+	"PathLen",
+};
+
+/*
+Find which syscall attributes a constraint refers to, so that doevil
+only asks the dispatcher for those.  If the references cannot be
+determined, assume the constraint needs all of them.
+*/
+
+static unsigned int
+constraint_attr_refs(ExprTree *tree)
+{
+	ClassAd empty;
+	References refs;
+	unsigned int mask = 0;
+
+	if ( !empty.GetExternalReferences(tree,refs,false) ) {
+		return ~0u;
+	}
+	for ( int i = 0; i < GREMLIN_ATTR_MAX; i++ ) {
+		if ( refs.find(gremlin_attr_names[i]) != refs.end() ) {
+			mask |= GREMLIN_ATTR_BIT(i);
+		}
+	}
+	return mask;
+}
+
+gremlin_eval_ad::gremlin_eval_ad()
+{
+	for ( int i = 0; i < EVAL_SLOT_MAX; i++ ) {
+		slots[i] = NULL;
+	}
+	for ( int i = 0; i < GREMLIN_ATTR_MAX; i++ ) {
+		attr_slots[i] = NULL;
+	}
+}
+
+/*
+Create one literal per slot and insert it into the ad.  From here on
+doevil only overwrites the literal values; the ad itself is never
+rebuilt.
+*/
+
+void
+gremlin_eval_ad::bind(const char *gname)
+{
+	Value val;
+
+	ad.DisableDirtyTracking();
+	for ( int i = 0; i < EVAL_SLOT_MAX; i++ ) {
+		if ( i == EVAL_SLOT_GREMLIN ) {
+			val.SetStringValue(gname);
+		} else if ( i == EVAL_SLOT_SYSCALLNAME || i == EVAL_SLOT_META ) {
+			val.SetStringValue("");
+		} else {
+			val.SetIntegerValue(0);
+		}
+		slots[i] = Literal::MakeLiteral(val);
+		ad.Insert(eval_slot_names[i],slots[i]);
+	}
+	val.SetUndefinedValue();
+	for ( int i = 0; i < GREMLIN_ATTR_MAX; i++ ) {
+		attr_slots[i] = Literal::MakeLiteral(val);
+		ad.Insert(gremlin_attr_names[i],attr_slots[i]);
+	}
+}
+
+static void
+eval_slot_set(Literal *slot, int value)
+{
+	Value val;
+	val.SetIntegerValue(value);
+	slot->SetValue(val);
+}
+
+static void
+eval_slot_set(Literal *slot, const char *value)
+{
+	Value val;
+	val.SetStringValue(value ? value : "");
+	slot->SetValue(val);
+}
+
+/*
+Load the syscall attribute slots for one constraint check.  Attributes
+the constraint refers to are resolved on demand; everything else, and
+anything this syscall does not have, reads as undefined.
+*/
+
+static void
+eval_attrs_set(gremlin_eval_ad *eval, unsigned int attr_refs,
+		controller_syscall_t *sc)
+{
+	Value undefined;
+	undefined.SetUndefinedValue();
+
+	for ( int i = 0; i < GREMLIN_ATTR_MAX; i++ ) {
+		unsigned int bit = GREMLIN_ATTR_BIT(i);
+		Literal *slot = eval->attr_slots[i];
+
+		if ( !sc || !(attr_refs & bit) || !(sc->present & bit) ) {
+			slot->SetValue(undefined);
+			continue;
+		}
+		if ( !(sc->resolved & bit) ) {
+			sc->resolve(sc,i);
+			sc->resolved |= bit;
+		}
+		switch ( i ) {
+			case GREMLIN_ATTR_FD:
+				eval_slot_set(slot,(int)sc->fd);
+				break;
+			case GREMLIN_ATTR_NAME:
+				eval_slot_set(slot,sc->name);
+				break;
+			case GREMLIN_ATTR_LENGTH:
+				eval_slot_set(slot,(int)sc->length);
+				break;
+			case GREMLIN_ATTR_OFFSET:
+				eval_slot_set(slot,(int)sc->offset);
+				break;
+			case GREMLIN_ATTR_O_CREAT: {
+				Value val;
+				val.SetBooleanValue(sc->o_creat);
+				slot->SetValue(val);
+				break;
+			}
+			case GREMLIN_ATTR_PATHSET:
+				eval_slot_set(slot,sc->pathset);
+				break;
+			case GREMLIN_ATTR_PATHLEN:
+				eval_slot_set(slot,sc->pathlen);
+				break;
+		}
+	}
+}
+
+/*
+Resolve the config entry for every gremlin id, so that doevil never
+has to look a gremlin up by name.  Gremlins without an entry of their
+own use the default entry.  Then recompute which gremlins are armed,
+that is, can fire at all: those with a nonzero percentage, plus any
+named in the replay log.  Unarmed gremlins are left out of every
+syscall mask, so the dispatcher never asks about them, and their
+invocation counts do not advance.  Redone on every config change.
+
+A replay log that records when each gremlin was armed is followed
+instead, so that invocations are counted over the same syscalls as
+when it was written.  Older logs come from versions that counted
+every invocation, so their gremlins are armed from the start.
+*/
+
+void
+controller::bind_configs()
+{
+	gremlin_config_entry *config;
+	gremlin_config_entry *default_config = NULL;
+
+	gremlin_config_table.lookup( MyString("default"), default_config );
+
+	for ( int i = 0; i < GREMLIN_MAX; i++ ) {
+		config = NULL;
+		gremlin_config_table.lookup( MyString(gremlin_names[i]), config );
+		gremlin_configs[i] = config ? config : default_config;
+	}
+
+	gremlin_mask_t armed = replay_gremlins;
+	if ( replay_arms.length() > 0 ) {
+		armed = replay_armed;
+	} else {
+		for ( int i = 0; i < GREMLIN_MAX; i++ ) {
+			if ( gremlin_configs[i] && gremlin_configs[i]->percent_on > 0 ) {
+				armed |= GREMLIN_BIT(i);
+			}
+		}
+	}
+
+	config_gen++;
+	set_armed(armed);
+}
+
+/*
+Rebuild the syscall masks for a new set of armed gremlins, and tell
+the log about every gremlin that was armed or disarmed since it last
+heard, so that a replay can follow along.
+*/
+
+void
+controller::set_armed(gremlin_mask_t mask)
+{
+	if ( gremlin_log_fd > 0 && mask != logged_armed ) {
+		for ( int i = 0; i < GREMLIN_MAX; i++ ) {
+			if ( (mask ^ logged_armed) & GREMLIN_BIT(i) ) {
+				write_arm_entry(i, (mask & GREMLIN_BIT(i)) != 0);
+			}
+		}
+		logged_armed = mask;
+	}
+
+	if ( mask == armed_gremlins ) return;
+	armed_gremlins = mask;
+
+	for ( int i = 0; i < SYSCALL64_MAX; i++ ) {
+		syscall_masks[i] = gremlin_eligible[i] & mask;
+	}
+	unknown_syscall_mask = GREMLIN_ANY_SYSCALL & mask;
+}
+
+/*
+Note the syscall being dispatched, and apply the replay log's arm
+records that are due.  A config update takes effect on entry to the
+syscall that made it, so a record at that SyscallCount applies from
+the exit of the same syscall.
+*/
+
+void
+controller::advance(int64_t count, bool entering)
+{
+	int n = replay_arm_next;
+
+	syscall_count = count;
+
+	while ( n < replay_arms.length() &&
+		( replay_arms[n].syscall < count ||
+		  ( replay_arms[n].syscall == count && !entering ) ) )
+	{
+		if ( replay_arms[n].armed ) {
+			replay_armed |= GREMLIN_BIT(replay_arms[n].gremlin);
+		} else {
+			replay_armed &= ~GREMLIN_BIT(replay_arms[n].gremlin);
+		}
+		n++;
+	}
+
+	if ( n != replay_arm_next ) {
+		replay_arm_next = n;
+		set_armed(replay_armed);
+	}
+}
+
+gremlin_mask_t
+controller::syscall_mask(int64_t syscall)
+{
+	if ( syscall < 0 || syscall >= SYSCALL64_MAX ) {
+		return unknown_syscall_mask;
+	}
+	return syscall_masks[syscall];
 }
 
 bool
@@ -184,8 +734,10 @@ controller::setconfig(const char* config_line)
 	// if we just allocated it, else delete it if we just 
 	// allocated it.
 	if ( process_config_line(line,entry) ) {
-		if (newlyCreated)
+		if (newlyCreated) {
 			gremlin_config_table.insert(entry->name,entry);
+		}
+		bind_configs();
 		ret_value =  true;
 	} else {
 		if (newlyCreated)
@@ -261,6 +813,12 @@ controller::process_config_line(MyString & line,
 	}
 
 	// If we made it here, all parsed ok
+
+	if ( name != "default" && controller_gremlin_lookup(name.Value()) < 0 ) {
+		debug ( DLEVEL 
+		  "controller gremlin %s is unknown and will never be invoked\n",
+		  name.Value());
+	}
 	
 	entry->name = name;
 	// for seed, a value of 0 means use default seed which
@@ -269,50 +827,191 @@ controller::process_config_line(MyString & line,
 		entry->seed = seed;
 	if ( percent >= 0 && percent < 101 ) 
 		entry->percent_on = percent;
+	entry->skip_log = log(1.0 - entry->percent_on / 100.0);
 	if ( constraint ) {
 		entry->constraint = constraint;
 		entry->constraint.trim();
 		if (entry->constraint_tree) delete entry->constraint_tree;
 		entry->constraint_tree = constraint_tree;
+		entry->attr_refs = constraint_attr_refs(constraint_tree);
 	}
 
 	return true;
 }
 
-gremlin_entry::gremlin_entry()
+gremlin_replay_entry::gremlin_replay_entry()
 {
-	config = NULL;
-	seed_initialized = false;
-	seed = 0;
-	pid = 0;
-	child_num = 0;
-	thissys_counter = 0;
-	evil_counter = 0;
-	replay = false;
-	evil_array_size = 0;
+	current_entry = 0;
+	divergent = 0;
 }
 
-gremlin_entry::~gremlin_entry()
+void
+controller::add_replay_entry(const char *gname, unsigned int childnum,
+	int64_t invoked_i, int64_t syscall_i)
 {
+	gremlin_replay_entry *replay_entry = NULL;
+	gremlin_replay_event event;
+	int gremlin = controller_gremlin_lookup(gname);
+
+	if ( gremlin < 0 ) {
+		replay_skipped++;
+		return;
+	}
+
+	ExtArray<gremlin_replay_entry*> &by_child = gremlin_replay_index[gremlin];
+	if ( (int)childnum < by_child.length() ) {
+		replay_entry = by_child[childnum];
+	}
+	if (replay_entry == NULL ) {
+		replay_entry = new gremlin_replay_entry;
+		by_child.set(childnum,replay_entry);
+		replay_pending++;
+		debug( DLEVEL "controller entered replay_entry for %s.%u\n",gname,childnum);
+	}
+
+	event.invoked = invoked_i;
+	event.syscall = syscall_i;
+	replay_entry->events.add(event);
+	replay_total++;
+	replay_gremlins |= GREMLIN_BIT(gremlin);
 }
 
-gremlin_replay_entry::gremlin_replay_entry()
+void
+controller::add_replay_arm(const char *gname, bool armed, int64_t syscall_i)
 {
-	current_entry = 0;
+	gremlin_replay_arm arm;
+	int gremlin = controller_gremlin_lookup(gname);
+
+	if ( gremlin < 0 ) return;
+
+	arm.syscall = syscall_i;
+	arm.gremlin = gremlin;
+	arm.armed = armed;
+	replay_arms.add(arm);
+}
+
+static int
+replay_event_compare(const void *a, const void *b)
+{
+	int64_t x = ((const gremlin_replay_event *)a)->invoked;
+	int64_t y = ((const gremlin_replay_event *)b)->invoked;
+
+	return x < y ? -1 : x > y ? 1 : 0;
+}
+
+/*
+A log written by -g is already in invocation order for every entry,
+so this is normally just one pass to check that.
+*/
+
+void
+controller::sort_replay_entries()
+{
+	for ( int i = 0; i < GREMLIN_MAX; i++ ) {
+		ExtArray<gremlin_replay_entry*> &by_child = gremlin_replay_index[i];
+		for ( int c = 0; c < by_child.length(); c++ ) {
+			gremlin_replay_entry *replay_entry = by_child[c];
+			if ( !replay_entry ) continue;
+
+			gremlin_replay_event *events = replay_entry->events.getarray();
+			int n = replay_entry->events.length();
+			for ( int j = 1; j < n; j++ ) {
+				if ( events[j].invoked < events[j-1].invoked ) {
+					qsort(events,n,sizeof(events[0]),replay_event_compare);
+					break;
+				}
+			}
+		}
+	}
+}
+
+/*
+Parse one line of a text replay log in place:
+Gremlin EvilCount ChildNum InvokedCount SyscallCount Meta: ...
+*/
+
+static bool
+parse_replay_line(char *line, char **gname, unsigned int *childnum,
+	int64_t *invoked_i, int64_t *syscall_i)
+{
+	char *p = line;
+	char *end;
+
+	while ( isspace(*p) ) p++;
+	*gname = p;
+	while ( *p && !isspace(*p) ) p++;
+	if ( !*p || p == *gname ) return false;
+	*p++ = 0;
+
+	strtoll(p,&end,10);		// EvilCount, not needed to replay
+	if ( end == p ) return false;
+	p = end;
+	*childnum = strtoul(p,&end,10);
+	if ( end == p ) return false;
+	p = end;
+	*invoked_i = strtoll(p,&end,10);
+	if ( end == p ) return false;
+	p = end;
+	*syscall_i = strtoll(p,&end,10);
+	if ( end == p ) return false;
+
+	return true;
+}
+
+/*
+Parse an arm record of a text replay log in place, the line after
+the GREMLIN_LOG_TEXT_ARM tag: Gremlin on|off SyscallCount
+*/
+
+static bool
+parse_replay_arm(char *line, char **gname, bool *armed, int64_t *syscall_i)
+{
+	char *p = line;
+	char *end;
+
+	while ( isspace(*p) ) p++;
+	*gname = p;
+	while ( *p && !isspace(*p) ) p++;
+	if ( !*p || p == *gname ) return false;
+	*p++ = 0;
+
+	while ( isspace(*p) ) p++;
+	if ( strncmp(p,"on",2) == 0 ) {
+		*armed = true;
+		p += 2;
+	} else if ( strncmp(p,"off",3) == 0 ) {
+		*armed = false;
+		p += 3;
+	} else {
+		return false;
+	}
+	*syscall_i = strtoll(p,&end,10);
+	if ( end == p ) return false;
+
+	return true;
 }
 
+/*
+Load the replay log, which may be either a binary log as written
+by -g, or one in the older text layout, such as murphy_log2text
+produces.  Either way the log is streamed straight into the replay
+index, which is sorted once at the end.
+*/
+
 bool
 controller::read_log()
 {
 	FILE *fp = NULL;
-	MyString line;
-	MyString key;
+	char line[4096];
 	int result;
-	char gname[80];
+	char *gname;
 	unsigned int childnum;
-	int64_t invoked_i, syscall_i, evil_counter;
-	gremlin_replay_entry *replay_entry = NULL;
+	int64_t invoked_i, syscall_i;
+	bool armed;
 	unsigned int linenum = 0;
+	gremlin_log_reader *reader;
+	gremlin_log_entry event;
+	bool binary;
 
 	if (!gremlin_replay_file) return false;
 
@@ -322,160 +1021,387 @@ controller::read_log()
 			gremlin_replay_file, strerror(errno));
 		return false;
 	}
-	while (line.readLine(fp)) {
-		line.chomp();
-		line.trim();
-		linenum++;
-		if ( line.IsEmpty() || line[0] == '#' ) continue;
-		result = sscanf(line.Value(), "%s %lu %u %lu %lu Meta:\n",
-			gname, &evil_counter, &childnum,
-			&invoked_i, &syscall_i);
-		if ( result != 5 ) {
-			fatal("Failed to parse replay log - error on line %u\n",
+
+	reader = gremlin_log_reader_open(fp);
+	binary = reader != NULL;
+	if (binary) {
+		while ( (result = gremlin_log_reader_next(reader,&event)) == 1 ) {
+			linenum++;
+			if ( event.type == GREMLIN_LOG_ARM ) {
+				add_replay_arm(event.name, event.arm.armed != 0,
+					event.arm.syscall_count);
+				continue;
+			}
+			add_replay_entry(event.name, event.event.childnum,
+				event.event.invoked_count, event.event.syscall_count);
+		}
+		gremlin_log_reader_close(reader);
+		if ( result < 0 ) {
+			fatal("Failed to parse replay log - corrupt after record %u\n",
 				linenum);
 		}
-		/*
-	debug ( DLEVEL "controller replay line: %s %lu %u %lu %lu Meta:\n",
-			gname, evil_counter, childnum,
-			invoked_i, syscall_i);
-		*/
-
-		key.sprintf("%s.%u",gname,childnum);
-		replay_entry = NULL;
-		gremlin_replay_table.lookup(key,replay_entry);
-		if (replay_entry == NULL ) {
-			replay_entry = new gremlin_replay_entry;
-			gremlin_replay_table.insert(key,replay_entry);
-			debug( DLEVEL "controller entered replay_entry with key %s\n",key.Value());
+	} else {
+		while ( fgets(line,sizeof(line),fp) ) {
+			linenum++;
+			// only the leading fields matter, so drop the rest of
+			// a line with overly long metadata
+			if ( !strchr(line,'\n') ) {
+				int c;
+				while ( (c = getc(fp)) != EOF && c != '\n' ) ;
+			}
+			char *p = line;
+			while ( isspace(*p) ) p++;
+			if ( strncmp(p,GREMLIN_LOG_TEXT_ARM,strlen(GREMLIN_LOG_TEXT_ARM)) == 0 ) {
+				if ( !parse_replay_arm(p+strlen(GREMLIN_LOG_TEXT_ARM),&gname,&armed,&syscall_i) ) {
+					fatal("Failed to parse replay log - error on line %u\n",
+						linenum);
+				}
+				add_replay_arm(gname, armed, syscall_i);
+				continue;
+			}
+			if ( !*p || *p == '#' ) continue;
+			if ( !parse_replay_line(p,&gname,&childnum,&invoked_i,&syscall_i) ) {
+				fatal("Failed to parse replay log - error on line %u\n",
+					linenum);
+			}
+			add_replay_entry(gname, childnum, invoked_i, syscall_i);
 		}
-		replay_entry->invoked_index.add(invoked_i);
-		replay_entry->syscall_index.add(syscall_i);
 	}
 	fclose(fp);
 
-	debug ( DLEVEL "controller read %u lines from replay log\n", linenum);
+	sort_replay_entries();
+	// arm whatever was armed before the first syscall
+	advance(0,false);
+
+	debug ( DLEVEL "controller read %lld events for %d entries and %d arm records from replay log%s\n",
+		(long long)replay_total, replay_pending, replay_arms.length(),
+		binary ? " (binary)" : "");
+	if ( replay_skipped ) {
+		debug ( D_NOTICE, "controller ignoring %lld replay events of unknown gremlins\n",
+			(long long)replay_skipped);
+	}
 
 	return true;
 }
 
+/*
+The gremlin half of the -W summary: only gremlins that were asked
+about at all, with times in milliseconds.
+*/
+
+void
+controller::print_stats(FILE *file)
+{
+	fprintf(file,"\nMurphy Gremlin Summary:\n");
+	fprintf(file,"%-14s %10s %10s %10s %10s %11s %11s\n",
+		"gremlin","invoked","fired","evaluated","rejected",
+		"doevil(ms)","context(ms)");
+	for ( int i = 0; i < GREMLIN_MAX; i++ ) {
+		if ( !stats[i].invocations ) continue;
+		fprintf(file,"%-14s %10lld %10lld %10lld %10lld %11.3f %11.3f\n",
+			gremlin_names[i],
+			(long long)stats[i].invocations,
+			(long long)stats[i].firings,
+			(long long)stats[i].evaluations,
+			(long long)stats[i].rejections,
+			stats[i].doevil_ns / 1e6,
+			stats[i].context_ns / 1e6);
+	}
+}
+
+/*
+Called once tracing is over.  With -r, say how far the replay got
+and how often it fired at a different syscall count than recorded.
+*/
+
+void
+controller::report()
+{
+	int hits, misses, entries;
+
+	FunctionCall::GetRegexCacheStats(hits,misses,entries);
+	debug ( DLEVEL "controller regex cache: %d hits, %d misses, %d patterns\n",
+		hits, misses, entries);
+
+	if ( gremlin_stats_file ) {
+		FILE *file = fopen(gremlin_stats_file,"w");
+		if ( file ) {
+			fprintf(file,"#Gremlin Invocations Firings Evaluations Rejections DoevilNs ContextNs\n");
+			for ( int i = 0; i < GREMLIN_MAX; i++ ) {
+				fprintf(file,"%s %lld %lld %lld %lld %lld %lld\n",
+					gremlin_names[i],
+					(long long)stats[i].invocations,
+					(long long)stats[i].firings,
+					(long long)stats[i].evaluations,
+					(long long)stats[i].rejections,
+					(long long)stats[i].doevil_ns,
+					(long long)stats[i].context_ns);
+			}
+			fclose(file);
+		} else {
+			debug ( D_NOTICE, "controller couldn't write stats to %s: %s\n",
+				gremlin_stats_file, strerror(errno));
+		}
+	}
+
+	if ( !gremlin_replay_file ) return;
+
+	debug ( D_NOTICE, "controller replayed %lld of %lld gremlin activations, "
+		"%lld at a different syscall count, %d entries unfinished\n",
+		(long long)replay_done, (long long)replay_total,
+		(long long)replay_divergent, replay_pending);
+
+	for ( int i = 0; i < GREMLIN_MAX; i++ ) {
+		ExtArray<gremlin_replay_entry*> &by_child = gremlin_replay_index[i];
+		for ( int c = 0; c < by_child.length(); c++ ) {
+			gremlin_replay_entry *replay_entry = by_child[c];
+			if ( !replay_entry ) continue;
+			debug ( DLEVEL "controller replay %s.%d: %d of %d replayed, %lld divergent\n",
+				gremlin_names[i], c,
+				replay_entry->current_entry, replay_entry->events.length(),
+				(long long)replay_entry->divergent );
+		}
+	}
+}
+
+/*
+The activation log is written in the binary format of gremlin_log.h,
+through a buffer that is flushed in large blocks: when it fills, at
+exit, and from the fatal signal handlers via controller_flush_log.
+log_len only covers complete records, so a flush from a signal handler
+never writes half of one.
+*/
+
+void
+controller::log_append(int type, int id,
+	const void *payload, uint32_t length,
+	const void *extra, uint32_t extra_length)
+{
+	gremlin_log_record record;
+	size_t total = sizeof(record) + length + extra_length;
+
+	if ( log_len + total > GREMLIN_LOG_BUFFER_SIZE ) {
+		flush_log();
+	}
+	if ( total > GREMLIN_LOG_BUFFER_SIZE || length + extra_length > 0xffff ) {
+		fatal("gremlin log record of %lu bytes is too large\n",
+			(unsigned long)total);
+	}
+
+	record.type = type;
+	record.id = id;
+	record.length = length + extra_length;
+
+	char *p = log_buf + log_len;
+	memcpy(p,&record,sizeof(record));
+	memcpy(p+sizeof(record),payload,length);
+	if ( extra_length ) memcpy(p+sizeof(record)+length,extra,extra_length);
+	log_len += total;
+}
+
+void
+controller::flush_log()
+{
+	size_t written = 0;
+	int ret_val;
+
+	if ( gremlin_log_fd < 1 ) return;
+
+	while (written < log_len) {
+		ret_val = write(gremlin_log_fd,&log_buf[written],log_len-written);
+		if ( ret_val < 0 && errno == EINTR ) continue;
+		if ( ret_val <= 0 ) {
+			debug( D_NOTICE, "controller failed to write gremlin log %s: %s\n",
+				gremlin_log_file, strerror(errno));
+			break;
+		}
+		written += ret_val;
+	}
+	log_len = 0;
+}
+
 void
-controller::write_log_entry(const char *gname, 
+controller::write_log_entry(int gremlin, 
 	const controller_context_t *context, 
 	const gremlin_entry *entry)
 {
-	char buf[8092];
-	static bool first_time = true;
-	int len, written, ret_val;
+	gremlin_log_event event;
+	const char *meta = context->ioctl_meta ? context->ioctl_meta : "";
+	int meta_id = 0;
 
 	if ( gremlin_log_fd < 1 ) return;
 
-	if (first_time) {
-		strcpy(buf,"#GremlinName EvilCount ChildNum InvokedCount SyscallCount\n");
-		len = strlen(buf);
-		written = 0;
-
-		while (written < len) {
-			ret_val = write(gremlin_log_fd,&buf[written],len-written);
-			if ( ret_val < 0 && errno == EINTR ) continue;
-			if ( ret_val > 0 ) written += ret_val;
+	// intern the metadata, writing it out the first time it is seen
+	if ( meta[0] ) {
+		MyString key(meta);
+		if ( log_meta_ids.lookup(key,meta_id) < 0 ) {
+			meta_id = ++log_meta_count;
+			log_meta_ids.insert(key,meta_id);
+			uint32_t id = meta_id;
+			log_append(GREMLIN_LOG_META,0,&id,sizeof(id),meta,strlen(meta));
 		}
-		first_time = false;
 	}
 
-	/* Gremlin EvilCount ChildNum InvokedCount SyscallCount Meta: */
-	snprintf(buf, sizeof(buf), "%s %lu %u %lu %lu Meta: %s\n",
-		gname, entry->evil_counter, context->childnum,
-		entry->thissys_counter, context->syscall_count,
-		context->ioctl_meta ? context->ioctl_meta : "" );
+	event.evil_count = entry->evil_counter;
+	event.invoked_count = entry->thissys_counter;
+	event.syscall_count = context->syscall_count;
+	event.childnum = context->childnum;
+	event.meta = meta_id;
+	log_append(GREMLIN_LOG_EVENT,gremlin,&event,sizeof(event),NULL,0);
+}
 
-	len = strlen(buf);
-	written = 0;
+void
+controller::write_arm_entry(int gremlin, bool armed)
+{
+	gremlin_log_arm arm;
 
-	while (written < len) {
-		ret_val = write(gremlin_log_fd,&buf[written],len-written);
-		if ( ret_val < 0 && errno == EINTR ) continue;
-		if ( ret_val > 0 ) written += ret_val;
+	arm.syscall_count = syscall_count;
+	arm.config_gen = config_gen;
+	arm.armed = armed;
+	log_append(GREMLIN_LOG_ARM,gremlin,&arm,sizeof(arm),NULL,0);
+}
+
+/*
+Counter-based generator for the skip-ahead schedule.  The kth draw
+for a seed depends on nothing but (seed,k), so any point in the
+schedule can be reached without stepping through the draws before it.
+This is the splitmix64 output function.
+*/
+
+static uint64_t
+schedule_draw(unsigned int seed, uint64_t k)
+{
+	uint64_t z = ((uint64_t)seed << 32) + (k + 1) * 0x9E3779B97F4A7C15ULL;
+	z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+	z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+	return z ^ (z >> 31);
+}
+
+/*
+Number of invocations that pass before the next firing, drawn from
+the geometric distribution with success probability percent/100 so
+that each invocation still fires independently at that rate.
+*/
+
+static int64_t
+schedule_gap(const gremlin_config_entry *config, unsigned int seed, uint64_t k)
+{
+	// uniform in (0,1]
+	double u = ((schedule_draw(seed,k) >> 11) + 1) * (1.0 / 9007199254740992.0);
+	double gap = floor(log(u) / config->skip_log);
+
+	return gap < (double)(INT64_MAX/2) ? (int64_t)gap : INT64_MAX/2;
+}
+
+/*
+Position a skip-ahead schedule on the first firing at or after the
+given invocation.  The schedule depends on seed and percentage alone,
+and the seed of an entry never changes, so while the percentage is
+the one the entry was drawn with, this carries on from where the
+entry stands.  Otherwise it starts over from the first firing.
+Either way it walks only firings, never the invocations themselves.
+*/
+
+void
+controller::schedule_seek(gremlin_entry *entry,
+	const gremlin_config_entry *config, int64_t invocation)
+{
+	uint64_t k;
+	int64_t next;
+
+	if ( entry->schedule_percent == config->percent_on ) {
+		k = entry->fire_index;
+		next = entry->next_fire;
+	} else {
+		k = 0;
+		next = schedule_gap(config,entry->seed,0);
+		entry->schedule_percent = config->percent_on;
 	}
+
+	while ( next < invocation ) {
+		k++;
+		next += 1 + schedule_gap(config,entry->seed,k);
+	}
+	entry->fire_index = k;
+	entry->next_fire = next;
+	entry->schedule_gen = config_gen;
+}
+
+static int64_t
+stats_now()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC,&ts);
+	return (int64_t)ts.tv_sec*1000000000 + ts.tv_nsec;
 }
 
 bool
-controller::doevil(const char *gname, const controller_context_t *context,
-		const char *classad_context)
+controller::doevil(int gremlin, const controller_context_t *context,
+		controller_syscall_t *syscall_context)
 {
 	bool doevil = false;
 	bool evalResult = true;
-	MyString key;
-	MyString name(gname);
+	const char *gname = controller_gremlin_name(gremlin);
 	gremlin_entry *entry = NULL;
 	gremlin_config_entry *config = NULL;
 	int random = 0;
+	int64_t start_ns = 0;
 
-	// key needs to be name.pid.childnum
-	key.sprintf("%s.%u.%u",gname,context->pid,context->childnum);
+	if ( gremlin < 0 || gremlin >= GREMLIN_MAX || !context->gremlins ) {
+		return false;
+	}
 
-	gremlin_table.lookup(key,entry);
-	
-	if ( entry == NULL ) {
-		entry = new gremlin_entry;
-		gremlin_table.insert(key,entry);
-		entry->name = name;
-		entry->pid = context->pid;
-		entry->child_num = context->childnum;
-	}
-
-	config = entry->config;
-	if ( config == NULL ) {
-		gremlin_config_table.lookup( name, config );
-		// if we find a config for gremlin, keep a copy
-		// in the entry. if not, look up the default config,
-		// but do NOT keep a copy in the entry in case the
-		// user ioctls a new config entry for this gremlin.
-		if ( config ) {
-			entry->config = config;
-		} else {
-			gremlin_config_table.lookup( MyString("default"), config );
-		}
-		// initialize seed from config table. we only do this the first
-		// time this gremlin is referenced in this process.
-		if ( !entry->seed_initialized ) {
-			entry->seed = config->seed;
-			entry->seed_initialized = true;
-		}
+	if ( stats_timing ) start_ns = stats_now();
+
+	entry = &context->gremlins[gremlin];
+	config = gremlin_configs[gremlin];
+	if ( !config ) {
+		return false;
+	}
+
+	// initialize seed from config table. we only do this the first
+	// time this gremlin is referenced in this process.
+	if ( !entry->seed_initialized ) {
+		entry->seed = config->seed;
+		entry->seed_initialized = true;
 	}
 
 	// Finally, decide what to do!
 	if ( gremlin_replay_file ) {
 		static bool already_warned = false;
-		MyString key;
 		gremlin_replay_entry *replay_entry = NULL;
+		ExtArray<gremlin_replay_entry*> &by_child = gremlin_replay_index[gremlin];
 
-		key.sprintf("%s.%u",gname,context->childnum);
-		gremlin_replay_table.lookup(key,replay_entry);
-		if (replay_entry) { 
-			debug( DLEVEL "controller found replay_entry with key %s\n",key.Value()); 
+		if ( (int)context->childnum < by_child.length() ) {
+			replay_entry = by_child[context->childnum];
 		}
-		if ( replay_entry && 
-		   	 (entry->thissys_counter == replay_entry->invoked_index[replay_entry->current_entry]) )
+		if ( replay_entry &&
+			 replay_entry->current_entry < replay_entry->events.length() &&
+			 (entry->thissys_counter ==
+			  replay_entry->events[replay_entry->current_entry].invoked) )
 		{
-			if (!already_warned &&
-				(context->syscall_count !=
-				replay_entry->syscall_index[replay_entry->current_entry]))
+			if ( context->syscall_count !=
+				 replay_entry->events[replay_entry->current_entry].syscall )
 			{
-				debug ( D_NOTICE,
-					"controller WARNING non-deterministic replay: "
-					"invocation %lu of %s\n",
-					entry->thissys_counter, key.Value());
-				already_warned = true;
+				replay_entry->divergent++;
+				replay_divergent++;
+				if (!already_warned) {
+					debug ( D_NOTICE,
+						"controller WARNING non-deterministic replay: "
+						"invocation %lu of %s.%u\n",
+						entry->thissys_counter, gname, context->childnum);
+					already_warned = true;
+				}
 			}
 			doevil = true;
+			replay_done++;
 			replay_entry->current_entry += 1;
 			if ( replay_entry->current_entry == 
-				 replay_entry->invoked_index.length() ) 
+				 replay_entry->events.length() ) 
 			{
-				// if we are done replaying this entry, remove from hash table
-				gremlin_replay_table.remove(key);
+				replay_pending--;
 				// if this was the last entry, fire up gdb if requested
-				if ( gremlin_replay_gdb && gremlin_replay_table.getNumElements() == 0 ) {
+				if ( gremlin_replay_gdb && replay_pending == 0 ) {
 					suspend_and_gdb();
 					debug(D_MURPHY, "end of replay log -- will invoke gdb on exit\n");
 				}
@@ -487,6 +1413,17 @@ controller::doevil(const char *gname, const controller_context_t *context,
 	} else 
 	if ( config->percent_on == 100 ) {
 		doevil = true;
+	} else
+	if ( schedule_skip ) {
+		if ( entry->schedule_gen != config_gen ) {
+			schedule_seek(entry,config,entry->thissys_counter);
+		}
+		if ( entry->thissys_counter == entry->next_fire ) {
+			doevil = true;
+			entry->fire_index++;
+			entry->next_fire += 1 +
+				schedule_gap(config,entry->seed,entry->fire_index);
+		}
 	} else {
 		random = rand_r(&entry->seed) % 100 ;
 		doevil = random < config->percent_on ? true : false;
@@ -494,60 +1431,72 @@ controller::doevil(const char *gname, const controller_context_t *context,
 
 	// If above decided to do evil, make sure constraint holds
 	if ( doevil && config->constraint_tree ) {
-		ClassAd ad;
-		ClassAdParser parser;
-		// Insert gremlin context into ad if we have one
-		if (classad_context &&
-			!parser.ParseClassAd(classad_context,ad,true ))
-		{
-			debug ( DLEVEL "controller doEvil %s classad context bad (%s)\n",
-			key.Value(), classad_context );
-
+		gremlin_eval_ad *eval = &gremlin_eval_ads[gremlin];
+		Value val;
+		int64_t context_start_ns = 0;
+		if ( stats_timing ) context_start_ns = stats_now();
+		// Load the syscall context the constraint refers to, if any
+		eval_attrs_set(eval,config->attr_refs,syscall_context);
+		// Now refresh gremlin-indepent context attributes
+		eval_slot_set(eval->slots[EVAL_SLOT_SYSCALLCOUNT],(int)context->syscall_count);
+		eval_slot_set(eval->slots[EVAL_SLOT_INVOKEDCOUNT],(int)entry->thissys_counter);
+		eval_slot_set(eval->slots[EVAL_SLOT_EVILCOUNT],(int)entry->evil_counter);
+		eval_slot_set(eval->slots[EVAL_SLOT_PID],(int)context->pid);
+		eval_slot_set(eval->slots[EVAL_SLOT_CHILDNUM],(int)context->childnum);
+		eval_slot_set(eval->slots[EVAL_SLOT_SYSCALLNAME],context->syscall_name);
+		eval_slot_set(eval->slots[EVAL_SLOT_SYSCALLNUM],(int)context->syscall_number);
+		eval_slot_set(eval->slots[EVAL_SLOT_META],context->ioctl_meta);
+		if ( stats_timing ) {
+			stats[gremlin].context_ns += stats_now() - context_start_ns;
+		}
+		// Now evaluate the contraint in the scope of the ad; the
+		// tree itself is shared and never copied.  This is what
+		// EvaluateAttrBool did: IsBooleanValue always stores the
+		// value's boolean, which is false for UNDEFINED or ERROR,
+		// so a constraint that is not a boolean never fires
+		if ( !eval->ad.EvaluateExpr(config->constraint_tree,val) ||
+			 !val.IsBooleanValue(evalResult) ) {
+			evalResult = false;
 		}
-		// Now insert gremlin-indepent context attributes
-		ad.InsertAttr("Gremlin",gname);
-		ad.InsertAttr("SyscallCount",(int)context->syscall_count);
-		ad.InsertAttr("InvokedCount",(int)entry->thissys_counter);
-		ad.InsertAttr("EvilCount",(int)entry->evil_counter);
-		ad.InsertAttr("Pid",(int)context->pid);
-		ad.InsertAttr("ChildNum",(int)context->childnum);
-		ad.InsertAttr("SyscallName",context->syscall_name);
-		ad.InsertAttr("SyscallNum",(int)context->syscall_number);
-		MyString meta(context->ioctl_meta);
-		ad.InsertAttr("Meta",meta.Value());
-		// Now evaluate the contraint
-		ExprTree *private_copy = config->constraint_tree->Copy();
-		ad.Insert("Constraint",private_copy);
-		ad.EvaluateAttrBool("Constraint",evalResult);
+		stats[gremlin].evaluations++;
 		if (!evalResult) {
 			doevil = false;
+			stats[gremlin].rejections++;
 		}
 		// Display some useful debug info into log
-		ClassAdUnParser unp;
-		std::string displayad;
-		unp.Unparse(displayad,&ad);
-		debug ( DLEVEL "controller evalResult=%s %s\n",
-			evalResult ? "true" : "false", displayad.c_str() );
+		if ( debug_flags_active(D_MURPHY) ) {
+			ClassAdUnParser unp;
+			std::string displayad;
+			unp.Unparse(displayad,&eval->ad);
+			debug ( DLEVEL "controller evalResult=%s %s\n",
+				evalResult ? "true" : "false", displayad.c_str() );
+		}
 
 	}
 
 
 	if ( config->percent_on ) {
-		debug ( DLEVEL "controller doEvil %s %s (%d<%d) constraint=%s\n",
-			key.Value(), doevil ? "true" : "false", 
+		debug ( DLEVEL "controller doEvil %s.%u.%u %s (%d<%d) constraint=%s\n",
+			gname, context->pid, context->childnum,
+			doevil ? "true" : "false", 
 			random, config->percent_on,
 			evalResult ? "true" : "false");
 	}
 
 	// write out to our gremlin log, if needed
 	if (doevil) {
-		write_log_entry(gname, context, entry);
+		write_log_entry(gremlin, context, entry);
 	}
 
 	// Update some statistics for our report
 	entry->thissys_counter++;
+	stats[gremlin].invocations++;
 	if ( doevil ) {
 		entry->evil_counter++;
+		stats[gremlin].firings++;
+	}
+	if ( stats_timing ) {
+		stats[gremlin].doevil_ns += stats_now() - start_ns;
 	}
 
 	return doevil;
@@ -607,16 +1556,37 @@ controller::init(const char *config_file)
 			open(gremlin_log_file,
 				O_APPEND|O_CREAT|O_LARGEFILE|O_TRUNC|O_WRONLY,
 				0644);
-		if ( gremlin_log_file < 0 ) {
+		if ( gremlin_log_fd < 0 ) {
 			fatal("failed to open gremlin log file %s : %s\n",
 				gremlin_log_file, strerror(errno));
 		}
+		log_buf = new char[GREMLIN_LOG_BUFFER_SIZE];
+		memcpy(log_buf,GREMLIN_LOG_MAGIC,GREMLIN_LOG_MAGIC_LENGTH);
+		log_len = GREMLIN_LOG_MAGIC_LENGTH;
+		for ( int i = 0; i < GREMLIN_MAX; i++ ) {
+			log_append(GREMLIN_LOG_NAME,i,
+				gremlin_names[i],strlen(gremlin_names[i]),NULL,0);
+		}
+		atexit(controller_flush_log);
 	}
 
 	if (gremlin_replay_file) {
 		read_log();
 	}
 
+	stats_timing = gremlin_stats || gremlin_stats_file;
+
+	if ( gremlin_schedule ) {
+		if ( strcmp(gremlin_schedule,"skip") == 0 ) {
+			schedule_skip = true;
+		} else if ( strcmp(gremlin_schedule,"rand") != 0 ) {
+			fatal("unknown gremlin schedule %s (expected rand or skip)\n",
+				gremlin_schedule);
+		}
+	}
+
+	bind_configs();
+
 	debug ( DLEVEL 
 			"controller exiting init() ret=%s config_file=%s\n", 
 			ret_value ? "true" : "false",
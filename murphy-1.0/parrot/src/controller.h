@@ -1,10 +1,117 @@
-
 #ifndef _MALOS_CONTROLLER_H_
 #define _MALOS_CONTROLLER_H_
 
 #include <stdint.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <limits.h>
 #include <sys/types.h>
 
+// every gremlin known to the dispatcher.  names in the config file
+// are interned to one of these ids when the config is loaded.
+enum gremlin_id {
+	GREMLIN_READONE,
+	GREMLIN_READONE_S,
+	GREMLIN_READLESS,
+	GREMLIN_WRITEONE,
+	GREMLIN_WRITEONE_S,
+	GREMLIN_WRITELESS,
+	GREMLIN_WRITEZERO,
+	GREMLIN_EINTR,
+	GREMLIN_EAGAIN,
+	GREMLIN_ENOSPC,
+	GREMLIN_CLOSEFAIL,
+	GREMLIN_SELECTFDSET,
+	GREMLIN_CWDLONGPATH,
+	GREMLIN_SLEEPY1,
+	GREMLIN_SLEEPY10TH,
+	GREMLIN_SLEEPY100TH,
+	GREMLIN_SLEEPY1000TH,
+	GREMLIN_MAX
+};
+
+// set of gremlin ids, one bit per gremlin
+typedef uint32_t gremlin_mask_t;
+#define GREMLIN_BIT(gremlin) ((gremlin_mask_t)1 << (gremlin))
+
+// per-process state of one gremlin.  each pfs_process holds
+// a dense array of these indexed by gremlin_id.
+struct gremlin_entry {
+	bool seed_initialized;
+	unsigned int seed;
+	int64_t thissys_counter;	// how many times asked?
+	int64_t evil_counter;		// how many times answered do evil?
+	// skip-ahead schedule: the invocation that fires next, and how
+	// many firings precede it, for the percentage it was drawn with.
+	// brought up to date when schedule_gen is stale.
+	int64_t next_fire;
+	uint64_t fire_index;
+	int schedule_percent;
+	unsigned int schedule_gen;
+};
+
+// attributes of the current syscall that a gremlin constraint may
+// refer to, in addition to the ones the controller supplies itself.
+enum gremlin_attr {
+	GREMLIN_ATTR_FD,
+	GREMLIN_ATTR_NAME,
+	GREMLIN_ATTR_LENGTH,
+	GREMLIN_ATTR_OFFSET,
+	GREMLIN_ATTR_O_CREAT,
+	GREMLIN_ATTR_PATHSET,
+	GREMLIN_ATTR_PATHLEN,
+	GREMLIN_ATTR_MAX
+};
+
+#define GREMLIN_ATTR_BIT(attr) (1u << (attr))
+
+// typed syscall context handed to doevil.  the dispatcher marks
+// every attribute that exists for this syscall in 'present', and fills
+// in the cheap ones directly by also marking them 'resolved'.  the
+// others are filled in by 'resolve' only when an armed constraint
+// actually refers to them.
+struct controller_syscall_t {
+	unsigned int present;
+	unsigned int resolved;
+	void (*resolve)(struct controller_syscall_t *sc, int attr);
+	void *resolve_data;
+
+	int64_t fd;
+	int64_t length;
+	int64_t offset;
+	bool o_creat;
+	int pathset;
+	int pathlen;
+	const char *name;
+	char name_buf[PATH_MAX];
+};
+
+static inline void
+controller_syscall_init(struct controller_syscall_t *sc,
+	void (*resolve)(struct controller_syscall_t *, int), void *resolve_data)
+{
+	sc->present = 0;
+	sc->resolved = 0;
+	sc->resolve = resolve;
+	sc->resolve_data = resolve_data;
+	sc->name = NULL;
+}
+
+// this attribute exists and its value is already filled in
+static inline void
+controller_syscall_provide(struct controller_syscall_t *sc, int attr)
+{
+	sc->present |= GREMLIN_ATTR_BIT(attr);
+	sc->resolved |= GREMLIN_ATTR_BIT(attr);
+}
+
+// this attribute exists, but is left to the resolve callback
+static inline void
+controller_syscall_defer(struct controller_syscall_t *sc, int attr)
+{
+	sc->present |= GREMLIN_ATTR_BIT(attr);
+}
+
 struct controller_context_t {
 	int64_t syscall_count;
 	pid_t pid;
@@ -12,13 +119,17 @@ struct controller_context_t {
 	const char *ioctl_meta;
 	const char *syscall_name;
 	int64_t syscall_number;
+	struct gremlin_entry *gremlins;
+	gremlin_mask_t armed;		// from controller_syscall_mask
 
 };
 
+#define GREMLIN_ARMED(context,gremlin) ((context)->armed & GREMLIN_BIT(gremlin))
+
 bool
-controller_doevil(const char *gremlin_name,
+controller_doevil(int gremlin,
 	const controller_context_t *context,
-	const char *classad_context);
+	controller_syscall_t *syscall_context);
 
 bool
 controller_setconfig(const char* config_line);
@@ -26,4 +137,34 @@ controller_setconfig(const char* config_line);
 bool
 controller_init();
 
+const char *
+controller_gremlin_name(int gremlin);
+
+int
+controller_gremlin_lookup(const char *name);
+
+// gremlins that are both implemented for this syscall and able to
+// fire under the current config.  a syscall with an empty mask needs
+// no gremlin handling at all.
+gremlin_mask_t
+controller_syscall_mask(int64_t syscall);
+
+// called as each syscall is dispatched, before its mask is fetched,
+// so that replay arms gremlins at the SyscallCount they were armed at
+void
+controller_advance(int64_t syscall_count, bool entering);
+
+// write out any buffered gremlin log records; safe from a signal handler
+void
+controller_flush_log();
+
+// summarize what the controller did, once tracing is over
+void
+controller_report();
+
+// per-gremlin invocation, firing and cost counters, in table form
+void
+controller_print_stats(FILE *file);
+
 #endif
+
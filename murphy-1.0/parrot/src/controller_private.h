@@ -9,13 +9,27 @@
 #include "HashTable.h"
 #include "classad/classad_distribution.h"
 
-// key needs to be name.pid.childnum 
+#define GREMLIN_LOG_BUFFER_SIZE (64*1024)
 
+struct gremlin_replay_event {
+	int64_t invoked;		// InvokedCount at which to fire
+	int64_t syscall;		// SyscallCount it fired at when recorded
+};
+
+// replay events of one gremlin in one child, sorted by invocation,
+// so deciding whether the current invocation is next is one compare
 struct gremlin_replay_entry {
 	gremlin_replay_entry();
-	int64_t current_entry;
-	ExtArray<int64_t> invoked_index;
-	ExtArray<int64_t> syscall_index;
+	int current_entry;
+	ExtArray<gremlin_replay_event> events;
+	int64_t divergent;		// replayed at a different SyscallCount
+};
+
+// an arm record of the replay log
+struct gremlin_replay_arm {
+	int64_t syscall;		// SyscallCount from which it applies
+	int gremlin;
+	bool armed;
 };
 
 struct gremlin_config_entry {
@@ -26,26 +40,45 @@ struct gremlin_config_entry {
 	int percent_on;
 	MyString constraint;
 	ExprTree *constraint_tree;
+	unsigned int attr_refs;		// GREMLIN_ATTR_BITs the constraint refers to
+	double skip_log;			// log(1-percent/100), for the skip schedule
+};
+
+// attributes of the evaluation ad that doevil refreshes in place
+// before every constraint check
+enum gremlin_eval_slot {
+	EVAL_SLOT_GREMLIN,
+	EVAL_SLOT_SYSCALLCOUNT,
+	EVAL_SLOT_INVOKEDCOUNT,
+	EVAL_SLOT_EVILCOUNT,
+	EVAL_SLOT_PID,
+	EVAL_SLOT_CHILDNUM,
+	EVAL_SLOT_SYSCALLNAME,
+	EVAL_SLOT_SYSCALLNUM,
+	EVAL_SLOT_META,
+	EVAL_SLOT_MAX
 };
 
-struct gremlin_entry {
-	gremlin_entry();
-	~gremlin_entry();
+// what the controller has spent on one gremlin, over all processes
+struct gremlin_stats {
+	int64_t invocations;
+	int64_t firings;
+	int64_t evaluations;	// constraints evaluated
+	int64_t rejections;		// constraints that vetoed a firing
+	int64_t doevil_ns;
+	int64_t context_ns;		// part of doevil_ns spent filling in the ad
+};
 
-	gremlin_config_entry *config;
-	bool seed_initialized;
-	unsigned int seed;
+// persistent ad that a gremlin's constraint is evaluated against.
+// the slot literals, one per controller attribute and one per
+// gremlin_attr, are owned by the ad.
+struct gremlin_eval_ad {
+	gremlin_eval_ad();
+	void bind(const char *gname);
 
-	MyString name;
-	pid_t pid;
-	unsigned int child_num;
-	int64_t thissys_counter;	// how many times asked?
-	int64_t evil_counter;		// how many times answered do evil?
-
-	bool replay;
-	unsigned int evil_array_size;
-	//ExtArray<unsigned int> evil_thissys_index;
-	//ExtArray<unsigned int> evil_allsys_index;
+	ClassAd ad;
+	Literal *slots[EVAL_SLOT_MAX];
+	Literal *attr_slots[GREMLIN_ATTR_MAX];
 };
 
 class controller {
@@ -55,21 +88,71 @@ class controller {
 
 	bool init(const char *config_file);
 	bool process_config_line(MyString & line, struct gremlin_config_entry *);
-	bool doevil(const char *name, const controller_context_t *context,
-		const char *classad_context);
+	bool doevil(int gremlin, const controller_context_t *context,
+		controller_syscall_t *syscall_context);
 	bool setconfig(const char* config_line);
+	gremlin_mask_t syscall_mask(int64_t syscall);
+	void advance(int64_t syscall_count, bool entering);
+	void flush_log();
+	void report();
+	void print_stats(FILE *file);
 
 	private:
-	HashTable<MyString, gremlin_entry*> gremlin_table;
+	// -e skip: decide with the skip-ahead schedule instead of rand_r
+	bool schedule_skip;
+	// bumped on every config change, to invalidate schedules
+	unsigned int config_gen;
+	gremlin_stats stats[GREMLIN_MAX];
+	// time doevil; only when the stats will be shown
+	bool stats_timing;
 	HashTable<MyString, gremlin_config_entry*> gremlin_config_table;
-	HashTable<MyString, gremlin_replay_entry*> gremlin_replay_table;
+	// config in effect for each gremlin id, rebound on every config change
+	gremlin_config_entry *gremlin_configs[GREMLIN_MAX];
+	gremlin_eval_ad gremlin_eval_ads[GREMLIN_MAX];
+	// replay entries of each gremlin id, indexed by childnum
+	ExtArray<gremlin_replay_entry*> gremlin_replay_index[GREMLIN_MAX];
+	int replay_pending;			// entries with events left to replay
+	int64_t replay_total;
+	int64_t replay_done;
+	int64_t replay_divergent;
+	int64_t replay_skipped;		// events of gremlins we don't know
+	// arm records of the replay log, in order, and the next to apply.
+	// a log that has any decides alone which gremlins are armed
+	ExtArray<gremlin_replay_arm> replay_arms;
+	int replay_arm_next;
+	gremlin_mask_t replay_armed;
+	// armed gremlins per SYSCALL64_*, rebuilt when armed_gremlins changes
+	gremlin_mask_t armed_gremlins;
+	gremlin_mask_t *syscall_masks;
+	gremlin_mask_t unknown_syscall_mask;
+	// gremlins named in the replay log, armed regardless of config
+	gremlin_mask_t replay_gremlins;
+	// SyscallCount of the syscall being dispatched
+	int64_t syscall_count;
 
 	int gremlin_log_fd;
-
+	char *log_buf;
+	size_t log_len;
+	HashTable<MyString, int> log_meta_ids;
+	int log_meta_count;
+	gremlin_mask_t logged_armed;	// as of the last arm records written
+
+	void bind_configs();
+	void set_armed(gremlin_mask_t mask);
+	void schedule_seek(gremlin_entry *entry,
+		const gremlin_config_entry *config, int64_t invocation);
 	bool read_log();
-	void write_log_entry(const char *gname, 
+	void add_replay_entry(const char *gname, unsigned int childnum,
+		int64_t invoked_i, int64_t syscall_i);
+	void add_replay_arm(const char *gname, bool armed, int64_t syscall_i);
+	void sort_replay_entries();
+	void write_log_entry(int gremlin, 
 		const controller_context_t *context, 
 		const gremlin_entry *entry);
+	void write_arm_entry(int gremlin, bool armed);
+	void log_append(int type, int id,
+		const void *payload, uint32_t length,
+		const void *extra, uint32_t extra_length);
 	
 
 };
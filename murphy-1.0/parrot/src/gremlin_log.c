@@ -0,0 +1,134 @@
+#include "gremlin_log.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+struct gremlin_log_reader {
+	FILE *file;
+	char *names[GREMLIN_LOG_MAX_ID];
+	char **metas;
+	uint32_t metas_length;
+};
+
+struct gremlin_log_reader * gremlin_log_reader_open( FILE *file )
+{
+	char magic[GREMLIN_LOG_MAGIC_LENGTH];
+	struct gremlin_log_reader *r;
+
+	if(fread(magic,1,sizeof(magic),file)!=sizeof(magic) ||
+	   memcmp(magic,GREMLIN_LOG_MAGIC,sizeof(magic))!=0) {
+		rewind(file);
+		return 0;
+	}
+
+	r = calloc(1,sizeof(*r));
+	if(!r) return 0;
+	r->file = file;
+	return r;
+}
+
+static char * read_string( FILE *file, uint32_t length )
+{
+	char *s = malloc(length+1);
+	if(!s) return 0;
+	if(fread(s,1,length,file)!=length) {
+		free(s);
+		return 0;
+	}
+	s[length] = 0;
+	return s;
+}
+
+/*
+Metadata ids are handed out densely in the order the strings are
+first seen, so they can be kept in a plain array.
+*/
+
+static int add_meta( struct gremlin_log_reader *r, uint32_t id, char *meta )
+{
+	if(id>=r->metas_length) {
+		uint32_t length = r->metas_length ? r->metas_length*2 : 16;
+		char **metas;
+		while(length<=id) length *= 2;
+		metas = realloc(r->metas,length*sizeof(char*));
+		if(!metas) return 0;
+		memset(&metas[r->metas_length],0,(length-r->metas_length)*sizeof(char*));
+		r->metas = metas;
+		r->metas_length = length;
+	}
+	free(r->metas[id]);
+	r->metas[id] = meta;
+	return 1;
+}
+
+int gremlin_log_reader_next( struct gremlin_log_reader *r, struct gremlin_log_entry *e )
+{
+	struct gremlin_log_record record;
+	uint32_t id;
+	char *s;
+
+	while(1) {
+		if(fread(&record,sizeof(record),1,r->file)!=1) {
+			return feof(r->file) ? 0 : -1;
+		}
+
+		switch(record.type) {
+			case GREMLIN_LOG_NAME:
+				if(record.id>=GREMLIN_LOG_MAX_ID) return -1;
+				s = read_string(r->file,record.length);
+				if(!s) return -1;
+				free(r->names[record.id]);
+				r->names[record.id] = s;
+				break;
+
+			case GREMLIN_LOG_META:
+				if(record.length<sizeof(id)) return -1;
+				if(fread(&id,sizeof(id),1,r->file)!=1) return -1;
+				s = read_string(r->file,record.length-sizeof(id));
+				if(!s) return -1;
+				if(!add_meta(r,id,s)) {
+					free(s);
+					return -1;
+				}
+				break;
+
+			case GREMLIN_LOG_EVENT:
+				if(record.id>=GREMLIN_LOG_MAX_ID || !r->names[record.id]) return -1;
+				if(record.length!=sizeof(e->event)) return -1;
+				if(fread(&e->event,sizeof(e->event),1,r->file)!=1) return -1;
+				e->type = GREMLIN_LOG_EVENT;
+				e->name = r->names[record.id];
+				if(e->event.meta==0) {
+					e->meta = "";
+				} else if(e->event.meta<r->metas_length && r->metas[e->event.meta]) {
+					e->meta = r->metas[e->event.meta];
+				} else {
+					return -1;
+				}
+				return 1;
+
+			case GREMLIN_LOG_ARM:
+				if(record.id>=GREMLIN_LOG_MAX_ID || !r->names[record.id]) return -1;
+				if(record.length!=sizeof(e->arm)) return -1;
+				if(fread(&e->arm,sizeof(e->arm),1,r->file)!=1) return -1;
+				e->type = GREMLIN_LOG_ARM;
+				e->name = r->names[record.id];
+				e->meta = "";
+				return 1;
+
+			default:
+				return -1;
+		}
+	}
+}
+
+void gremlin_log_reader_close( struct gremlin_log_reader *r )
+{
+	uint32_t i;
+
+	if(!r) return;
+	for(i=0;i<GREMLIN_LOG_MAX_ID;i++) free(r->names[i]);
+	for(i=0;i<r->metas_length;i++) free(r->metas[i]);
+	free(r->metas);
+	free(r);
+}
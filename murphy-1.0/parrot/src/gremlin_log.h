@@ -0,0 +1,95 @@
+#ifndef GREMLIN_LOG_H
+#define GREMLIN_LOG_H
+
+/*
+Binary gremlin activation log, as written by Murphy -g and read back
+by Murphy -r and murphy_log2text.  The file starts with the magic
+string and then holds a stream of records.  Each record is a
+gremlin_log_record header followed by 'length' bytes of payload:
+
+GREMLIN_LOG_NAME	id is a gremlin id, payload is its name
+GREMLIN_LOG_META	payload is a uint32_t metadata id, then the metadata
+GREMLIN_LOG_EVENT	id is a gremlin id, payload is a gremlin_log_event
+GREMLIN_LOG_ARM		id is a gremlin id, payload is a gremlin_log_arm
+
+The name of every gremlin is written before any event, so that the
+file can be read without knowing the gremlin ids of the build that
+wrote it.  Metadata strings are written once, the first time they
+are seen, and events refer to them by id.  Metadata id 0 is the
+empty string.  An arm record says that from the given SyscallCount
+on, the gremlin is consulted, and so counts its invocations, or no
+longer is.  All fields are in host byte order.
+*/
+
+#include <stdio.h>
+#include <stdint.h>
+
+#define GREMLIN_LOG_MAGIC "MURPHYGL"
+#define GREMLIN_LOG_MAGIC_LENGTH 8
+
+#define GREMLIN_LOG_MAX_ID 256
+
+#define GREMLIN_LOG_TEXT_HEADER "#GremlinName EvilCount ChildNum InvokedCount SyscallCount\n"
+
+/* text form of an arm record; other readers take it for a comment */
+#define GREMLIN_LOG_TEXT_ARM "#Armed"
+
+enum gremlin_log_type {
+	GREMLIN_LOG_NAME = 1,
+	GREMLIN_LOG_META,
+	GREMLIN_LOG_EVENT,
+	GREMLIN_LOG_ARM
+};
+
+struct gremlin_log_record {
+	uint8_t type;
+	uint8_t id;
+	uint16_t length;
+};
+
+struct gremlin_log_event {
+	int64_t evil_count;
+	int64_t invoked_count;
+	int64_t syscall_count;
+	uint32_t childnum;
+	uint32_t meta;
+};
+
+struct gremlin_log_arm {
+	int64_t syscall_count;
+	uint32_t config_gen;
+	uint32_t armed;
+};
+
+/* one record as returned by the reader, with its references resolved */
+struct gremlin_log_entry {
+	int type;		/* GREMLIN_LOG_EVENT or GREMLIN_LOG_ARM */
+	const char *name;
+	const char *meta;
+	struct gremlin_log_event event;
+	struct gremlin_log_arm arm;
+};
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+struct gremlin_log_reader;
+
+/*
+Start reading a binary log.  Returns null, with the file rewound,
+if the file does not start with the binary magic, so that the caller
+can read it as a text log instead.
+*/
+struct gremlin_log_reader * gremlin_log_reader_open( FILE *file );
+
+/* Returns 1 for an event or arm record, 0 at the end of the log, -1 if it is corrupt. */
+int gremlin_log_reader_next( struct gremlin_log_reader *r, struct gremlin_log_entry *e );
+
+void gremlin_log_reader_close( struct gremlin_log_reader *r );
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
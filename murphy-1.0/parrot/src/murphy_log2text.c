@@ -0,0 +1,71 @@
+/*
+Convert a binary gremlin activation log, as written by Murphy -g,
+into the text layout used by earlier versions of Murphy.  Arm
+records come out as #Armed lines, which those versions skip as
+comments and Murphy -r reads back.
+*/
+
+#include "gremlin_log.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <string.h>
+
+int main( int argc, char *argv[] )
+{
+	struct gremlin_log_reader *r;
+	struct gremlin_log_entry e;
+	FILE *file;
+	int result;
+
+	if(argc>2 || (argc==2 && argv[1][0]=='-')) {
+		printf("use: murphy_log2text [binary-log]\n");
+		return 0;
+	}
+
+	if(argc==2) {
+		file = fopen(argv[1],"r");
+		if(!file) {
+			fprintf(stderr,"murphy_log2text: couldn't open %s: %s\n",argv[1],strerror(errno));
+			return 1;
+		}
+	} else {
+		file = stdin;
+	}
+
+	r = gremlin_log_reader_open(file);
+	if(!r) {
+		fprintf(stderr,"murphy_log2text: not a binary gremlin log\n");
+		return 1;
+	}
+
+	printf(GREMLIN_LOG_TEXT_HEADER);
+
+	while((result=gremlin_log_reader_next(r,&e))==1) {
+		if(e.type==GREMLIN_LOG_ARM) {
+			printf("%s %s %s %lld\n",
+				GREMLIN_LOG_TEXT_ARM,
+				e.name,
+				e.arm.armed ? "on" : "off",
+				(long long)e.arm.syscall_count);
+			continue;
+		}
+		printf("%s %lld %u %lld %lld Meta: %s\n",
+			e.name,
+			(long long)e.event.evil_count,
+			e.event.childnum,
+			(long long)e.event.invoked_count,
+			(long long)e.event.syscall_count,
+			e.meta);
+	}
+
+	gremlin_log_reader_close(r);
+
+	if(result<0) {
+		fprintf(stderr,"murphy_log2text: log is corrupt or truncated\n");
+		return 1;
+	}
+
+	return 0;
+}
@@ -7,73 +7,162 @@ See the file COPYING for details.
 
 #include "pfs_channel.h"
 #include "debug.h"
+#include "itable.h"
+#include "macros.h"
 
 #include <stdlib.h>
+#include <stdio.h>
 #include <unistd.h>
 #include <sys/mman.h>
+#include <sys/syscall.h>
 #include <bits/mman.h>
 #include <string.h>
 #include <errno.h>
 
 extern char pfs_temp_dir[];
 
-struct entry {
+/*
+The channel is carved into page-aligned blocks.  Every block is on
+a list in address order, so that a freed block can be merged with
+free neighbours.  Free blocks of up to CLASS_LARGE-1 pages are kept
+on a list per size, with a bit in class_bits for each list that is
+not empty, so that finding the smallest block that fits is a single
+bit scan.  Larger free blocks share the last list and are searched
+first-fit.  Blocks in use are found by their start offset in a
+table, so that freeing does not search.  Block structures are
+recycled rather than returned to malloc.
+*/
+
+#define CLASS_LARGE 63
+
+struct block {
 	pfs_size_t start;
 	pfs_size_t length;
 	int inuse;
-	struct entry *prev;
-	struct entry *next;
+	struct block *prev;
+	struct block *next;
+	struct block *free_prev;
+	struct block *free_next;
 };
 
-static struct entry *head=0;
+static struct block *free_lists[CLASS_LARGE+1];
+static UINT64_T class_bits = 0;
+static struct itable *inuse_blocks = 0;
+static struct block *spare_blocks = 0;
+static struct block *last_block = 0;
+
 static int channel_fd=-1;
 static char *channel_base=0;
 static pfs_size_t channel_size;
 
-static struct entry * entry_create( pfs_size_t start, pfs_size_t length, struct entry *prev, struct entry *next )
+static int page_size=0;
+
+static pfs_size_t round_up( pfs_size_t x )
 {
-	struct entry *e;
+	if(page_size==0) page_size = sysconf(_SC_PAGE_SIZE);
+	if(x%page_size) x = page_size * ((x/page_size)+1);
+	if(x<=0) x=page_size;
+	return x;
+}
 
-	e = malloc(sizeof(*e));
-	if(!e) return 0;
+static int size_class( pfs_size_t length )
+{
+	pfs_size_t pages = length/page_size;
+	if(pages<CLASS_LARGE) return pages;
+	return CLASS_LARGE;
+}
 
-	e->start = start;
-	e->length = length;
-	e->inuse = 0;
+static struct block * block_create( pfs_size_t start, pfs_size_t length )
+{
+	struct block *b;
 
-	if(prev) {
-		e->prev = prev;
-		prev->next = e;
+	if(spare_blocks) {
+		b = spare_blocks;
+		spare_blocks = b->next;
 	} else {
-		e->prev = e;
+		b = malloc(sizeof(*b));
+		if(!b) return 0;
 	}
 
-	if(next) {
-		e->next = next;
-		next->prev = e;
+	b->start = start;
+	b->length = length;
+	b->inuse = 0;
+	b->prev = b->next = 0;
+	b->free_prev = b->free_next = 0;
+
+	return b;
+}
+
+static void block_recycle( struct block *b )
+{
+	b->next = spare_blocks;
+	spare_blocks = b;
+}
+
+static void free_insert( struct block *b )
+{
+	int c = size_class(b->length);
+	b->free_prev = 0;
+	b->free_next = free_lists[c];
+	if(free_lists[c]) free_lists[c]->free_prev = b;
+	free_lists[c] = b;
+	class_bits |= ((UINT64_T)1)<<c;
+}
+
+static void free_remove( struct block *b )
+{
+	int c = size_class(b->length);
+	if(b->free_prev) {
+		b->free_prev->free_next = b->free_next;
 	} else {
-		e->next = e;
+		free_lists[c] = b->free_next;
+		if(!free_lists[c]) class_bits &= ~(((UINT64_T)1)<<c);
 	}
-
-	return e;
+	if(b->free_next) b->free_next->free_prev = b->free_prev;
 }
 
-static void entry_delete( struct entry *e )
+/* Unlink b from the address list, once its space belongs to a neighbour. */
+
+static void block_unlink( struct block *b )
 {
-	if(head==e) head = e->next;
-	if(e->prev) e->prev->next = e->next;
-	if(e->next) e->next->prev = e->prev;
-	free(e);
+	if(b->prev) b->prev->next = b->next;
+	if(b->next) b->next->prev = b->prev;
+	if(last_block==b) last_block = b->prev;
+	block_recycle(b);
 }
 
-int pfs_channel_init( pfs_size_t size )
+/*
+The channel lives in an anonymous memory file where the kernel
+offers one, so that it never touches pfs_temp_dir.  Either way,
+tracees inherit the fd and pread from it.
+*/
+
+static int channel_open()
 {
 	char path[PATH_MAX];
+	int fd;
+
+#ifdef SYS_memfd_create
+	fd = syscall(SYS_memfd_create,"parrot-channel",0);
+	if(fd>=0) return fd;
+	debug(D_CHANNEL,"memfd_create failed (%s), using a temporary file",strerror(errno));
+#endif
 
 	sprintf(path,"%s/pfs.tmp.XXXXXX",pfs_temp_dir);
-	channel_fd = mkstemp(path);
-	if(channel_fd<0) return 0;
+	fd = mkstemp(path);
+	if(fd<0) return -1;
 	unlink(path);
+	return fd;
+}
+
+int pfs_channel_init( pfs_size_t size )
+{
+	struct block *b;
+
+	round_up(1);
+
+	channel_fd = channel_open();
+	if(channel_fd<0) return 0;
 	ftruncate(channel_fd,size);
 
 	channel_size = size;
@@ -84,13 +173,17 @@ int pfs_channel_init( pfs_size_t size )
 		return 0;
 	}
 
-	head = entry_create(0,size,0,0);
-	if(!head) {
+	inuse_blocks = itable_create(0);
+	b = block_create(0,size);
+	if(!inuse_blocks || !b) {
 		close(channel_fd);
 		munmap(channel_base,size);
 		return 0;
 	}
 
+	last_block = b;
+	free_insert(b);
+
 	debug(D_CHANNEL,"fd is %d",channel_fd);
 
 	return 1;
@@ -106,94 +199,128 @@ char * pfs_channel_base()
 	return channel_base;
 }
 
-static int page_size=0;
+static struct block * find_free( pfs_size_t length )
+{
+	struct block *b;
+	int c = size_class(length);
+
+	if(c<CLASS_LARGE) {
+		UINT64_T bits = class_bits & (~(UINT64_T)0 << c);
+		if(bits) {
+			c = __builtin_ctzll(bits);
+			if(c<CLASS_LARGE) return free_lists[c];
+		}
+	}
 
-static pfs_size_t round_up( pfs_size_t x )
+	for(b=free_lists[CLASS_LARGE];b;b=b->free_next) {
+		if(b->length>=length) return b;
+	}
+
+	return 0;
+}
+
+/*
+When the channel is full, grow it by at least its own size, so that
+a workload that keeps needing more space remaps only a few times.
+*/
+
+static int expand( pfs_size_t length )
 {
-	if(page_size==0) page_size = sysconf(_SC_PAGE_SIZE);
-	if(x%page_size) x = page_size * ((x/page_size)+1);
-	if(x<=0) x=page_size;
-	return x;
+	pfs_size_t newsize;
+	void *newbase;
+	struct block *b;
+
+	debug(D_CHANNEL,"channel is full, attempting to expand it...");
+	newsize = channel_size + MAX(length,channel_size);
+
+	if(ftruncate64(channel_fd,newsize)!=0) return 0;
+
+	newbase = mremap(channel_base,channel_size,newsize,MREMAP_MAYMOVE);
+	if(newbase==MAP_FAILED) {
+		ftruncate64(channel_fd,channel_size);
+		return 0;
+	}
+
+	if(last_block && !last_block->inuse) {
+		free_remove(last_block);
+		last_block->length += newsize-channel_size;
+		free_insert(last_block);
+	} else {
+		b = block_create(channel_size,newsize-channel_size);
+		if(!b) return 0;
+		b->prev = last_block;
+		if(last_block) last_block->next = b;
+		last_block = b;
+		free_insert(b);
+	}
+
+	channel_size = newsize;
+	channel_base = newbase;
+	debug(D_CHANNEL,"channel expanded to 0x%x bytes at base 0x%x",(PTRINT_T)newsize,newbase);
+
+	return 1;
 }
 
 int pfs_channel_alloc( pfs_size_t length, pfs_size_t *start )
 {
-	struct entry *e = head;
-	struct entry *tail;
-	pfs_size_t newsize;
+	struct block *b;
 
 	length = round_up(length);
 
-	do {
-		if(!e->inuse) {
-			if(e->length==length) {
-				e->inuse = 1;
-				*start = e->start;
-				memset(channel_base+*start+length-page_size,0,page_size);
-				return 1;
-			} else if(e->length>length) {
-				struct entry *f;
-				f = entry_create(e->start+length,e->length-length,e,e->next);
-				if(!f) return 0;
-
-				e->length = length;
-				e->inuse = 1;
-				*start = e->start;
-				memset(channel_base+*start+length-page_size,0,page_size);
-				return 1;
-			} else {
-				/* not big enough */
-			}
+	while(!(b=find_free(length))) {
+		if(!expand(length)) {
+			debug(D_CHANNEL|D_NOTICE,"out of channel space: %s",strerror(errno));
+			return 0;
 		}
-		tail = e;
-		e = e->next;
-	} while(e!=head);
+	}
 
-	debug(D_CHANNEL,"channel is full, attempting to expand it...");
-	newsize = channel_size + length;
-
-	if(ftruncate64(channel_fd,newsize)==0) {
-		void *newbase;
-		newbase = mremap(channel_base,channel_size,newsize,MREMAP_MAYMOVE);
-		if(newbase!=MAP_FAILED) {
-			e = entry_create(channel_size,newsize-channel_size,tail,head);
-			channel_size = newsize;
-			channel_base = newbase;
-			debug(D_CHANNEL,"channel expanded to 0x%x bytes at base 0x%x",(PTRINT_T)newsize,newbase);
-			return pfs_channel_alloc(length,start);
+	free_remove(b);
+
+	if(b->length>length) {
+		struct block *f = block_create(b->start+length,b->length-length);
+		if(!f) {
+			free_insert(b);
+			return 0;
 		}
-		ftruncate64(channel_fd,channel_size);
+		f->prev = b;
+		f->next = b->next;
+		if(b->next) b->next->prev = f;
+		b->next = f;
+		if(last_block==b) last_block = f;
+		b->length = length;
+		free_insert(f);
 	}
 
-	debug(D_CHANNEL|D_NOTICE,"out of channel space: %s",strerror(errno));
+	b->inuse = 1;
+	itable_insert(inuse_blocks,b->start,b);
+	*start = b->start;
 
-	return 0;
+	return 1;
 }
 
 void pfs_channel_free( pfs_size_t start )
 {
-	struct entry *e = head;
-
-	do {
-		if(e->start==start) {
-			e->inuse=0;
-			if( (e->prev->start < e->start) && !e->prev->inuse) {
-				struct entry *f = e->prev;
-				f->length += e->length;
-				entry_delete(e);
-				e = f;
-			}
-			if( (e->next->start>e->start) && !e->next->inuse) {
-				struct entry *f = e->next;
-				f->start = e->start;
-				f->length += e->length;
-				entry_delete(e);
-				e = f;
-			}
-			return;
-		}
-		e = e->next;
-	} while(e!=head);
-}
+	struct block *b, *n;
+
+	b = itable_remove(inuse_blocks,start);
+	if(!b) return;
 
+	b->inuse = 0;
 
+	n = b->next;
+	if(n && !n->inuse) {
+		free_remove(n);
+		b->length += n->length;
+		block_unlink(n);
+	}
+
+	n = b->prev;
+	if(n && !n->inuse) {
+		free_remove(n);
+		n->length += b->length;
+		block_unlink(b);
+		b = n;
+	}
+
+	free_insert(b);
+}
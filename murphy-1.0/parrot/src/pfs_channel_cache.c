@@ -20,6 +20,7 @@ See the file COPYING for details.
 #include <stdlib.h>
 #include <string.h>
 #include <errno.h>
+#include <unistd.h>
 #include <sys/mman.h>
 
 static struct hash_table * table=0;
@@ -96,6 +97,14 @@ static int load_file( const char *name, int fd, pfs_size_t length, pfs_size_t st
 		debug(D_CHANNEL,"loading: failed: %s",strerror(errno));
 		return 0;
 	} else {
+		/*
+		the rest of the last page is mapped along with the file,
+		and must read as zeros, whatever was in the channel before.
+		*/
+		pfs_size_t page_size = sysconf(_SC_PAGE_SIZE);
+		pfs_size_t tail = length%page_size;
+		if(tail || length==0) memset(pfs_channel_base()+start+length,0,page_size-tail);
+
 		/*
 		we must invalidate the others' mapping of this file,
 		otherwise, they will see old data that was in this place.
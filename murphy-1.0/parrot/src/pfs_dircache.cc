@@ -9,6 +9,7 @@ See the file COPYING for details.
 #include "pfs_types.h"
 
 extern "C" {
+#include "debug.h"
 #include "hash_table.h"
 #include "stringtools.h"
 #include "xmalloc.h"
@@ -17,83 +18,323 @@ extern "C" {
 #include <errno.h>
 #include <stdio.h>
 #include <stdlib.h>
-#include <sys/mman.h>
 #include <string.h>
 
-pfs_dircache::pfs_dircache() 
+extern int pfs_enable_small_file_optimizations;
+
+#define DIRCACHE_UNKNOWN 0
+#define DIRCACHE_PRESENT 1
+#define DIRCACHE_MISSING 2
+
+/*
+An entry in state DIRCACHE_UNKNOWN records only that the path
+exists, or has been changed here since it was last seen, so that
+the listing of its directory remains good.
+*/
+
+struct pfs_dircache_entry {
+	char *path;
+	int state;
+	struct pfs_stat info;
+	time_t expires;
+	int listed;
+	time_t listed_expires;
+	struct pfs_dircache_entry *prev;
+	struct pfs_dircache_entry *next;
+};
+
+static long long dircache_hits = 0;
+static long long dircache_negative_hits = 0;
+static long long dircache_misses = 0;
+static long long dircache_evictions = 0;
+static long long dircache_invalidations = 0;
+
+static int parent_of( const char *path, char *parent )
+{
+	const char *s = strrchr(path, '/');
+	if (!s || s == path) return 0;
+	strncpy(parent, path, s - path);
+	parent[s - path] = 0;
+	return 1;
+}
+
+pfs_dircache::pfs_dircache( int t )
 {
 	dircache_table = 0;
-	dircache_path  = 0;
+	lru_head = 0;
+	lru_tail = 0;
+	listing = 0;
+	listing_complete = 0;
+	ttl = t;
 }
 
-pfs_dircache::~pfs_dircache() 
+pfs_dircache::~pfs_dircache()
 {
 	invalidate();
 
 	if (dircache_table)
 		hash_table_delete(dircache_table);
+}
 
-	if (dircache_path)
-		free(dircache_path);
+struct pfs_dircache_entry * pfs_dircache::find( const char *path )
+{
+	if (!dircache_table) return 0;
+	return (struct pfs_dircache_entry *) hash_table_lookup(dircache_table, path);
 }
 
-void pfs_dircache::invalidate()
+void pfs_dircache::touch( struct pfs_dircache_entry *e )
+{
+	if (e == lru_head) return;
+
+	e->prev->next = e->next;
+	if (e->next) e->next->prev = e->prev;
+	else lru_tail = e->prev;
+
+	e->prev = 0;
+	e->next = lru_head;
+	lru_head->prev = e;
+	lru_head = e;
+}
+
+struct pfs_dircache_entry * pfs_dircache::create( const char *path )
 {
-	char *key;
-	void *value;
+	struct pfs_dircache_entry *e;
+
+	e = find(path);
+	if (e) {
+		touch(e);
+		return e;
+	}
+
+	if (!dircache_table) dircache_table = hash_table_create(0, 0);
+
+	e = (struct pfs_dircache_entry *) xxmalloc(sizeof(*e));
+	memset(e, 0, sizeof(*e));
+	e->path = xstrdup(path);
+	e->state = DIRCACHE_UNKNOWN;
+	hash_table_insert(dircache_table, path, e);
 
-	if (dircache_table) {
-		hash_table_firstkey(dircache_table);
-		while (hash_table_nextkey(dircache_table, &key, &value)) {
-			hash_table_remove(dircache_table, key);
-			free(value);
+	e->next = lru_head;
+	if (lru_head) lru_head->prev = e;
+	else lru_tail = e;
+	lru_head = e;
+
+	return e;
+}
+
+void pfs_dircache::remove( struct pfs_dircache_entry *e )
+{
+	if (e->prev) e->prev->next = e->next;
+	else lru_head = e->next;
+	if (e->next) e->next->prev = e->prev;
+	else lru_tail = e->prev;
+
+	if (e == listing) listing = 0;
+
+	hash_table_remove(dircache_table, e->path);
+	free(e->path);
+	free(e);
+}
+
+/*
+Dropping an entry loses the knowledge that its name exists,
+so the listing of its directory can no longer be trusted.
+The directory being listed is never dropped.
+*/
+
+void pfs_dircache::trim()
+{
+	char parent[PFS_PATH_MAX];
+	struct pfs_dircache_entry *e, *p;
+
+	while (hash_table_size(dircache_table) > PFS_DIRCACHE_MAX) {
+		e = lru_tail;
+		if (e == listing) {
+			touch(e);
+			continue;
+		}
+		if (parent_of(e->path, parent)) {
+			p = find(parent);
+			if (p) {
+				p->listed = 0;
+				if (p == listing) listing_complete = 0;
+			}
 		}
+		remove(e);
+		dircache_evictions++;
+	}
+}
+
+void pfs_dircache::invalidate()
+{
+	while (lru_head) remove(lru_head);
+	dircache_invalidations++;
+}
+
+/*
+Forget the attributes of path, but not that it exists.
+If path is being listed, the listing is abandoned.
+*/
+
+void pfs_dircache::invalidate( const char *path )
+{
+	char parent[PFS_PATH_MAX];
+	struct pfs_dircache_entry *e, *p;
+
+	if (!dircache_table) return;
+
+	e = find(path);
+	if (!e) {
+		if (!parent_of(path, parent)) return;
+		p = find(parent);
+		if (!p || !p->listed) return;
+		e = create(path);
+		trim();
 	}
 
-	if (dircache_path) {
-		free(dircache_path);
-		dircache_path = 0;
+	e->state = DIRCACHE_UNKNOWN;
+	if (e == listing) {
+		e->listed = 0;
+		listing = 0;
 	}
+
+	dircache_invalidations++;
+}
+
+/*
+Forget path and everything beneath it.  A path known to be
+anything other than a directory has nothing beneath it, which
+spares the search.
+*/
+
+void pfs_dircache::invalidate_tree( const char *path )
+{
+	struct pfs_dircache_entry *e, *next;
+	size_t length = strlen(path);
+
+	e = find(path);
+	if (!e || e->state != DIRCACHE_PRESENT || S_ISDIR(e->info.st_mode)) {
+		for (e = lru_head; e; e = next) {
+			next = e->next;
+			if (!strncmp(e->path, path, length) && e->path[length] == '/') remove(e);
+		}
+		e = find(path);
+		if (e) e->listed = 0;
+	}
+
+	invalidate(path);
 }
 
 void pfs_dircache::begin( const char *path )
 {
-	invalidate();
-	dircache_path = xstrdup(path);
+	listing = 0;
+	if (!pfs_enable_small_file_optimizations) return;
+
+	listing = create(path);
+	listing->listed = 0;
+	listing_complete = 1;
 }
 
 void pfs_dircache::insert( const char *name, struct pfs_stat *buf, pfs_dir *dir )
 {
 	char path[PFS_PATH_MAX];
-	struct pfs_stat *copy;
-	
-	if (!dircache_table) dircache_table = hash_table_create(0, 0);
+	const char *base;
+	size_t length;
 
 	dir->append(name);
 
-	copy = (struct pfs_stat *)xxmalloc(sizeof(struct pfs_stat));
-	*copy = *buf;
+	if (!listing) return;
+
+	base = string_basename(name);
+	if (!strcmp(base, ".") || !strcmp(base, "..")) return;
 
-	sprintf(path, "%s/%s", dircache_path, string_basename(name));
-	hash_table_insert(dircache_table, path, copy);
+	length = strlen(listing->path);
+	if (length > 0 && listing->path[length - 1] == '/') {
+		snprintf(path, sizeof(path), "%s%s", listing->path, base);
+	} else {
+		snprintf(path, sizeof(path), "%s/%s", listing->path, base);
+	}
+
+	insert(path, buf);
 }
 
+void pfs_dircache::end()
+{
+	if (listing && listing_complete) {
+		listing->listed = 1;
+		listing->listed_expires = time(0) + ttl;
+	}
+	listing = 0;
+}
+
+void pfs_dircache::insert( const char *path, struct pfs_stat *buf )
+{
+	struct pfs_dircache_entry *e;
+
+	if (!pfs_enable_small_file_optimizations) return;
+
+	e = create(path);
+	e->state = DIRCACHE_PRESENT;
+	e->info = *buf;
+	e->expires = time(0) + ttl;
+	trim();
+}
+
+void pfs_dircache::insert_missing( const char *path )
+{
+	struct pfs_dircache_entry *e;
+
+	if (!pfs_enable_small_file_optimizations) return;
+
+	e = create(path);
+	e->state = DIRCACHE_MISSING;
+	e->expires = time(0) + ttl;
+	trim();
+}
+
+/*
+Returns 1 and fills buf if the attributes of path are known, -1
+with errno set to ENOENT if path is known not to exist, and 0 if
+the server must be asked.
+*/
+
 int pfs_dircache::lookup( const char *path, struct pfs_stat *buf )
 {
-	struct pfs_stat *value;
-	int result = 0;
+	char parent[PFS_PATH_MAX];
+	struct pfs_dircache_entry *e;
+	time_t now = time(0);
 
-	if (!dircache_table) dircache_table = hash_table_create(0, 0);
+	if (!pfs_enable_small_file_optimizations) return 0;
 
-	value = (struct pfs_stat *)hash_table_lookup(dircache_table, path);
-	if (value) {
-		*buf = *value;
-		hash_table_remove(dircache_table, path);
-		free(value);
-		result = 1;
+	e = find(path);
+	if (e) {
+		touch(e);
+		if (e->state != DIRCACHE_UNKNOWN && e->expires <= now) e->state = DIRCACHE_UNKNOWN;
+		if (e->state == DIRCACHE_PRESENT) {
+			*buf = e->info;
+			dircache_hits++;
+			return 1;
+		} else if (e->state == DIRCACHE_MISSING) {
+			dircache_negative_hits++;
+			errno = ENOENT;
+			return -1;
+		}
+	} else if (parent_of(path, parent)) {
+		e = find(parent);
+		if (e && e->listed && e->listed_expires > now) {
+			dircache_negative_hits++;
+			errno = ENOENT;
+			return -1;
+		}
 	}
 
-	return (result);
+	dircache_misses++;
+	return 0;
+}
+
+void pfs_dircache::report()
+{
+	debug(D_DEBUG, "dircache: %lld hits, %lld negative hits, %lld misses, %lld evictions, %lld invalidations", dircache_hits, dircache_negative_hits, dircache_misses, dircache_evictions, dircache_invalidations);
 }
 
 // vim: ts=8 st=8 sw=8 ft=cpp
@@ -9,6 +9,8 @@ See the file COPYING for details.
 
 #include "pfs_types.h"
 
+#include <time.h>
+
 extern "C" {
 #include "hash_table.h"
 #include "stringtools.h"
@@ -16,20 +18,57 @@ extern "C" {
 }
 
 class pfs_dir;
+struct pfs_dircache_entry;
+
+/*
+A cache of stat results for a remote service, keyed by full path.
+Entries come from directory listings that carry attributes, between
+begin and end, and from individual stats.  A directory whose listing
+completed is known to hold nothing else, so a lookup of any other
+name in it fails with ENOENT without asking the server, as does a
+lookup of a path recorded as missing.  Entries live for the ttl given
+to the service's cache, and the least recently used are dropped once
+there are more than PFS_DIRCACHE_MAX of them.  Each service keeps a
+single cache for all traced processes, and must invalidate a path
+whenever it changes it, or invalidate_tree when it removes or renames
+it.  Nothing is cached when small file optimizations are disabled.
+*/
+
+#define PFS_DIRCACHE_MAX 16384
 
 class pfs_dircache {
 public:
-	pfs_dircache();
+	pfs_dircache( int ttl );
 	virtual ~pfs_dircache();
 
 	virtual void invalidate();
+	virtual void invalidate( const char *path );
+	virtual void invalidate_tree( const char *path );
+
 	virtual void begin( const char *path );
-	virtual void insert( const char *name, struct pfs_stat *buf, pfs_dir *dir);
+	virtual void insert( const char *name, struct pfs_stat *buf, pfs_dir *dir );
+	virtual void end();
+
+	virtual void insert( const char *path, struct pfs_stat *buf );
+	virtual void insert_missing( const char *path );
+
 	virtual int lookup( const char *path, struct pfs_stat *buf );
 
+	static void report();
+
 protected:
+	struct pfs_dircache_entry * find( const char *path );
+	struct pfs_dircache_entry * create( const char *path );
+	void touch( struct pfs_dircache_entry *e );
+	void remove( struct pfs_dircache_entry *e );
+	void trim();
+
 	struct hash_table *dircache_table;
-	char *dircache_path;	
+	struct pfs_dircache_entry *lru_head;
+	struct pfs_dircache_entry *lru_tail;
+	struct pfs_dircache_entry *listing;
+	int listing_complete;
+	int ttl;
 };
 
 #endif
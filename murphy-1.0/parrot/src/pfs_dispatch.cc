@@ -126,7 +126,7 @@ static void decode_read( struct pfs_process *p, int entering, int syscall, INT64
 	char *local_addr;
 	
 	if(entering) {
-		if(!pfs_channel_alloc(length,&p->io_channel_offset)) {
+		if(!pfs_process_channel_alloc(p,length)) {
 			divert_to_dummy(p,-ENOMEM);
 			return;
 		}
@@ -156,7 +156,7 @@ static void decode_read( struct pfs_process *p, int entering, int syscall, INT64
 			} else if(pfs_is_nonblocking(fd)) {
 				divert_to_dummy(p,-EAGAIN);
 			} else {
-				pfs_channel_free(p->io_channel_offset);
+				pfs_process_channel_free(p);
 				p->state = PFS_PROCESS_STATE_WAITREAD;
 				int rfd = pfs_get_real_fd(fd);
 				if(rfd>=0) pfs_poll_wakeon(rfd,PFS_POLL_READ);
@@ -181,7 +181,7 @@ static void decode_read( struct pfs_process *p, int entering, int syscall, INT64
 			tracer_result_set(p->tracer,p->syscall_result);
 		}
 
-		pfs_channel_free(p->io_channel_offset);
+		pfs_process_channel_free(p);
 	}
 }
 
@@ -197,7 +197,7 @@ static void decode_write( struct pfs_process *p, int entering, int syscall, INT6
 	if(entering) {
 		void *uaddr = POINTER(args[1]);
 		INT64_T length = args[2];
-		if(!pfs_channel_alloc(length,&p->io_channel_offset)) {
+		if(!pfs_process_channel_alloc(p,length)) {
 			divert_to_dummy(p,-ENOMEM);
 			return;
 		}
@@ -230,7 +230,7 @@ static void decode_write( struct pfs_process *p, int entering, int syscall, INT6
 					debug(D_SYSCALL,"write returned %lld instead of %lld",p->syscall_result,actual_result);
 				}
 				tracer_result_set(p->tracer,p->syscall_result);
-				pfs_channel_free(p->io_channel_offset);
+				pfs_process_channel_free(p);
 				p->state = PFS_PROCESS_STATE_KERNEL;
 				entering = 0;
 				pfs_write_count += p->syscall_result;
@@ -242,7 +242,7 @@ static void decode_write( struct pfs_process *p, int entering, int syscall, INT6
 				} else {
 					p->syscall_result = -errno;
 					tracer_result_set(p->tracer,p->syscall_result);
-					pfs_channel_free(p->io_channel_offset);
+					pfs_process_channel_free(p);
 					if(p->syscall_result==-EPIPE) {
 						// make sure that we are not in a wait state,
 						// otherwise pfs_process_raise will re-dispatch.
@@ -252,7 +252,7 @@ static void decode_write( struct pfs_process *p, int entering, int syscall, INT6
 				}
 			}
 		} else {
-			pfs_channel_free(p->io_channel_offset);
+			pfs_process_channel_free(p);
 		}
 	}
 }
@@ -417,8 +417,6 @@ static void decode_stat( struct pfs_process *p, int entering, int syscall, INT64
 	int bufsize;
 
 	if(entering) {
-		p->io_channel_offset = 0;
-
 		if(syscall==SYSCALL32_stat) {
 			tracer_copy_in_string(p->tracer,path,POINTER(args[0]),sizeof(path));
 			p->syscall_result = pfs_stat(path,&lbuf);
@@ -430,7 +428,7 @@ static void decode_stat( struct pfs_process *p, int entering, int syscall, INT64
 		}
 
 		if(p->syscall_result>=0) {
-			if(!pfs_channel_alloc(sizeof(kbuf64),&p->io_channel_offset)) {
+			if(!pfs_process_channel_alloc(p,sizeof(kbuf64))) {
 				divert_to_dummy(p,-ENOMEM);
 			} else {
 				local_addr = pfs_channel_base() + p->io_channel_offset;
@@ -453,7 +451,7 @@ static void decode_stat( struct pfs_process *p, int entering, int syscall, INT64
 		}
 	} else {
 		if(p->syscall_result>=0) {
-			pfs_channel_free(p->io_channel_offset);
+			pfs_process_channel_free(p);
 			divert_to_dummy(p,0);
 		}
 	}
@@ -467,8 +465,6 @@ static void decode_statfs( struct pfs_process *p, int entering, int syscall, INT
 	char path[PFS_PATH_MAX];
 
 	if(entering) {
-		p->io_channel_offset = 0;
-
 		if(syscall==SYSCALL32_statfs) {
 			tracer_copy_in_string(p->tracer,path,POINTER(args[0]),sizeof(path));
 			p->syscall_result = pfs_statfs(path,&lbuf);
@@ -1329,6 +1325,8 @@ void decode_syscall( struct pfs_process *p, int entering )
 	context.pid = p->pid;
 	context.childnum = p->childnum;
 	context.ioctl_meta = p->ioctl_meta;
+	context.gremlins = p->gremlins;
+	context.armed = 0;
 
 
 	args = p->syscall_args;
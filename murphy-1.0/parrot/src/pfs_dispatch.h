@@ -17,4 +17,7 @@ void pfs_dispatch( struct pfs_process *p, INT64_T signum );
 void pfs_dispatch32( struct pfs_process *p, INT64_T signum );
 void pfs_dispatch64( struct pfs_process *p, INT64_T signum );
 
+/* syscalls that a seccomp filter may let run without stopping */
+int pfs_dispatch64_untraced( int *syscalls, int max );
+
 #endif
@@ -16,6 +16,11 @@ int pfs_dispatch64( struct pfs_process *p, INT64_T signum )
   return 0;
 }
 
+int pfs_dispatch64_untraced( int *syscalls, int max )
+{
+  return 0;
+}
+
 #else
 
 #include "pfs_sysdeps64.h"
@@ -23,6 +28,7 @@ int pfs_dispatch64( struct pfs_process *p, INT64_T signum )
 #include "pfs_channel_cache.h"
 #include "pfs_process.h"
 #include "pfs_sys.h"
+#include "pfs_pathcache.h"
 #include "pfs_poll.h"
 #include "pfs_service.h"
 #include "controller.h"
@@ -81,11 +87,14 @@ extern INT64_T pfs_read_count;
 extern INT64_T pfs_write_count;
 
 extern int pfs_trap_after_fork;
+extern int pfs_trace_forks;
 
 extern char *pfs_ldso_path;
 extern int *pfs_syscall_totals64;
 
 extern void handle_specific_process( pid_t pid );
+extern void handle_pending_event( pid_t pid );
+extern void discard_pending_events();
 
 // Murphy
 static void (*bail_func)(int pid) = NULL;
@@ -123,6 +132,18 @@ void suspend_and_gdb() {
 
 #include <values.h>
 
+#ifndef F_DUPFD_CLOEXEC
+#define F_DUPFD_CLOEXEC 1030
+#endif
+
+#ifndef CLOSE_RANGE_UNSHARE
+#define CLOSE_RANGE_UNSHARE (1U<<1)
+#endif
+
+#ifndef CLOSE_RANGE_CLOEXEC
+#define CLOSE_RANGE_CLOEXEC (1U<<2)
+#endif
+
 /*
 Divert this incoming system call to a read or write on the I/O channel
 */
@@ -150,6 +171,199 @@ static void divert_to_dummy( struct pfs_process *p, INT64_T result )
 	tracer_args_set(p->tracer,SYSCALL64_getpid,0,0);
 }
 
+/*
+Plain local files that a tracee opens are opened a second time by
+the tracee itself, in place of the dummy call, so that later reads
+and writes that no gremlin touches can go directly between the file
+and the tracee, rather than being copied through the channel.  The
+tracee opens the very name that it passed to the call, which is
+still in its memory, so this is only done for absolute names that
+we do not map elsewhere.  The native descriptor never creates or
+truncates, since that has been done already, and is closed on exec,
+since our mapping to it is dropped then.
+*/
+
+#define NATIVE_OPEN_FLAGS (O_ACCMODE|O_CREAT|O_EXCL|O_TRUNC|O_LARGEFILE|O_CLOEXEC|O_NOCTTY)
+
+static void divert_to_native_open( struct pfs_process *p, int fd, int flags, INT64_T uaddr, const char *path )
+{
+	char name[PFS_PATH_MAX];
+	struct stat64 buf;
+	INT64_T args[TRACER_ARGS_MAX];
+	int rfd;
+
+	if(flags&~NATIVE_OPEN_FLAGS) return;
+	if(path[0]!='/') return;
+	if(p->table->get_native_name(fd,name)!=0) return;
+	if(strcmp(name,path)) return;
+
+	rfd = p->table->get_real_fd(fd);
+	if(rfd<0 || ::fstat64(rfd,&buf)!=0 || !S_ISREG(buf.st_mode)) return;
+
+	args[0] = uaddr;
+	args[1] = (flags&O_ACCMODE)|O_CLOEXEC|O_LARGEFILE;
+	args[2] = 0;
+	tracer_args_set(p->tracer,SYSCALL64_open,args,3);
+	p->syscall_args_changed = 1;
+	p->native_io = 1;
+}
+
+/*
+The tracee's open may have raced with a rename, so the descriptor
+is only used if it leads to the same file that we have open.
+*/
+
+static void native_open_complete( struct pfs_process *p )
+{
+	char path[PFS_PATH_MAX];
+	struct stat64 nbuf, buf;
+	INT64_T nfd;
+	int fd = p->syscall_result;
+
+	p->native_io = 0;
+
+	tracer_result_get(p->tracer,&nfd);
+	if(nfd<0) return;
+
+	sprintf(path,"/proc/%d/fd/%d",p->pid,(int)nfd);
+	if(::stat64(path,&nbuf)==0 && ::fstat64(p->table->get_real_fd(fd),&buf)==0
+			&& nbuf.st_dev==buf.st_dev && nbuf.st_ino==buf.st_ino) {
+		debug(D_SYSCALL,"fd %d is native fd %d",fd,(int)nfd);
+		p->table->set_native_fd(fd,nfd);
+	} else {
+		debug(D_SYSCALL,"native fd %d for fd %d is not the same file",(int)nfd,fd);
+	}
+}
+
+/*
+Divert this incoming read or write to the same buffer on the tracee's
+native descriptor for the file, at the offset that we keep for it.
+The transfer happens in the tracee, so the offset is only known to
+have moved once the call returns.  If another process may move the
+same offset meanwhile, the whole length is reserved on the way in,
+so that two transfers never get the same offset, and whatever was
+not transferred is given back on the way out, if nothing has moved
+the offset since.
+*/
+
+static int native_io_seeks( INT64_T syscall )
+{
+	return syscall==SYSCALL64_read || syscall==SYSCALL64_write
+		|| syscall==SYSCALL64_readv || syscall==SYSCALL64_writev;
+}
+
+static int native_io_reads( INT64_T syscall )
+{
+	return syscall==SYSCALL64_read || syscall==SYSCALL64_pread
+		|| syscall==SYSCALL64_readv || syscall==SYSCALL64_preadv;
+}
+
+static int divert_to_native( struct pfs_process *p, INT64_T syscall, INT64_T *args, INT64_T length )
+{
+	INT64_T nargs[TRACER_ARGS_MAX];
+	INT64_T fd = args[0];
+	pfs_off_t offset;
+	int nfd;
+
+	nfd = p->table->get_native_fd(fd);
+	if(nfd<0) return 0;
+
+	p->native_io_reserved = 0;
+
+	if(native_io_seeks(syscall)) {
+		offset = p->table->lseek(fd,0,SEEK_CUR);
+		if(offset<0) return 0;
+		if(p->table->is_pointer_shared(fd)) {
+			if(length>0 && p->table->lseek(fd,length,SEEK_CUR)<0) return 0;
+			p->native_io_offset = offset;
+			p->native_io_reserved = length;
+		}
+	} else {
+		offset = args[3];
+	}
+
+	nargs[0] = nfd;
+	nargs[1] = args[1];
+	nargs[2] = args[2];
+	nargs[3] = offset;
+	nargs[4] = 0;
+
+	switch(syscall) {
+		case SYSCALL64_read:
+		case SYSCALL64_pread:
+			tracer_args_set(p->tracer,SYSCALL64_pread,nargs,4);
+			break;
+		case SYSCALL64_write:
+		case SYSCALL64_pwrite:
+			tracer_args_set(p->tracer,SYSCALL64_pwrite,nargs,4);
+			break;
+		case SYSCALL64_readv:
+		case SYSCALL64_preadv:
+			tracer_args_set(p->tracer,SYSCALL64_preadv,nargs,5);
+			break;
+		default:
+			tracer_args_set(p->tracer,SYSCALL64_pwritev,nargs,5);
+			break;
+	}
+	p->syscall_args_changed = 1;
+	p->native_io = 1;
+
+	return 1;
+}
+
+static void native_io_complete( struct pfs_process *p, INT64_T syscall, INT64_T *args )
+{
+	INT64_T result;
+	pfs_size_t done;
+
+	p->native_io = 0;
+
+	tracer_result_get(p->tracer,&result);
+	done = result>0 ? result : 0;
+
+	if(p->native_io_reserved) {
+		pfs_off_t end = p->native_io_offset+p->native_io_reserved;
+		if(done<p->native_io_reserved && p->table->lseek(args[0],0,SEEK_CUR)==end) {
+			p->table->lseek(args[0],p->native_io_offset+done,SEEK_SET);
+		}
+		p->native_io_reserved = 0;
+	} else if(done>0 && native_io_seeks(syscall)) {
+		p->table->lseek(args[0],done,SEEK_CUR);
+	}
+
+	if(native_io_reads(syscall)) {
+		pfs_read_count += done;
+	} else {
+		pfs_write_count += done;
+	}
+}
+
+/*
+A native descriptor that is no longer wanted is closed by the tracee
+in place of a dummy call.  A call may give up several at once, so
+they wait here and are closed one per dummy call until none are
+left.
+*/
+
+static void native_close_later( struct pfs_process *p, int nfd )
+{
+	if(nfd<0) return;
+
+	if(p->native_close_count==p->native_close_max) {
+		p->native_close_max = p->native_close_max ? p->native_close_max*2 : 8;
+		p->native_closes = (int*) xxrealloc(p->native_closes,sizeof(int)*p->native_close_max);
+	}
+	p->native_closes[p->native_close_count++] = nfd;
+}
+
+static void divert_to_native_close( struct pfs_process *p )
+{
+	INT64_T args[TRACER_ARGS_MAX];
+	args[0] = p->native_closes[--p->native_close_count];
+	tracer_args_set(p->tracer,SYSCALL64_close,args,1);
+	p->syscall_args_changed = 1;
+}
+
 static int errno_in_progress( int e )
 {
 	return (e==EAGAIN || e==EALREADY || e==EINPROGRESS);
@@ -162,74 +376,230 @@ Read, write, and similar syscalls need better performance
 and thus have more specialized implementations shown here.
 */
 
+#define POINTER( i ) ((void*)(PTRINT_T)(i))
+
+/*
+Gremlin constraints may refer to attributes of the current syscall
+that are costly to compute, such as the canonical name of the file
+being opened.  The dispatcher only marks those as present, and the
+controller calls back here when an armed constraint actually refers
+to one of them.
+*/
+
+/*
+The path arguments of a syscall are wanted by both the gremlin
+context and the handler, so each is copied in, completed and
+canonicalized at most once per stop, on first demand.  The cache
+is cleared when the syscall begins and when it returns.
+*/
+
+static const char * decoded_path( struct pfs_process *p, int i )
+{
+	if(!(p->decoded[i]&PFS_DECODED_PATH)) {
+		tracer_copy_in_string(p->tracer,p->decoded_path[i],POINTER(p->syscall_args[i]),PFS_PATH_MAX);
+		p->decoded[i] |= PFS_DECODED_PATH;
+	}
+	return p->decoded_path[i];
+}
+
+static const char * decoded_full_path( struct pfs_process *p, int i )
+{
+	if(!(p->decoded[i]&PFS_DECODED_FULL_PATH)) {
+		// path may be relative.  turn it into a full path
+		p->table->complete_at_path(AT_FDCWD, decoded_path(p,i), p->decoded_full_path[i]);
+		p->decoded[i] |= PFS_DECODED_FULL_PATH;
+	}
+	return p->decoded_full_path[i];
+}
+
+/*
+A file that does not exist yet has no canonical name, so a failure
+is not remembered: the open handler asks again once it has created
+the file.  Meanwhile, the full path stands in for it.
+*/
+
+static const char * decoded_real_path( struct pfs_process *p, int i )
+{
+	if(!(p->decoded[i]&PFS_DECODED_REAL_PATH)) {
+		const char *full_path = decoded_full_path(p,i);
+		// and resolve symlinks and . and .. references
+		if(pfs_pathcache_realpath(full_path,p->decoded_real_path[i])) {
+			p->decoded[i] |= PFS_DECODED_REAL_PATH;
+		} else {
+			strcpy(p->decoded_real_path[i],full_path);
+		}
+	}
+	return p->decoded_real_path[i];
+}
+
+static void decoded_clear( struct pfs_process *p )
+{
+	memset(p->decoded,0,sizeof(p->decoded));
+}
+
+static void resolve_gremlin_name( struct pfs_process *p, struct controller_syscall_t *sc )
+{
+	switch(p->syscall) {
+		case SYSCALL64_open:
+			sc->name = decoded_real_path(p,0);
+			break;
+		case SYSCALL64_mknod:
+		case SYSCALL64_mkdir:
+			sc->name = decoded_full_path(p,0);
+			break;
+		case SYSCALL64_link:
+		case SYSCALL64_symlink:
+		case SYSCALL64_rename:
+			sc->name = decoded_full_path(p,1);
+			break;
+		default: {
+			// look up the actual file name in our table
+			const char *name = p->filenames->lookup(sc->fd);
+			sc->name = name ? name : "DEADBEEF";
+			break;
+		}
+	}
+}
+
+static void resolve_gremlin_attr( struct controller_syscall_t *sc, int attr )
+{
+	struct pfs_process *p = (struct pfs_process *) sc->resolve_data;
+
+	switch(attr) {
+		case GREMLIN_ATTR_NAME:
+			resolve_gremlin_name(p,sc);
+			break;
+		case GREMLIN_ATTR_OFFSET:
+			sc->offset = p->table->get_fd_offset(sc->fd);
+			break;
+	}
+}
+
+/*
+Start a gremlin context for a syscall on this descriptor.
+The file name is only looked up if a constraint asks for it.
+*/
+
+static void gremlin_fd_context( struct pfs_process *p, struct controller_syscall_t *sc, INT64_T fd )
+{
+	controller_syscall_init(sc,resolve_gremlin_attr,p);
+	sc->fd = fd;
+	controller_syscall_provide(sc,GREMLIN_ATTR_FD);
+	controller_syscall_defer(sc,GREMLIN_ATTR_NAME);
+}
+
+/*
+Apply the read gremlins to a request for length bytes from fd,
+and return the number of bytes that should actually be read.
+*/
+
+static INT64_T read_gremlins( struct pfs_process *p, controller_context_t *ctx, INT64_T fd, INT64_T length )
+{
+	struct controller_syscall_t sc;
+	gremlin_fd_context(p,&sc,fd);
+	sc.length = length;
+	controller_syscall_provide(&sc,GREMLIN_ATTR_LENGTH);
+
+	if (GREMLIN_ARMED(ctx,GREMLIN_READLESS) &&
+			controller_doevil(GREMLIN_READLESS, ctx, &sc)) {
+		if(length>1) {
+			INT64_T n = length;
+			length >>= 1;
+			debug(D_MURPHY, "readless: changing bytes from %lli to %lli\n", n, length);
+		}
+	} else
+	if (GREMLIN_ARMED(ctx,GREMLIN_READONE_S) &&
+			controller_doevil(GREMLIN_READONE_S, ctx, &sc)) {
+		if(p->readone_s_remainder == length) {
+			p->readone_s_remainder = 0;
+			debug(D_MURPHY, "readone_s: leaving request of %i alone, setting remainder to 0.\n");
+		} else {
+			INT64_T n = length;
+			p->readone_s_remainder = length - 1;
+			length = 1;
+			debug(D_MURPHY, "readone_s: changing request from %lli to 1 and setting remainder to %i\n", n, p->readone_s_remainder);
+		}
+	} else
+	if (GREMLIN_ARMED(ctx,GREMLIN_READONE) &&
+			controller_doevil(GREMLIN_READONE, ctx, &sc)) {
+		debug(D_MURPHY, "readone: changing bytes from %lli to 1\n", length);
+		length = 1;
+	}
+
+	return length;
+}
+
+/*
+Apply the write gremlins in the same way.  A result of -1
+means that nothing should be written, and zero returned.
+*/
+
+static INT64_T write_gremlins( struct pfs_process *p, controller_context_t *ctx, INT64_T fd, INT64_T length )
+{
+	struct controller_syscall_t sc;
+	gremlin_fd_context(p,&sc,fd);
+	sc.length = length;
+	controller_syscall_provide(&sc,GREMLIN_ATTR_LENGTH);
+
+	if (GREMLIN_ARMED(ctx,GREMLIN_WRITEZERO) &&
+			controller_doevil(GREMLIN_WRITEZERO, ctx, &sc)) {
+		debug(D_MURPHY, "writezero: being lazy, not writing, returning 0\n");
+		return -1;
+	} else
+	if (GREMLIN_ARMED(ctx,GREMLIN_WRITELESS) &&
+			controller_doevil(GREMLIN_WRITELESS, ctx, &sc)) {
+		if(length>1) {
+			INT64_T n = length;
+			length >>= 1;
+			debug(D_MURPHY, "writeless: changing bytes from %lli to %lli\n", n, length);
+		}
+	} else
+	if (GREMLIN_ARMED(ctx,GREMLIN_WRITEONE_S) &&
+			controller_doevil(GREMLIN_WRITEONE_S, ctx, &sc)) {
+		if(p->writeone_s_remainder == length) {
+			p->writeone_s_remainder = 0;
+			debug(D_MURPHY, "writeone_s: leaving request of %i alone, setting remainder to 0.\n");
+		} else {
+			INT64_T n = length;
+			p->writeone_s_remainder = length - 1;
+			length = 1;
+			debug(D_MURPHY, "writeone_s: changing request from %lli to 1 and setting remainder to %i\n", n, p->writeone_s_remainder);
+		}
+	} else
+	if (GREMLIN_ARMED(ctx,GREMLIN_WRITEONE) &&
+			controller_doevil(GREMLIN_WRITEONE, ctx, &sc)) {
+		debug(D_MURPHY, "writeone: changing bytes from %lli to 1\n", length);
+		length = 1;
+	}
+
+	return length;
+}
+
 /*
 SYSCALL64_read and friends are implemented by loading the data
 into the channel, and then redirecting the system call
-to read from the channel fd. SYSCALL64_readv is done exactly
-the same as read, but only the first chunk is actually
-read.  The caller must examine the result and then keep reading.
+to read from the channel fd.  The vectored calls are
+handled in the same way below, by decode_readv.
 */
 
-#define POINTER( i ) ((void*)(PTRINT_T)(i))
-
 static void decode_read( struct pfs_process *p, INT64_T entering, INT64_T syscall, INT64_T *args, controller_context_t *ctx )
 {
 	INT64_T fd = args[0];
 	void *uaddr = POINTER(args[1]);
 
 	if(entering) {
+		INT64_T length = read_gremlins(p,ctx,fd,args[2]);
 
-		MyString ad_text;
-		MyString tmp;
-
-		ad_text += "[ ";
-
-		ad_text += "FD = ";
-		ad_text += (int)(fd);
-		ad_text += "; ";
-
-		// look up the actual file name in our hash table
-		tmp = "DEADBEEF";
-		p->filenames->lookup(fd, tmp);
-		ad_text += "Name = ";
-		ad_text += "\"";
-		ad_text += tmp.EscapeChars("\"\\", '\\');
-		ad_text += "\"";
-		ad_text += "; ";
-
-		ad_text += "Length = ";
-		ad_text += (int)(args[2]);
-		ad_text += "; ";
-
-		ad_text += "]";
-
-		if (controller_doevil("readless", ctx, ad_text.Value())) {
-			if(args[2]>1) {
-				INT64_T n = args[2];
-				args[2] >>= 1;
-				debug(D_MURPHY, "readless: changing bytes from %lli to %lli\n", n, args[2]);
-			}
-		} else
-		if (controller_doevil("readone_s", ctx, ad_text.Value())) {
-			if(p->readone_s_remainder == args[2]) {
-				p->readone_s_remainder = 0;
-				debug(D_MURPHY, "readone_s: leaving request of %i alone, setting remainder to 0.\n");
-			} else {
-				INT64_T n = args[2];
-				p->readone_s_remainder = args[2] - 1;
-				args[2] = 1;
-				debug(D_MURPHY, "readone_s: changing request from %lli to 1 and setting remainder to %i\n", n, p->readone_s_remainder);
-			}
-		} else
-		if (controller_doevil("readone", ctx, ad_text.Value())) {
-			debug(D_MURPHY, "readone: changing bytes from %lli to 1\n", args[2]);
-			args[2] = 1;
+		if(syscall!=SYSCALL64_recvfrom && length==args[2] && divert_to_native(p,syscall,args,length)) {
+			return;
 		}
-		pfs_size_t length = args[2];
+
+		args[2] = length;
+
 		pfs_off_t offset = args[3];
 		char *local_addr;
 	
-		if(!pfs_channel_alloc(length,&p->io_channel_offset)) {
+		if(!pfs_process_channel_alloc(p,length)) {
 			divert_to_dummy(p,-ENOMEM);
 			return;
 		}
@@ -257,7 +627,7 @@ static void decode_read( struct pfs_process *p, INT64_T entering, INT64_T syscal
 			} else if(pfs_is_nonblocking(fd)) {
 				divert_to_dummy(p,-EAGAIN);
 			} else {
-				pfs_channel_free(p->io_channel_offset);
+				pfs_process_channel_free(p);
 				p->state = PFS_PROCESS_STATE_WAITREAD;
 				INT64_T rfd = pfs_get_real_fd(fd);
 				if(rfd>=0) pfs_poll_wakeon(rfd,PFS_POLL_READ);
@@ -265,6 +635,8 @@ static void decode_read( struct pfs_process *p, INT64_T entering, INT64_T syscal
 		} else {
 			divert_to_dummy(p,-errno);
 		}
+	} else if(p->native_io) {
+		native_io_complete(p,syscall,args);
 	} else {
 		/*
 		This is an ugly situation.
@@ -276,13 +648,13 @@ static void decode_read( struct pfs_process *p, INT64_T entering, INT64_T syscal
 		the ugly slow copy out instead.
 		*/
 
-		if( (p->syscall_result==-EINTR) && (p->diverted_length>0) ) {
+		if( !p->syscall_dummy && (p->syscall_result==-EINTR) && (p->diverted_length>0) ) {
 			tracer_copy_out(p->tracer,pfs_channel_base()+p->io_channel_offset,uaddr,p->diverted_length);
 			p->syscall_result = p->diverted_length;
 			tracer_result_set(p->tracer,p->syscall_result);
 		}
 
-		pfs_channel_free(p->io_channel_offset);
+		pfs_process_channel_free(p);
 	}
 }
 
@@ -298,77 +670,40 @@ static void decode_write( struct pfs_process *p, INT64_T entering, INT64_T sysca
 	if(entering) {
 		INT64_T fd = args[0];
 
-		MyString ad_text;
-		MyString tmp;
-
-		ad_text += "[ ";
-
-		ad_text += "FD = ";
-		ad_text += (int)(args[0]);
-		ad_text += "; ";
+		INT64_T length = write_gremlins(p,ctx,fd,args[2]);
 
-		// look up the actual file name in our hash table
-		tmp = "DEADBEEF";
-		p->filenames->lookup(fd, tmp);
-		ad_text += "Name = ";
-		ad_text += "\"";
-		ad_text += tmp.EscapeChars("\"\\", '\\');
-		ad_text += "\"";
-		ad_text += "; ";
-
-		ad_text += "Length = ";
-		ad_text += (int)(args[2]);
-		ad_text += "; ";
-
-		ad_text += "]";
-
-		if (controller_doevil("writezero", ctx, ad_text.Value())) {
-			debug(D_MURPHY, "writezero: being lazy, not writing, returning 0\n");
+		if(length<0) {
 			divert_to_dummy(p,0);
 			return;
-		} else
-		if (controller_doevil("writeless", ctx, ad_text.Value())) {
-			if(args[2]>1) {
-				INT64_T n = args[2];
-				args[2] >>= 1;
-				debug(D_MURPHY, "writeless: changing bytes from %lli to %lli\n", n, args[2]);
-			}
-		} else
-		if (controller_doevil("writeone_s", ctx, ad_text.Value())) {
-			if(p->writeone_s_remainder == args[2]) {
-				p->writeone_s_remainder = 0;
-				debug(D_MURPHY, "writeone_s: leaving request of %i alone, setting remainder to 0.\n");
-			} else {
-				INT64_T n = args[2];
-				p->writeone_s_remainder = args[2] - 1;
-				args[2] = 1;
-				debug(D_MURPHY, "writeone_s: changing request from %lli to 1 and setting remainder to %i\n", n, p->writeone_s_remainder);
-			}
-		} else
-		if(entering && controller_doevil("writeone", ctx, ad_text.Value())) {
-			debug(D_MURPHY, "writeone: changing bytes from %lli to 1\n", args[2]);
-			args[2] = 1;
-		} 
+		}
+
+		if(syscall!=SYSCALL64_sendto && length==args[2] && divert_to_native(p,syscall,args,length)) {
+			return;
+		}
+
+		args[2] = length;
 
 		void *uaddr = POINTER(args[1]);
-		INT64_T length = args[2];
-		if(!pfs_channel_alloc(length,&p->io_channel_offset)) {
+		if(!pfs_process_channel_alloc(p,length)) {
 			divert_to_dummy(p,-ENOMEM);
 			return;
 		}
 		divert_to_channel(p,SYSCALL64_pwrite,uaddr,length,p->io_channel_offset);
+	} else if(p->native_io) {
+		native_io_complete(p,syscall,args);
 	} else {
 		INT64_T actual_result;
 		tracer_result_get(p->tracer,&actual_result);
 
-		if(actual_result>0) {
+		// a dummy call, for a gremlin or an error, put nothing in the channel
+		if(actual_result>0 && !p->syscall_dummy) {
 			INT64_T fd = args[0];
 			pfs_off_t offset = args[3];
 			char *local_addr = pfs_channel_base() + p->io_channel_offset;
 
-			if(syscall==SYSCALL64_write) {
+			if(syscall==SYSCALL64_write || syscall==SYSCALL64_writev) {
 				p->syscall_result = pfs_write(fd,local_addr,actual_result);
-			} else if(syscall==SYSCALL64_pwrite) {
+			} else if(syscall==SYSCALL64_pwrite || syscall==SYSCALL64_pwritev) {
 				p->syscall_result = pfs_pwrite(fd,local_addr,actual_result,offset);
 			} else if(syscall==SYSCALL64_sendto) {
 				p->syscall_result = pfs_sendto(fd,local_addr,actual_result,args[3],(struct sockaddr *)args[4],args[5]);
@@ -376,7 +711,7 @@ static void decode_write( struct pfs_process *p, INT64_T entering, INT64_T sysca
 
 			if(p->syscall_result>=0) {
 				tracer_result_set(p->tracer,p->syscall_result);
-				pfs_channel_free(p->io_channel_offset);
+				pfs_process_channel_free(p);
 				p->state = PFS_PROCESS_STATE_KERNEL;
 				entering = 0;
 				pfs_write_count += p->syscall_result;
@@ -388,7 +723,7 @@ static void decode_write( struct pfs_process *p, INT64_T entering, INT64_T sysca
 				} else {
 					p->syscall_result = -errno;
 					tracer_result_set(p->tracer,p->syscall_result);
-					pfs_channel_free(p->io_channel_offset);
+					pfs_process_channel_free(p);
 					if(p->syscall_result==-EPIPE) {
 						// make sure that we are not in a wait state,
 						// otherwise pfs_process_raise will re-dispatch.
@@ -398,7 +733,7 @@ static void decode_write( struct pfs_process *p, INT64_T entering, INT64_T sysca
 				}
 			}
 		} else {
-			pfs_channel_free(p->io_channel_offset);
+			pfs_process_channel_free(p);
 		}
 	}
 }
@@ -426,128 +761,275 @@ static int iovec_size( struct pfs_process *p, struct pfs_kernel_iovec *v, int co
 	return total;	
 }
 
-static int iovec_copy_in( struct pfs_process *p, char *buf, struct pfs_kernel_iovec *v, int count )
+/*
+Lay the user buffers end to end in buf, and move them all
+with one scatter/gather copy.  On x86_64, pfs_kernel_iovec
+has the same layout as struct iovec.
+*/
+
+static int iovec_copy( struct pfs_process *p, char *buf, struct pfs_kernel_iovec *v, int count, int out )
 {
 	int i, pos=0;
+	struct iovec *local = (struct iovec *) malloc(sizeof(struct iovec)*count);
+	if(!local) return 0;
 	for(i=0;i<count;i++) {
-		tracer_copy_in(p->tracer,&buf[pos],(void*)v[i].iov_base,v[i].iov_len);
+		local[i].iov_base = &buf[pos];
+		local[i].iov_len = v[i].iov_len;
 		pos += v[i].iov_len;
 	}
+	if(out) {
+		tracer_copy_out_vector(p->tracer,local,(struct iovec *)v,count);
+	} else {
+		tracer_copy_in_vector(p->tracer,local,(struct iovec *)v,count);
+	}
+	free(local);
 	return pos;
 }
 
+static int iovec_copy_in( struct pfs_process *p, char *buf, struct pfs_kernel_iovec *v, int count )
+{
+	return iovec_copy(p,buf,v,count,0);
+}
+
 static int iovec_copy_out( struct pfs_process *p, char *buf, struct pfs_kernel_iovec *v, int count )
 {
-	int i, pos=0;
+	return iovec_copy(p,buf,v,count,1);
+}
+
+/*
+Add a pair of buffers to a scatter/gather copy, if the user gave one.
+*/
+
+static void iovec_add( struct iovec *local, struct iovec *remote, int *count, void *data, INT64_T uaddr, INT64_T length )
+{
+	if(!uaddr) return;
+	local[*count].iov_base = data;
+	local[*count].iov_len = length;
+	remote[*count].iov_base = POINTER(uaddr);
+	remote[*count].iov_len = length;
+	(*count)++;
+}
+
+/*
+The vectored calls move the whole request at once.  The data passes
+through the channel as for read and write, and the tracee's call is
+diverted to preadv or pwritev on the channel fd with its own iovec,
+so that the kernel scatters or gathers it in one step.  Gremlins act
+on the total length.  When a gremlin or a short read leaves less data
+than the iovec describes, we copy just that much between the channel
+and the tracee ourselves, and divert to a dummy call.
+*/
+
+static void divert_to_channel_vector( struct pfs_process *p, INT64_T syscall, const void *uv, INT64_T count, INT64_T length, pfs_size_t channel_offset )
+{
+	INT64_T args[TRACER_ARGS_MAX];
+	args[0] = pfs_channel_fd();
+	args[1] = (INT64_T) uv;
+	args[2] = count;
+	args[3] = (INT64_T) (channel_offset);
+	args[4] = 0;
+	tracer_args_set(p->tracer,syscall,args,5);
+	p->syscall_args_changed = 1;
+	p->diverted_length = length;
+}
+
+/*
+Fetch the tracee's iovec into v, and return its total length,
+or a negative errno if the kernel would refuse it.
+*/
+
+static INT64_T iovec_load( struct pfs_process *p, struct pfs_kernel_iovec *v, INT64_T *args )
+{
+	struct pfs_kernel_iovec *uv = (struct pfs_kernel_iovec *) args[1];
+	INT64_T count = args[2];
+	INT64_T total = 0;
+	int i;
+
+	if(count<0 || count>PFS_IOV_MAX) return -EINVAL;
+	if(count==0) return 0;
+
+	if(tracer_copy_in(p->tracer,v,uv,sizeof(*v)*count)!=(int)(sizeof(*v)*count)) return -EFAULT;
+
 	for(i=0;i<count;i++) {
-		tracer_copy_out(p->tracer,&buf[pos],(void*)v[i].iov_base,v[i].iov_len);
-		pos += v[i].iov_len;
+		if((INT64_T)v[i].iov_len<0) return -EINVAL;
+		total += v[i].iov_len;
+		if(total<0) return -EINVAL;
 	}
-	return pos;
+
+	return total;
 }
 
 /*
-Both readv and writev have a careful but inefficient implementation.
-For each uio block, we examine the data structures, do a manual
-read and write in our local buffer, and then copy the data over.
-I assume that these are not heavily used system calls, although
-they do seem to appear sporadically in X11, the dynamic linker,
-and sporadically in networking utilities.
+Move the first length bytes described by v between the tracee and buf.
 */
 
-static void decode_readv( struct pfs_process *p, INT64_T entering, INT64_T syscall, INT64_T *args )
+static void iovec_copy_length( struct pfs_process *p, char *buf, struct pfs_kernel_iovec *v, int count, INT64_T length, int out )
+{
+	struct iovec local[PFS_IOV_MAX];
+	struct iovec remote[PFS_IOV_MAX];
+	INT64_T pos = 0;
+	int i;
+
+	for(i=0;i<count && pos<length;i++) {
+		INT64_T chunk = MIN((INT64_T)v[i].iov_len,length-pos);
+		local[i].iov_base = &buf[pos];
+		local[i].iov_len = chunk;
+		remote[i].iov_base = v[i].iov_base;
+		remote[i].iov_len = chunk;
+		pos += chunk;
+	}
+
+	if(out) {
+		tracer_copy_out_vector(p->tracer,local,remote,i);
+	} else {
+		tracer_copy_in_vector(p->tracer,local,remote,i);
+	}
+}
+
+static void decode_readv( struct pfs_process *p, INT64_T entering, INT64_T syscall, INT64_T *args, controller_context_t *ctx )
 {
+	INT64_T fd = args[0];
+	struct pfs_kernel_iovec v[PFS_IOV_MAX];
+
 	if(entering) {
-		INT64_T fd = args[0];
-		struct pfs_kernel_iovec *uv = (struct pfs_kernel_iovec *) args[1];
-		INT64_T count = args[2];
+		INT64_T total, length;
+		char *local_addr;
 
-		struct pfs_kernel_iovec *v;
-		INT64_T size;
-		char *buffer;
-		INT64_T result;
-		
-		if(!uv || count<=0) {
-			divert_to_dummy(p,-EINVAL);
+		total = iovec_load(p,v,args);
+		if(total<0) {
+			divert_to_dummy(p,total);
 			return;
 		}
 
-		v = iovec_alloc_in(p,uv,count);
-		if(v) {
-			size = iovec_size(p,v,count);
-			buffer = (char*) malloc(size);
-			if(buffer) {
-				result = pfs_read(fd,buffer,size);
-				if(result>=0) {
-					iovec_copy_out(p,buffer,v,count);
-					divert_to_dummy(p,result);
-				} else {
-					if(errno==EAGAIN && !pfs_is_nonblocking(fd)) {
-						p->state = PFS_PROCESS_STATE_WAITREAD;
-						int rfd = pfs_get_real_fd(fd);
-						if(rfd>=0) pfs_poll_wakeon(rfd,PFS_POLL_READ);
-					} else {
-						divert_to_dummy(p,-errno);
-					}
-				}
-				free(buffer);
+		length = read_gremlins(p,ctx,fd,total);
+
+		if(length==total && divert_to_native(p,syscall,args,total)) {
+			return;
+		}
+
+		if(!pfs_process_channel_alloc(p,length)) {
+			divert_to_dummy(p,-ENOMEM);
+			return;
+		}
+		local_addr = pfs_channel_base() + p->io_channel_offset;
+
+		if(syscall==SYSCALL64_readv) {
+			p->syscall_result = pfs_read(fd,local_addr,length);
+		} else {
+			p->syscall_result = pfs_pread(fd,local_addr,length,args[3]);
+		}
+
+		p->diverted_length = 0;
+
+		if(p->syscall_result==0) {
+			divert_to_dummy(p,0);
+		} else if(p->syscall_result==total) {
+			divert_to_channel_vector(p,SYSCALL64_preadv,POINTER(args[1]),args[2],total,p->io_channel_offset);
+			pfs_read_count += p->syscall_result;
+		} else if(p->syscall_result>0) {
+			iovec_copy_length(p,local_addr,v,args[2],p->syscall_result,1);
+			divert_to_dummy(p,p->syscall_result);
+			pfs_read_count += p->syscall_result;
+		} else if( errno==EAGAIN ) {
+			if(p->interrupted) {
+				p->interrupted = 0;
+				divert_to_dummy(p,-EINTR);
+			} else if(pfs_is_nonblocking(fd)) {
+				divert_to_dummy(p,-EAGAIN);
 			} else {
-				divert_to_dummy(p,-ENOMEM);
+				pfs_process_channel_free(p);
+				p->state = PFS_PROCESS_STATE_WAITREAD;
+				INT64_T rfd = pfs_get_real_fd(fd);
+				if(rfd>=0) pfs_poll_wakeon(rfd,PFS_POLL_READ);
 			}
-			free(v);		
 		} else {
-			divert_to_dummy(p,-ENOMEM);
+			divert_to_dummy(p,-errno);
+		}
+	} else if(p->native_io) {
+		native_io_complete(p,syscall,args);
+	} else {
+		/* as in decode_read, an interrupted channel read is finished by hand */
+		if( !p->syscall_dummy && (p->syscall_result==-EINTR) && (p->diverted_length>0) ) {
+			if(iovec_load(p,v,args)>=0) {
+				iovec_copy_length(p,pfs_channel_base()+p->io_channel_offset,v,args[2],p->diverted_length,1);
+				p->syscall_result = p->diverted_length;
+				tracer_result_set(p->tracer,p->syscall_result);
+			}
 		}
+
+		pfs_process_channel_free(p);
 	}
 }
 
-static void decode_writev( struct pfs_process *p, INT64_T entering, INT64_T syscall, INT64_T *args )
+/*
+A whole writev is gathered into the channel by the tracee, and then
+written out from there by decode_write, just as for write.
+*/
+
+static void decode_writev( struct pfs_process *p, INT64_T entering, INT64_T syscall, INT64_T *args, controller_context_t *ctx )
 {
-	if(entering) {
-		INT64_T fd = args[0];
-		struct pfs_kernel_iovec *uv = (struct pfs_kernel_iovec *) args[1];
-		INT64_T count = args[2];
+	INT64_T fd = args[0];
+	struct pfs_kernel_iovec v[PFS_IOV_MAX];
 
-		struct pfs_kernel_iovec *v;
-		INT64_T size;
-		char *buffer;
+	if(entering) {
+		INT64_T total, length;
+		char *local_addr;
 		INT64_T result;
 
-		if(!uv || count<=0) {
-			divert_to_dummy(p,-EINVAL);
+		total = iovec_load(p,v,args);
+		if(total<0) {
+			divert_to_dummy(p,total);
 			return;
 		}
 
-		v = iovec_alloc_in(p,uv,count);
-		if(v) {
-			size = iovec_size(p,v,count);
-			buffer = (char *) malloc(size);
-			if(buffer) {
-				iovec_copy_in(p,buffer,v,count);
-				result = pfs_write(fd,buffer,size);
-				if(result>=0) {
-					divert_to_dummy(p,result);
-				} else if(result<0) {
-					if(errno==EAGAIN && !pfs_is_nonblocking(fd)) {
-						/*
-                                                WAITREAD is correct here, because WAITWRITE
-						would cause us to be called again with entering=0
-						*/
-						p->state = PFS_PROCESS_STATE_WAITREAD;
-						int rfd = pfs_get_real_fd(fd);
-						if(rfd>=0) pfs_poll_wakeon(rfd,PFS_POLL_WRITE);
-					} else {
-						divert_to_dummy(p,-errno);
-					}
-				}
-				free(buffer);
-			} else {
-				divert_to_dummy(p,-ENOMEM);
-			}
-			free(v);		
-		} else {
+		length = write_gremlins(p,ctx,fd,total);
+
+		if(length<0) {
+			divert_to_dummy(p,0);
+			return;
+		}
+
+		if(length==total && divert_to_native(p,syscall,args,total)) {
+			return;
+		}
+
+		if(!pfs_process_channel_alloc(p,length)) {
 			divert_to_dummy(p,-ENOMEM);
+			return;
+		}
+
+		if(length==total) {
+			divert_to_channel_vector(p,SYSCALL64_pwritev,POINTER(args[1]),args[2],total,p->io_channel_offset);
+			return;
+		}
+
+		local_addr = pfs_channel_base() + p->io_channel_offset;
+		iovec_copy_length(p,local_addr,v,args[2],length,0);
+
+		if(syscall==SYSCALL64_writev) {
+			result = pfs_write(fd,local_addr,length);
+		} else {
+			result = pfs_pwrite(fd,local_addr,length,args[3]);
+		}
+
+		if(result>=0) {
+			divert_to_dummy(p,result);
+			pfs_write_count += result;
+		} else if(errno==EAGAIN && !pfs_is_nonblocking(fd)) {
+			/*
+			WAITREAD is correct here, because WAITWRITE
+			would cause us to be called again with entering=0
+			*/
+			p->state = PFS_PROCESS_STATE_WAITREAD;
+			int rfd = pfs_get_real_fd(fd);
+			if(rfd>=0) pfs_poll_wakeon(rfd,PFS_POLL_WRITE);
+		} else {
+			divert_to_dummy(p,-errno);
 		}
+
+		pfs_process_channel_free(p);
+	} else {
+		decode_write(p,entering,syscall,args,ctx);
 	}
 }
 
@@ -561,8 +1043,6 @@ static void decode_stat( struct pfs_process *p, INT64_T entering, INT64_T syscal
 	char path[PFS_PATH_MAX];
 
 	if(entering) {
-		p->io_channel_offset = 0;
-
 		if(syscall==SYSCALL64_stat) {
 			tracer_copy_in_string(p->tracer,path,POINTER(args[0]),sizeof(path));
 			p->syscall_result = pfs_stat(path,&lbuf);
@@ -574,7 +1054,7 @@ static void decode_stat( struct pfs_process *p, INT64_T entering, INT64_T syscal
 		}
 
 		if(p->syscall_result>=0) {
-			if(!pfs_channel_alloc(sizeof(kbuf),&p->io_channel_offset)) {
+			if(!pfs_process_channel_alloc(p,sizeof(kbuf))) {
 				divert_to_dummy(p,-ENOMEM);
 			} else {
 				local_addr = pfs_channel_base() + p->io_channel_offset;
@@ -587,7 +1067,7 @@ static void decode_stat( struct pfs_process *p, INT64_T entering, INT64_T syscal
 		}
 	} else {
 		if(p->syscall_result>=0) {
-			pfs_channel_free(p->io_channel_offset);
+			pfs_process_channel_free(p);
 			divert_to_dummy(p,0);
 		}
 	}
@@ -604,8 +1084,6 @@ static void decode_statfs( struct pfs_process *p, INT64_T entering, INT64_T sysc
 	INT64_T bufsize;
 
 	if(entering) {
-		p->io_channel_offset = 0;
-
 		if(syscall==SYSCALL64_statfs) {
 			tracer_copy_in_string(p->tracer,path,POINTER(args[0]),sizeof(path));
 			p->syscall_result = pfs_statfs(path,&lbuf);
@@ -614,7 +1092,7 @@ static void decode_statfs( struct pfs_process *p, INT64_T entering, INT64_T sysc
 		}
 
 		if(p->syscall_result>=0) {
-			if(!pfs_channel_alloc(sizeof(kbuf),&p->io_channel_offset)) {
+			if(!pfs_process_channel_alloc(p,sizeof(kbuf))) {
 				divert_to_dummy(p,-ENOMEM);
 			} else {
 				local_addr = pfs_channel_base() + p->io_channel_offset;
@@ -628,7 +1106,7 @@ static void decode_statfs( struct pfs_process *p, INT64_T entering, INT64_T sysc
 		}
 	} else {
 		if(p->syscall_result>=0) {
-			pfs_channel_free(p->io_channel_offset);
+			pfs_process_channel_free(p);
 			divert_to_dummy(p,0);
 		}
 	}
@@ -971,7 +1449,10 @@ static void decode_execve( struct pfs_process *p, INT64_T entering, INT64_T sysc
 			/* after a successful exec, signal handlers are reset */
 			memset(p->signal_interruptible,0,sizeof(p->signal_interruptible));
 			/* and certain files in the file table are closed */
+			p->filenames = p->filenames->close_on_exec(p->table);
 			p->table->close_on_exec();
+			/* along with every native fd, which the tracee opens close-on-exec */
+			p->native_close_count = 0;
 			/* and our knowledge of the address space is gone. */
 			p->heap_address = 0;
 			p->break_address = 0;
@@ -1071,6 +1552,120 @@ static INT64_T decode_ioctl_siocgifconf( struct pfs_process *p, INT64_T fd, INT6
 	return result;
 }
 
+/*
+System calls that decode_syscall hands to the kernel untouched,
+as listed in the pass-through case at the end of its switch.
+These are the only ones that may run without us seeing them.
+*/
+
+static const int passthrough_syscalls64[] = {
+	SYSCALL64_alarm,
+	SYSCALL64_futex,
+	SYSCALL64_getgroups,
+	SYSCALL64_getitimer,
+	SYSCALL64_getpgid,
+	SYSCALL64_getpgrp,
+	SYSCALL64_getpid,
+	SYSCALL64_getpriority,
+	SYSCALL64_getrlimit,
+	SYSCALL64_getrusage,
+	SYSCALL64_getsid,
+	SYSCALL64_gettid,
+	SYSCALL64_gettimeofday,
+	SYSCALL64_madvise,
+	SYSCALL64_mincore,
+	SYSCALL64_mlock,
+	SYSCALL64_mlockall,
+	SYSCALL64_mprotect,
+	SYSCALL64_mremap,
+	SYSCALL64_msync,
+	SYSCALL64_munlock,
+	SYSCALL64_munlockall,
+	SYSCALL64_nanosleep,
+	SYSCALL64_pause,
+	SYSCALL64_prctl,
+	SYSCALL64_arch_prctl,
+	SYSCALL64_restart_syscall,
+	SYSCALL64_rt_sigpending,
+	SYSCALL64_rt_sigprocmask,
+	SYSCALL64_rt_sigqueueinfo,
+	SYSCALL64_rt_sigreturn,
+	SYSCALL64_rt_sigsuspend,
+	SYSCALL64_rt_sigtimedwait,
+	SYSCALL64_sched_get_priority_max,
+	SYSCALL64_sched_get_priority_min,
+	SYSCALL64_sched_getparam,
+	SYSCALL64_sched_getscheduler,
+	SYSCALL64_sched_rr_get_interval,
+	SYSCALL64_sched_setparam,
+	SYSCALL64_sched_setscheduler,
+	SYSCALL64_sched_yield,
+	SYSCALL64_setitimer,
+	SYSCALL64_setpgid,
+	SYSCALL64_setpriority,
+	SYSCALL64_setrlimit,
+	SYSCALL64_set_tid_address,
+	SYSCALL64_sigaltstack,
+	SYSCALL64_sysinfo,
+	SYSCALL64_time,
+	SYSCALL64_times,
+	SYSCALL64_sched_setaffinity,
+	SYSCALL64_sched_getaffinity,
+	SYSCALL64_set_thread_area,
+	SYSCALL64_get_thread_area,
+	SYSCALL64_timer_create,
+	SYSCALL64_timer_settime,
+	SYSCALL64_timer_gettime,
+	SYSCALL64_timer_getoverrun,
+	SYSCALL64_timer_delete,
+	SYSCALL64_clock_gettime,
+	SYSCALL64_clock_getres,
+	SYSCALL64_clock_nanosleep,
+	SYSCALL64_get_robust_list,
+	SYSCALL64_set_robust_list,
+};
+
+static char untraced_syscalls64[SYSCALL64_MAX];
+
+/*
+Fill in the syscalls that a seccomp filter may let run untraced:
+those we pass through, unless some gremlin could fire on them
+under the config we start with.
+*/
+
+int pfs_dispatch64_untraced( int *syscalls, int max )
+{
+	unsigned int i;
+	int n = 0;
+
+	for(i=0;i<sizeof(passthrough_syscalls64)/sizeof(passthrough_syscalls64[0]);i++) {
+		int s = passthrough_syscalls64[i];
+		if(n>=max) break;
+		if(controller_syscall_mask(s)) continue;
+		syscalls[n++] = s;
+		untraced_syscalls64[s] = 1;
+	}
+
+	return n;
+}
+
+/*
+A filter cannot be taken back once the program runs, so a gremlin
+armed later never sees the syscalls the filter lets through.
+*/
+
+static void check_untraced_gremlins()
+{
+	int s;
+
+	for(s=0;s<SYSCALL64_MAX;s++) {
+		if(untraced_syscalls64[s] && controller_syscall_mask(s)) {
+			debug(D_NOTICE,"warning: gremlins cannot fire on %s and other syscalls that seccomp lets run untraced",tracer_syscall64_name(s));
+			return;
+		}
+	}
+}
+
 static void decode_syscall( struct pfs_process *p, INT64_T entering )
 {
 	INT64_T *args;
@@ -1082,9 +1677,19 @@ static void decode_syscall( struct pfs_process *p, INT64_T entering )
 	struct sockaddr_un *paddr;
 	struct sockaddr_un addr;
 
+	// back from a sleepy gremlin: this syscall was already
+	// counted and its delay is over, so pick up where we left off
+	bool delayed = false;
+
 	if(entering) {
+		delayed = (p->state==PFS_PROCESS_STATE_WAITSLEEP);
 		p->state = PFS_PROCESS_STATE_KERNEL;
+	}
+
+	if(entering && !delayed) {
 		p->syscall_dummy = 0;
+		p->native_io = 0;
+		decoded_clear(p);
 		tracer_args_get(p->tracer,&p->syscall,p->syscall_args);
 		debug(D_SYSCALL,"%s",tracer_syscall_name(p->tracer,p->syscall));
 		p->syscall_original = p->syscall;
@@ -1103,24 +1708,42 @@ static void decode_syscall( struct pfs_process *p, INT64_T entering )
 	context.pid = p->pid;
 	context.childnum = p->childnum;
 	context.ioctl_meta = p->ioctl_meta;
+	context.gremlins = p->gremlins;
 	context.syscall_number = p->syscall;
 	context.syscall_name = tracer_syscall_name(p->tracer,p->syscall);
+	controller_advance(pfs_syscall_count,entering);
+	context.armed = controller_syscall_mask(p->syscall);
 
 	args = p->syscall_args;
 
-	// sleepy gremlin
-	if (entering) {
-		if (controller_doevil("sleepy1", &context, NULL)) {
-			sleep(1); // one second
+	// sleepy gremlin: park just this process on a poll timer,
+	// rather than stalling the tracer and everyone else with it
+	if (entering && !delayed && context.armed) {
+		struct timeval delay;
+		delay.tv_sec = 0;
+		delay.tv_usec = 0;
+		if (GREMLIN_ARMED(&context,GREMLIN_SLEEPY1) &&
+				controller_doevil(GREMLIN_SLEEPY1, &context, NULL)) {
+			delay.tv_sec = 1; // one second
 		} else 
-		if (controller_doevil("sleepy10th", &context, NULL)) {
-			usleep(100000); // one tenth of a second
+		if (GREMLIN_ARMED(&context,GREMLIN_SLEEPY10TH) &&
+				controller_doevil(GREMLIN_SLEEPY10TH, &context, NULL)) {
+			delay.tv_usec = 100000; // one tenth of a second
 		} else 
-		if (controller_doevil("sleepy100th", &context, NULL)) {
-			usleep(10000); // one hundredth of a second
+		if (GREMLIN_ARMED(&context,GREMLIN_SLEEPY100TH) &&
+				controller_doevil(GREMLIN_SLEEPY100TH, &context, NULL)) {
+			delay.tv_usec = 10000; // one hundredth of a second
 		} else 
-		if (controller_doevil("sleepy1000th", &context, NULL)) {
-			usleep(1000); // one thousandth of a second
+		if (GREMLIN_ARMED(&context,GREMLIN_SLEEPY1000TH) &&
+				controller_doevil(GREMLIN_SLEEPY1000TH, &context, NULL)) {
+			delay.tv_usec = 1000; // one thousandth of a second
+		}
+		if (delay.tv_sec || delay.tv_usec) {
+			debug(D_MURPHY, "Murphy: pid %d sleeping %d.%06d before %s\n",
+				p->pid, (int)delay.tv_sec, (int)delay.tv_usec, context.syscall_name);
+			p->state = PFS_PROCESS_STATE_WAITSLEEP;
+			pfs_poll_wakein(delay);
+			return;
 		}
 	} 
 
@@ -1151,6 +1774,7 @@ static void decode_syscall( struct pfs_process *p, INT64_T entering )
 					int r = controller_setconfig(config_line);
 					if (r) {
 						debug(D_MURPHY, "Murphy: added to config for pid %i: %s\n", p->pid, config_line);
+						check_untraced_gremlins();
 					} else {
 						debug(D_MURPHY, "Murphy: failed to add config for pid %i: %s\n", p->pid, config_line);
 					}
@@ -1170,239 +1794,55 @@ static void decode_syscall( struct pfs_process *p, INT64_T entering )
 			}
 		}
 
-		// check enospc gremlin
-		if (!handled)
-		switch(p->syscall) {
-			case SYSCALL64_inotify_add_watch:
-			case SYSCALL64_mknod:
-			case SYSCALL64_open:
-			case SYSCALL64_sync_file_range:
-			case SYSCALL64_symlink:
-//			case SYSCALL64_spu_create:
-			case SYSCALL64_fsetxattr:
-			case SYSCALL64_semop:
-			case SYSCALL64_lsetxattr:
-			case SYSCALL64_write:
-			case SYSCALL64_mkdir:
-			case SYSCALL64_shmget:
-			case SYSCALL64_query_module:
-			case SYSCALL64_shmctl:
-			case SYSCALL64_setxattr:
-			case SYSCALL64_msgget:
-			case SYSCALL64_rename:
-			case SYSCALL64_semget:
-			case SYSCALL64_link:
-
-				MyString ad_text;
-				if((p->syscall == SYSCALL64_open)) {
-					tracer_copy_in_string(p->tracer,path,POINTER(args[0]),sizeof(path));
-
-					// path may be relative.  turn it into a full path
-					char abs_path[PFS_PATH_MAX];
-					p->table->complete_at_path(AT_FDCWD, path, abs_path);
-
-					// and resolve symlinks and . and .. references
-					char real_path[PATH_MAX];
-					realpath(abs_path, real_path);
-
-					MyString tmp = real_path;
-					ad_text += "[ Name = \"";
-					ad_text += tmp.EscapeChars("\"\\", '\\');
-					ad_text += "\"; ";
-
-					// useful to know if the file is for reading only
-					ad_text += " O_CREAT=";
-					if(args[1] & O_CREAT) {
-						ad_text += "true";
-					} else {
-						ad_text += "false";
-					}
-
-					ad_text += "; ]";
-				} else
-				if((p->syscall == SYSCALL64_mknod) ||
-						(p->syscall == SYSCALL64_mkdir)) {
-					tracer_copy_in_string(p->tracer,path,POINTER(args[0]),sizeof(path));
-
-					// path may be relative.  turn it into a full path
-					char full_path[PFS_PATH_MAX];
-					p->table->complete_at_path(AT_FDCWD, path, full_path);
-
-					MyString tmp = full_path;
-					ad_text += "[ Name = \"";
-					ad_text += tmp.EscapeChars("\"\\", '\\');
-					ad_text += "\" ]";
-				} else
-				if((p->syscall == SYSCALL64_link) ||
-						(p->syscall == SYSCALL64_symlink) ||
-						(p->syscall == SYSCALL64_rename)) {
-					tracer_copy_in_string(p->tracer,path,POINTER(args[1]),sizeof(path));
-
-					// path may be relative.  turn it into a full path
-					char full_path[PFS_PATH_MAX];
-					p->table->complete_at_path(AT_FDCWD, path, full_path);
-
-					MyString tmp = full_path;
-					ad_text += "[ Name = \"";
-					ad_text += tmp.EscapeChars("\"\\", '\\');
-					ad_text += "\" ]";
-				} else
-				if(p->syscall == SYSCALL64_write) {
-					MyString tmp;
-
-					ad_text += "[ ";
-
-					INT64_T fd = args[0];
-					ad_text += "FD = ";
-					ad_text += (long)fd;
-					ad_text += "; ";
-
-					// look up the actual file name in our hash table
-					tmp = "DEADBEEF";
-					p->filenames->lookup(fd, tmp);
-					ad_text += "Name = ";
-					ad_text += "\"";
-					ad_text += tmp.EscapeChars("\"\\", '\\');
-					ad_text += "\"";
-					ad_text += "; ";
-
-					ad_text += "Offset = ";
-					ad_text += (int)p->table->get_fd_offset(fd);
-					ad_text += "; ";
-
-					ad_text += "]";
-				}
-
-				if (controller_doevil("enospc", &context, ad_text.Value())) {
-					handled = true;
-					divert_to_dummy(p,-ENOSPC);
-					break;
-				}
+		// check enospc gremlin; the controller knows which
+		// syscalls each gremlin applies to
+		if (!handled && GREMLIN_ARMED(&context,GREMLIN_ENOSPC)) {
+			struct controller_syscall_t sc;
+			controller_syscall_init(&sc,resolve_gremlin_attr,p);
+			if(p->syscall == SYSCALL64_open) {
+				controller_syscall_defer(&sc,GREMLIN_ATTR_NAME);
+				// useful to know if the file is for reading only
+				sc.o_creat = (args[1] & O_CREAT) ? true : false;
+				controller_syscall_provide(&sc,GREMLIN_ATTR_O_CREAT);
+			} else
+			if((p->syscall == SYSCALL64_mknod) ||
+					(p->syscall == SYSCALL64_mkdir) ||
+					(p->syscall == SYSCALL64_link) ||
+					(p->syscall == SYSCALL64_symlink) ||
+					(p->syscall == SYSCALL64_rename)) {
+				controller_syscall_defer(&sc,GREMLIN_ATTR_NAME);
+			} else
+			if(p->syscall == SYSCALL64_write) {
+				gremlin_fd_context(p,&sc,args[0]);
+				controller_syscall_defer(&sc,GREMLIN_ATTR_OFFSET);
+			}
+
+			if (controller_doevil(GREMLIN_ENOSPC, &context, &sc)) {
+				handled = true;
+				divert_to_dummy(p,-ENOSPC);
+			}
 		}
 
 		// check eintr gremlin
-		if (!handled)
-		switch(p->syscall) {
-			case SYSCALL64_close:
-			case SYSCALL64_request_key:
-//			case SYSCALL64_recv:
-//			case SYSCALL64_sigsuspend:
-			case SYSCALL64_stat:
-			case SYSCALL64_futex:
-			case SYSCALL64_poll:
-			case SYSCALL64_chown:
-			case SYSCALL64_rt_sigsuspend:
-			case SYSCALL64_wait4:
-			case SYSCALL64_init_module:
-			case SYSCALL64_delete_module:
-			case SYSCALL64_mknod:
-			case SYSCALL64_unlink:
-			case SYSCALL64_statfs:
-			case SYSCALL64_select:
-			case SYSCALL64_epoll_wait:
-			case SYSCALL64_read:
-//			case SYSCALL64_close:
-//			case SYSCALL64_send:
-			case SYSCALL64_semop:
-			case SYSCALL64_utime:
-			case SYSCALL64_write:
-			case SYSCALL64_rt_sigtimedwait:
-			case SYSCALL64_execve:
-			case SYSCALL64_pause:
-			case SYSCALL64_truncate:
-			case SYSCALL64_flock:
-			case SYSCALL64_fcntl:
-//			case SYSCALL64_statvfs:
-//			case SYSCALL64_wait:
-//			case SYSCALL64_spu_run:
-//			case SYSCALL64_sigwaitinfo:
-			case SYSCALL64_connect:
-			case SYSCALL64_nanosleep:
-			case SYSCALL64_dup:
-//			case SYSCALL64_msgop:
-//			case SYSCALL64_sigaction:
-			case SYSCALL64_chroot:
-			case SYSCALL64_ustat:
-			case SYSCALL64_accept:
-//			case SYSCALL64_select_tut:
-				if (controller_doevil("eintr", &context, NULL)) {
-					handled = true;
-					divert_to_dummy(p,-EINTR);
-					break;
-				}
+		if (!handled && GREMLIN_ARMED(&context,GREMLIN_EINTR)) {
+			if (controller_doevil(GREMLIN_EINTR, &context, NULL)) {
+				handled = true;
+				divert_to_dummy(p,-EINTR);
+			}
 		}
 
 		// check eagain gremlin
-		if (!handled)
-		switch(p->syscall) {
-			case SYSCALL64_madvise:
-			case SYSCALL64_getrlimit:
-//			case SYSCALL64_recv:
-			case SYSCALL64_mprotect:
-			case SYSCALL64_futex:
-//			case SYSCALL64_madvise:
-			case SYSCALL64_setuid:
-			case SYSCALL64_sendfile:
-//			case SYSCALL64_sigqueue:
-			case SYSCALL64_read:
-			case SYSCALL64_setresuid:
-			case SYSCALL64_mlock:
-//			case SYSCALL64_send:
-			case SYSCALL64_semop:
-			case SYSCALL64_io_submit:
-			case SYSCALL64_write:
-			case SYSCALL64_io_cancel:
-			case SYSCALL64_clone:
-			case SYSCALL64_tee:
-			case SYSCALL64_rt_sigtimedwait:
-			case SYSCALL64_execve:
-			case SYSCALL64_fork:
-			case SYSCALL64_truncate:
-//			case SYSCALL64_spufs:
-			case SYSCALL64_fcntl:
-			case SYSCALL64_mmap:
-//			case SYSCALL64_spu_run:
-//			case SYSCALL64_sigwaitinfo:
-			case SYSCALL64_mount:
-			case SYSCALL64_timer_create:
-//			case SYSCALL64_getrlimit:
-//			case SYSCALL64_msgop:
-			case SYSCALL64_mremap:
-			case SYSCALL64_mincore:
-			case SYSCALL64_vmsplice:
-			case SYSCALL64_accept:
-			case SYSCALL64_io_setup:
-//			case SYSCALL64_select_tut:
-			case SYSCALL64_semget:
-
-				MyString ad_text;
-				if((p->syscall == SYSCALL64_read) || (p->syscall == SYSCALL64_write)) {
-					MyString tmp;
-
-					ad_text += "[ ";
-
-					INT64_T fd = args[0];
-					ad_text += "FD = ";
-					ad_text += (long)fd;
-					ad_text += "; ";
-
-					// look up the actual file name in our hash table
-					tmp = "DEADBEEF";
-					p->filenames->lookup(fd, tmp);
-					ad_text += "Name = ";
-					ad_text += "\"";
-					ad_text += tmp.EscapeChars("\"\\", '\\');
-					ad_text += "\"";
-					ad_text += "; ";
-
-					ad_text += "]";
-				}
+		if (!handled && GREMLIN_ARMED(&context,GREMLIN_EAGAIN)) {
+			struct controller_syscall_t sc;
+			controller_syscall_init(&sc,resolve_gremlin_attr,p);
+			if((p->syscall == SYSCALL64_read) || (p->syscall == SYSCALL64_write)) {
+				gremlin_fd_context(p,&sc,args[0]);
+			}
 
-				if (controller_doevil("eagain", &context, ad_text.Value())) {
-					handled = true;
-					divert_to_dummy(p,-EAGAIN);
-					break;
-				}
+			if (controller_doevil(GREMLIN_EAGAIN, &context, &sc)) {
+				handled = true;
+				divert_to_dummy(p,-EAGAIN);
+			}
 		}
 	}
 
@@ -1419,6 +1859,11 @@ static void decode_syscall( struct pfs_process *p, INT64_T entering )
 		so that we can determine the child pid before seeing
 		any events from the child. On return, we must fill
 		in the child process with its parent's ppid.
+
+		When tracking forks natively, the kernel attaches the
+		child for us, so CLONE_PTRACE is not needed, and any
+		early events from the child are held by pfs_main until
+		we get here.  CLONE_UNTRACED would escape the tracer.
 		*/
 
 		case SYSCALL64_fork:
@@ -1426,23 +1871,29 @@ static void decode_syscall( struct pfs_process *p, INT64_T entering )
 			if(entering) {
 				INT64_T newargs[4];
 				INT64_T newargs_count;
+				INT64_T ptrace_flags = pfs_trace_forks ? 0 : CLONE_PTRACE;
 				if(p->syscall==SYSCALL64_fork || p->syscall==SYSCALL64_vfork) {
-					newargs[0] = CLONE_PTRACE|CLONE_PARENT|SIGCHLD;
+					newargs[0] = ptrace_flags|CLONE_PARENT|SIGCHLD;
 					newargs[1] = 0;
 					newargs_count = 2;
 					p->syscall_args_changed = 1;
 					debug(D_SYSCALL,"converting fork into clone(%x)",newargs[0]);
 				} else {
-					newargs[0] = (args[0]&~0xff)|CLONE_PTRACE|CLONE_PARENT|SIGCHLD;
+					newargs[0] = (args[0]&~(0xff|CLONE_UNTRACED))|ptrace_flags|CLONE_PARENT|SIGCHLD;
 					newargs_count = 1;
 					debug(D_SYSCALL,"adjusting clone(%x,%x,%x,%x) -> clone(%x)",args[0],args[1],args[2],args[3],newargs[0]);
 				}
 				tracer_args_set(p->tracer,SYSCALL64_clone,newargs,newargs_count);
-				trace_this_pid = p->pid;
+				if(pfs_trace_forks) {
+					p->forking = 1;
+				} else {
+					trace_this_pid = p->pid;
+				}
 			} else {
 				INT64_T childpid;
 				struct pfs_process *child;
 				tracer_result_get(p->tracer,&childpid);
+				p->forking = 0;
 				if(childpid>0) {
 					INT64_T child_signal,clone_files;
 					if(p->syscall_original==SYSCALL64_fork) {
@@ -1465,15 +1916,20 @@ static void decode_syscall( struct pfs_process *p, INT64_T entering )
 						memcpy(child->syscall_args,p->syscall_args,sizeof(p->syscall_args));
 						child->syscall_args_changed = 1;
 					}
-					if(pfs_trap_after_fork) {
+					if(pfs_trap_after_fork && !pfs_trace_forks) {
 						child->state = PFS_PROCESS_STATE_KERNEL;
 					} else {
 						child->state = PFS_PROCESS_STATE_USER;
 					}
 					debug(D_PROCESS,"%d created pid %d",p->pid,childpid);
-					/* now trace any process at all */
-					trace_this_pid = -1;
+					if(pfs_trace_forks) {
+						handle_pending_event(childpid);
+					} else {
+						/* now trace any process at all */
+						trace_this_pid = -1;
+					}
 				}
+				if(pfs_trace_forks) discard_pending_events();
 
 			}
 			break;
@@ -1528,7 +1984,7 @@ static void decode_syscall( struct pfs_process *p, INT64_T entering )
 		case SYSCALL64_open:
 		case SYSCALL64_creat:
 			if(entering) {
-				tracer_copy_in_string(p->tracer,path,POINTER(args[0]),sizeof(path));
+				const char *path = decoded_path(p,0);
 
 				if(p->syscall==SYSCALL64_creat) {
 					p->syscall_result = pfs_open(path,O_CREAT|O_WRONLY|O_TRUNC,args[1]);
@@ -1540,19 +1996,20 @@ static void decode_syscall( struct pfs_process *p, INT64_T entering )
 
 				if(p->syscall_result >= 0) {
 					// record pathname in filename table process.
-
-					// path may be relative.  turn it into a full path
-					char abs_path[PFS_PATH_MAX];
-					p->table->complete_at_path(AT_FDCWD, path, abs_path);
-
-					// and resolve symlinks and . and .. references
-					char real_path[PATH_MAX];
-					realpath(abs_path, real_path);
+					const char *real_path = decoded_real_path(p,0);
 
 					int fd = p->syscall_result;
 					debug(D_MURPHY, "ZKM: recording open, fd: %i, path %s, full_path: %s\n", fd, path, real_path);
-					p->filenames->insert(fd, real_path);
+					p->filenames = p->filenames->insert(fd, real_path);
+
+					if(p->syscall==SYSCALL64_creat) {
+						divert_to_native_open(p,fd,O_CREAT|O_WRONLY|O_TRUNC,args[0],path);
+					} else {
+						divert_to_native_open(p,fd,args[1],args[0],path);
+					}
 				}
+			} else if(p->native_io) {
+				native_open_complete(p);
 			}
 			break;
 
@@ -1579,32 +2036,17 @@ static void decode_syscall( struct pfs_process *p, INT64_T entering )
 
 		case SYSCALL64_close:
 			if(entering) {
-				MyString ad_text;
-				MyString tmp;
+				struct controller_syscall_t sc;
+				gremlin_fd_context(p,&sc,args[0]);
 
-				ad_text += "[ ";
-
-				INT64_T fd = args[0];
-				ad_text += "FD = ";
-				ad_text += (long)fd;
-				ad_text += "; ";
-
-				// look up the actual file name in our hash table
-				tmp = "DEADBEEF";
-				p->filenames->lookup(fd, tmp);
-				ad_text += "Name = ";
-				ad_text += "\"";
-				ad_text += tmp.EscapeChars("\"\\", '\\');
-				ad_text += "\"";
-				ad_text += "; ";
-
-				ad_text += "]";
-
-				if(controller_doevil("closefail", &context, ad_text.Value())) {
+				if(GREMLIN_ARMED(&context,GREMLIN_CLOSEFAIL) &&
+						controller_doevil(GREMLIN_CLOSEFAIL, &context, &sc)) {
 					divert_to_dummy(p,-EIO);
 					break;
 				}
 
+				native_close_later(p,p->table->get_native_fd(args[0]));
+				p->filenames = p->filenames->remove(args[0]);
 				p->syscall_result = pfs_close(args[0]);
 				if(p->syscall_result<0) p->syscall_result = -errno;
 				divert_to_dummy(p,p->syscall_result);
@@ -1622,11 +2064,13 @@ static void decode_syscall( struct pfs_process *p, INT64_T entering )
 			break;
 
 		case SYSCALL64_readv:
-			decode_readv(p,entering,p->syscall,args);
+		case SYSCALL64_preadv:
+			decode_readv(p,entering,p->syscall,args,&context);
 			break;
 
 		case SYSCALL64_writev:
-			decode_writev(p,entering,p->syscall,args);
+		case SYSCALL64_pwritev:
+			decode_writev(p,entering,p->syscall,args,&context);
 			break;
 
 		case SYSCALL64_socket:
@@ -2122,6 +2566,16 @@ static void decode_syscall( struct pfs_process *p, INT64_T entering )
 				struct flock fl;
 
 				switch(cmd) {
+					case F_DUPFD_CLOEXEC:
+						p->syscall_result = pfs_fcntl(fd,F_DUPFD,uaddr);
+						if(p->syscall_result<0) {
+							p->syscall_result = -errno;
+						} else {
+							pfs_fcntl(p->syscall_result,F_SETFD,(void*)FD_CLOEXEC);
+						}
+						divert_to_dummy(p,p->syscall_result);
+						break;
+
 					case F_DUPFD:
 					case F_GETFD:
 					case F_SETFD:
@@ -2214,46 +2668,30 @@ static void decode_syscall( struct pfs_process *p, INT64_T entering )
 				nlongs = (maxfd+31)/32;
 				nbytes = nlongs*4;
 
+				struct iovec local[4], remote[4];
+				int nvec = 0;
+
 				FD_ZERO(&rset);
 				FD_ZERO(&wset);
 				FD_ZERO(&eset);
 
-				if(args[1]) {
-					tracer_copy_in(p->tracer,&rset,POINTER(args[1]),nbytes);
-					prset = &rset;
-				} else {
-					prset = 0;
-				}
-
-				if(args[2]) {
-					tracer_copy_in(p->tracer,&wset,POINTER(args[2]),nbytes);
-					pwset = &wset;
-				} else {
-					pwset = 0;
-				}
-
-				if(args[3]) {
-					tracer_copy_in(p->tracer,&eset,POINTER(args[3]),nbytes);
-					peset = &eset;
-				} else {
-					peset = 0;
-				}
+				// the sets and the timeout all come over in one copy
+				iovec_add(local,remote,&nvec,&rset,args[1],nbytes);
+				iovec_add(local,remote,&nvec,&wset,args[2],nbytes);
+				iovec_add(local,remote,&nvec,&eset,args[3],nbytes);
+				iovec_add(local,remote,&nvec,&tv,args[4],sizeof(tv));
+				tracer_copy_in_vector(p->tracer,local,remote,nvec);
 
-				if(args[4]) {
-					tracer_copy_in(p->tracer,&tv,POINTER(args[4]),sizeof(tv));
-					ptv = &tv;
-				} else {
-					ptv = 0;
-				}
+				prset = args[1] ? &rset : 0;
+				pwset = args[2] ? &wset : 0;
+				peset = args[3] ? &eset : 0;
+				ptv = args[4] ? &tv : 0;
 
 				p->syscall_result = pfs_select(maxfd,prset,pwset,peset,ptv);
 
 				if(p->syscall_result>=0) {
 					divert_to_dummy(p,p->syscall_result);
-					if(prset) tracer_copy_out(p->tracer,prset,POINTER(args[1]),nbytes);
-					if(pwset) tracer_copy_out(p->tracer,pwset,POINTER(args[2]),nbytes);
-					if(peset) tracer_copy_out(p->tracer,peset,POINTER(args[3]),nbytes);
-					if(ptv) tracer_copy_out(p->tracer,ptv,POINTER(args[4]),sizeof(*ptv));
+					tracer_copy_out_vector(p->tracer,local,remote,nvec);
 				} else if(errno==EAGAIN) {
 					if(p->interrupted) {
 						p->interrupted = 0;
@@ -2266,7 +2704,8 @@ static void decode_syscall( struct pfs_process *p, INT64_T entering )
 				}
 			} else {
 				if (p->syscall_result < 0) {
-					if (controller_doevil("selectfdset", &context, NULL)) {
+					if (GREMLIN_ARMED(&context,GREMLIN_SELECTFDSET) &&
+							controller_doevil(GREMLIN_SELECTFDSET, &context, NULL)) {
 						// scramble the FD sets
 						INT64_T maxfd = args[0];
 						fd_set rset, wset, eset;
@@ -2277,9 +2716,13 @@ static void decode_syscall( struct pfs_process *p, INT64_T entering )
 						nlongs = (maxfd+31)/32;
 						nbytes = nlongs*4;
 
-						tracer_copy_in(p->tracer,&rset,POINTER(args[1]),nbytes);
-						tracer_copy_in(p->tracer,&wset,POINTER(args[2]),nbytes);
-						tracer_copy_in(p->tracer,&eset,POINTER(args[3]),nbytes);
+						struct iovec local[3], remote[3];
+						int nvec = 0;
+
+						iovec_add(local,remote,&nvec,&rset,args[1],nbytes);
+						iovec_add(local,remote,&nvec,&wset,args[2],nbytes);
+						iovec_add(local,remote,&nvec,&eset,args[3],nbytes);
+						tracer_copy_in_vector(p->tracer,local,remote,nvec);
 						for (int i = 0; i < nbytes; i++) {
 							tp = (unsigned char*) &rset;
 							tp[i] ^= 0xFF;
@@ -2288,9 +2731,7 @@ static void decode_syscall( struct pfs_process *p, INT64_T entering )
 							tp = (unsigned char*) &eset;
 							tp[i] ^= 0xFF;
 						}
-						tracer_copy_out(p->tracer,&rset,POINTER(args[1]),nbytes);
-						tracer_copy_out(p->tracer,&wset,POINTER(args[2]),nbytes);
-						tracer_copy_out(p->tracer,&eset,POINTER(args[3]),nbytes);
+						tracer_copy_out_vector(p->tracer,local,remote,nvec);
 					}
 				}
 			}
@@ -2357,22 +2798,15 @@ static void decode_syscall( struct pfs_process *p, INT64_T entering )
 			// TODO: move variables into the process object.
 
 			if(entering) {
-				MyString ad_text;
-				MyString tmp;
-
-				ad_text += "[ ";
+				struct controller_syscall_t sc;
+				controller_syscall_init(&sc,resolve_gremlin_attr,p);
+				sc.pathset = p->cwdlongpath_set;
+				sc.pathlen = p->cwdlongpath_len;
+				controller_syscall_provide(&sc,GREMLIN_ATTR_PATHSET);
+				controller_syscall_provide(&sc,GREMLIN_ATTR_PATHLEN);
 
-				ad_text += "PathSet = ";
-				ad_text += p->cwdlongpath_set;
-				ad_text += "; ";
-
-				ad_text += "PathLen = ";
-				ad_text += p->cwdlongpath_len;
-				ad_text += "; ";
-
-				ad_text += "]";
-
-				if (controller_doevil("cwdlongpath", &context, ad_text.Value())) {
+				if (GREMLIN_ARMED(&context,GREMLIN_CWDLONGPATH) &&
+						controller_doevil(GREMLIN_CWDLONGPATH, &context, &sc)) {
 					if (p->cwdlongpath_set) {
 						// check the length (we increased it by one)
 						if (p->cwdlongpath_len <= args[1]) {
@@ -2429,13 +2863,61 @@ static void decode_syscall( struct pfs_process *p, INT64_T entering )
 			break;
 
 		case SYSCALL64_dup2:
+		case SYSCALL64_dup3:
 			if(entering) {
+				int nfd = p->table->get_native_fd(args[1]);
+				if(p->syscall==SYSCALL64_dup3 && (args[0]==args[1] || (args[2]&~O_CLOEXEC))) {
+					divert_to_dummy(p,-EINVAL);
+					break;
+				}
 				p->syscall_result = pfs_dup2(args[0],args[1]);
-				if(p->syscall_result<0) p->syscall_result = -errno;
+				if(p->syscall_result<0) {
+					p->syscall_result = -errno;
+				} else if(p->syscall==SYSCALL64_dup3 && (args[2]&O_CLOEXEC)) {
+					pfs_fcntl(args[1],F_SETFD,(void*)FD_CLOEXEC);
+				}
+				if(p->syscall_result>=0 && args[0]!=args[1]) p->filenames = p->filenames->remove(args[1]);
+				if(nfd>=0 && p->table->get_native_fd(args[1])<0) native_close_later(p,nfd);
 				divert_to_dummy(p,p->syscall_result);
 			}
 			break;
 
+		/*
+		close_range closes, or marks close-on-exec, every open fd
+		between its first two arguments.  Only the open ones are
+		visited, since the range is commonly everything above some
+		fd.  Unsharing the table is not needed, since we keep the
+		table ourselves.
+		*/
+
+		case SYSCALL64_close_range:
+			if(entering) {
+				unsigned int first = args[0];
+				unsigned int last = args[1];
+				int fd;
+
+				if(first>last || (args[2]&~(CLOSE_RANGE_UNSHARE|CLOSE_RANGE_CLOEXEC))) {
+					divert_to_dummy(p,-EINVAL);
+					break;
+				}
+				if(first>INT_MAX) {
+					divert_to_dummy(p,0);
+					break;
+				}
+
+				for(fd=p->table->next_open(first);fd>=0 && (unsigned int)fd<=last;fd=p->table->next_open(fd+1)) {
+					if(args[2]&CLOSE_RANGE_CLOEXEC) {
+						pfs_fcntl(fd,F_SETFD,(void*)FD_CLOEXEC);
+					} else {
+						native_close_later(p,p->table->get_native_fd(fd));
+						p->filenames = p->filenames->remove(fd);
+						pfs_close(fd);
+					}
+				}
+				divert_to_dummy(p,0);
+			}
+			break;
+
 		/*
 		Next we have all of the system calls that work on
 		a file name, rather than an open file.  In most cases,
@@ -2510,9 +2992,7 @@ static void decode_syscall( struct pfs_process *p, INT64_T entering )
 
 		case SYSCALL64_rename:
 			if(entering) {
-				tracer_copy_in_string(p->tracer,path,POINTER(args[0]),sizeof(path));
-				tracer_copy_in_string(p->tracer,path2,POINTER(args[1]),sizeof(path2));
-				p->syscall_result = pfs_rename(path,path2);
+				p->syscall_result = pfs_rename(decoded_path(p,0),decoded_path(p,1));
 				if(p->syscall_result<0) p->syscall_result = -errno;
 				divert_to_dummy(p,p->syscall_result);
 			}
@@ -2520,9 +3000,7 @@ static void decode_syscall( struct pfs_process *p, INT64_T entering )
 
 		case SYSCALL64_link:
 			if(entering) {
-				tracer_copy_in_string(p->tracer,path,POINTER(args[0]),sizeof(path));
-				tracer_copy_in_string(p->tracer,path2,POINTER(args[1]),sizeof(path2));
-				p->syscall_result = pfs_link(path,path2);
+				p->syscall_result = pfs_link(decoded_path(p,0),decoded_path(p,1));
 				if(p->syscall_result<0) p->syscall_result = -errno;
 				divert_to_dummy(p,p->syscall_result);
 			}
@@ -2530,9 +3008,7 @@ static void decode_syscall( struct pfs_process *p, INT64_T entering )
 
 		case SYSCALL64_symlink:
 			if(entering) {
-				tracer_copy_in_string(p->tracer,path,POINTER(args[0]),sizeof(path));
-				tracer_copy_in_string(p->tracer,path2,POINTER(args[1]),sizeof(path2));
-				p->syscall_result = pfs_symlink(path,path2);
+				p->syscall_result = pfs_symlink(decoded_path(p,0),decoded_path(p,1));
 				if(p->syscall_result<0) p->syscall_result = -errno;
 				divert_to_dummy(p,p->syscall_result);
 			}
@@ -2553,8 +3029,7 @@ static void decode_syscall( struct pfs_process *p, INT64_T entering )
 
 		case SYSCALL64_mknod:
 			if(entering) {
-				tracer_copy_in_string(p->tracer,path,POINTER(args[0]),sizeof(path));
-				p->syscall_result = pfs_mknod(path,args[1],args[2]);
+				p->syscall_result = pfs_mknod(decoded_path(p,0),args[1],args[2]);
 				if(p->syscall_result<0) p->syscall_result = -errno;
 				divert_to_dummy(p,p->syscall_result);
 			}
@@ -2562,8 +3037,7 @@ static void decode_syscall( struct pfs_process *p, INT64_T entering )
 
 		case SYSCALL64_mkdir:
    			if(entering) {
-				tracer_copy_in_string(p->tracer,path,POINTER(args[0]),sizeof(path));
-				p->syscall_result = pfs_mkdir(path,args[1]);
+				p->syscall_result = pfs_mkdir(decoded_path(p,0),args[1]);
 				if(p->syscall_result<0) p->syscall_result = -errno;
 				divert_to_dummy(p,p->syscall_result);
 			}
@@ -2693,6 +3167,9 @@ static void decode_syscall( struct pfs_process *p, INT64_T entering )
 				p->syscall_result = pfs_openat(args[0],path,args[2],args[3]);
 				if(p->syscall_result<0) p->syscall_result = -errno;
 				divert_to_dummy(p,p->syscall_result);
+				if(p->syscall_result>=0) divert_to_native_open(p,p->syscall_result,args[2],args[1],path);
+			} else if(p->native_io) {
+				native_open_complete(p);
 			}
 			break;
 
@@ -3279,8 +3756,13 @@ static void decode_syscall( struct pfs_process *p, INT64_T entering )
 			break;
 	}
 
+	if(entering && p->syscall_dummy && !p->native_io && p->native_close_count>0) {
+		divert_to_native_close(p);
+	}
+
 	if(!entering && p->state==PFS_PROCESS_STATE_KERNEL) {
 		p->state = PFS_PROCESS_STATE_USER;
+		decoded_clear(p);
 		if(p->syscall_args_changed) {
 			tracer_args_set(p->tracer,p->syscall,p->syscall_args,TRACER_ARGS_MAX);
 			p->syscall_args_changed = 0;
@@ -3297,6 +3779,7 @@ static void decode_syscall( struct pfs_process *p, INT64_T entering )
 	// if bail_func is set and we are on our way out, the system call has
 	// completed and now is the time to make our exit
 	if(!entering && bail_func) {
+		tracer_flush(p->tracer);
 		bail_func(p->pid);
 	}
 }
@@ -3322,6 +3805,7 @@ void pfs_dispatch64( struct pfs_process *p, INT64_T signum )
 		case PFS_PROCESS_STATE_USER:
 			p->interrupted = 0;
 		case PFS_PROCESS_STATE_WAITREAD:
+		case PFS_PROCESS_STATE_WAITSLEEP:
 			decode_syscall(p,1);
 			break;
 		case PFS_PROCESS_STATE_WAITPID:
@@ -3341,6 +3825,7 @@ void pfs_dispatch64( struct pfs_process *p, INT64_T signum )
 		case PFS_PROCESS_STATE_WAITPID:
 		case PFS_PROCESS_STATE_WAITREAD:
 		case PFS_PROCESS_STATE_WAITWRITE:
+		case PFS_PROCESS_STATE_WAITSLEEP:
 		case PFS_PROCESS_STATE_DONE:
 			break;
 		default:
@@ -124,6 +124,17 @@ int pfs_file::get_local_name( char *n )
 	return -1;
 }
 
+/*
+The name under which a tracee may open this very file for itself,
+and see the same bytes that read and write would show it here.
+Only plain local files have one.
+*/
+
+int pfs_file::get_native_name( char *n )
+{
+	return -1;
+}
+
 pfs_off_t pfs_file::get_last_offset()
 {
 	return last_offset;
@@ -0,0 +1,156 @@
+/*
+Copyright (C) 2003-2004 Douglas Thain and the University of Wisconsin
+Copyright (C) 2005- The University of Notre Dame
+This software is distributed under the GNU General Public License.
+See the file COPYING for details.
+*/
+
+#include "pfs_filenames.h"
+#include "pfs_table.h"
+
+extern "C" {
+#include "hash_table.h"
+#include "xmalloc.h"
+}
+
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+
+struct pfs_filename {
+	int refs;
+	char name[1];
+};
+
+static struct hash_table *interned = 0;
+
+static struct pfs_filename * filename_intern( const char *name )
+{
+	struct pfs_filename *f;
+
+	if(!interned) interned = hash_table_create(0,0);
+
+	f = (struct pfs_filename *) hash_table_lookup(interned,name);
+	if(!f) {
+		f = (struct pfs_filename *) xxmalloc(sizeof(*f)+strlen(name));
+		f->refs = 0;
+		strcpy(f->name,name);
+		hash_table_insert(interned,name,f);
+	}
+
+	f->refs++;
+	return f;
+}
+
+static void filename_release( struct pfs_filename *f )
+{
+	if(--f->refs==0) {
+		hash_table_remove(interned,f->name);
+		free(f);
+	}
+}
+
+pfs_filenames::pfs_filenames()
+{
+	count = 0;
+	names = 0;
+}
+
+pfs_filenames::~pfs_filenames()
+{
+	for(int i=0;i<count;i++) {
+		if(names[i]) filename_release(names[i]);
+	}
+	free(names);
+}
+
+pfs_filenames * pfs_filenames::share()
+{
+	addref();
+	return this;
+}
+
+const char * pfs_filenames::lookup( int fd )
+{
+	if(fd<0 || fd>=count || !names[fd]) return 0;
+	return names[fd]->name;
+}
+
+/*
+Return a table that only the caller refers to,
+copying this one if it is shared.
+*/
+
+pfs_filenames * pfs_filenames::writable()
+{
+	pfs_filenames *t;
+
+	if(refs()==1) return this;
+
+	t = new pfs_filenames;
+	t->count = count;
+	t->names = (struct pfs_filename **) xxmalloc(sizeof(*names)*count);
+	for(int i=0;i<count;i++) {
+		t->names[i] = names[i];
+		if(names[i]) names[i]->refs++;
+	}
+
+	delref();
+	return t;
+}
+
+pfs_filenames * pfs_filenames::insert( int fd, const char *name )
+{
+	pfs_filenames *t;
+
+	if(fd<0) return this;
+
+	t = writable();
+
+	if(fd>=t->count) {
+		int n = t->count ? t->count : 16;
+		while(n<=fd) n *= 2;
+		struct pfs_filename **newnames = (struct pfs_filename **) xxmalloc(sizeof(*names)*n);
+		memcpy(newnames,t->names,sizeof(*names)*t->count);
+		memset(&newnames[t->count],0,sizeof(*names)*(n-t->count));
+		free(t->names);
+		t->names = newnames;
+		t->count = n;
+	}
+
+	if(t->names[fd]) filename_release(t->names[fd]);
+	t->names[fd] = filename_intern(name);
+
+	return t;
+}
+
+pfs_filenames * pfs_filenames::remove( int fd )
+{
+	pfs_filenames *t;
+
+	if(!lookup(fd)) return this;
+
+	t = writable();
+	filename_release(t->names[fd]);
+	t->names[fd] = 0;
+
+	return t;
+}
+
+/*
+Forget the names of the fds that exec is about to close,
+and of any that the table has closed already.
+*/
+
+pfs_filenames * pfs_filenames::close_on_exec( pfs_table *table )
+{
+	pfs_filenames *t = this;
+
+	for(int i=0;i<count;i++) {
+		if(!t->names[i]) continue;
+		int flags = table->fcntl(i,F_GETFD,0);
+		if(flags<0 || (flags&FD_CLOEXEC)) t = t->remove(i);
+	}
+
+	return t;
+}
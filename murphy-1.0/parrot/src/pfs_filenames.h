@@ -0,0 +1,45 @@
+/*
+Copyright (C) 2003-2004 Douglas Thain and the University of Wisconsin
+Copyright (C) 2005- The University of Notre Dame
+This software is distributed under the GNU General Public License.
+See the file COPYING for details.
+*/
+
+#ifndef PFS_FILENAMES_H
+#define PFS_FILENAMES_H
+
+#include "pfs_refcount.h"
+
+class pfs_table;
+struct pfs_filename;
+
+/*
+The canonical name of the file behind each fd of a process, for
+gremlin constraints that refer to Name.  Each distinct name is
+stored once, no matter how many tables refer to it.  A table is
+shared between a parent and its children after fork, and copied
+only when one of them changes it: each of the calls that change a
+table returns the table that the caller must use from then on.
+*/
+
+class pfs_filenames : public pfs_refcount {
+public:
+	pfs_filenames();
+	~pfs_filenames();
+
+	pfs_filenames * share();
+
+	const char * lookup( int fd );
+
+	pfs_filenames * insert( int fd, const char *name );
+	pfs_filenames * remove( int fd );
+	pfs_filenames * close_on_exec( pfs_table *table );
+
+private:
+	pfs_filenames * writable();
+
+	int    count;
+	struct pfs_filename **names;
+};
+
+#endif
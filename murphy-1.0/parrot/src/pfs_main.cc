@@ -12,6 +12,8 @@ See the file COPYING for details.
 #include "pfs_poll.h"
 #include "pfs_service.h"
 #include "pfs_critical.h"
+#include "pfs_pathcache.h"
+#include "pfs_dircache.h"
 
 extern "C" {
 #include "tracer.h"
@@ -30,6 +32,7 @@ extern "C" {
 #include "chirp_global.h"
 #include "chirp_ticket.h"
 #include "ftp_lite.h"
+#include "itable.h"
 }
 
 #include <stdlib.h>
@@ -50,6 +53,9 @@ char *gremlin_log_file = NULL;
 char *gremlin_replay_file = NULL;
 bool gremlin_replay_gdb = false;
 char *murphy_config_file = NULL;
+char *gremlin_schedule = NULL;
+char *gremlin_stats_file = NULL;
+bool gremlin_stats = false;
 
 pid_t trace_this_pid = -1;
 
@@ -63,6 +69,8 @@ int pfs_force_sync = 0;
 int pfs_follow_symlinks = 1;
 int pfs_session_cache = 0;
 int pfs_use_helper = 1;
+int pfs_use_seccomp = 0;
+int pfs_trace_forks = 0;
 int pfs_checksum_files = 1;
 int pfs_auto_gzip = 0;
 int pfs_write_rval = 0;
@@ -235,6 +243,10 @@ static void show_use( const char *cmd )
 	printf("  -g <file>  Send gremlin activation log to this file. \n");
 	printf("  -r <file>  Replay a gremlin activation log from this file. \n");
 	printf("  -a         Attach w/ gdb when replay of a gremlin activation log completes. \n");
+	printf("  -e <mode>  Gremlin firing schedule: rand (default) or skip. \n");
+	printf("  -x <file>  Write per-gremlin controller statistics to this file. \n");
+	printf("  -X         Stop only at syscalls that Murphy must see, using seccomp. \n");
+	printf("  -n         Let the kernel attach forked children, instead of rewriting forks. \n");
 	printf("  -d <name>  Enable debugging for this sub-system.  \n");
 	printf("  -H         Disable use of helper library.\n");
 	printf("  -h         Show this screen.\n");
@@ -285,6 +297,7 @@ and then kill ourselves.
 static void kill_everyone( int sig )
 {
 	debug(D_NOTICE,"received signal %d (%s), killing all my children...",sig,string_signal(sig));
+	controller_flush_log();
 	pfs_process_killall();
 	debug(D_NOTICE,"sending myself %d (%s), goodbye!",sig,string_signal(sig));
 	while(1) {
@@ -335,13 +348,76 @@ something interesting has happened to this pid. Decode
 the event and take the appropriate action.
 */
 
+/*
+When tracking forks natively, a new child may report to us before
+its parent has returned from fork and told us who it is.  Whatever
+it reports is held here until the dispatcher creates the child
+and calls handle_pending_event.  Only a pid that turns up while
+some fork is in flight can be such a child; once none is, whatever
+is left was never ours, and is killed as any other stray pid.
+*/
+
+struct pending_event {
+	int status;
+	struct rusage usage;
+};
+
+static struct itable *pending_events = 0;
+
+static void handle_event( pid_t pid, int status, struct rusage usage );
+
+void handle_pending_event( pid_t pid )
+{
+	struct pending_event *e;
+
+	if(!pending_events) return;
+	e = (struct pending_event *) itable_remove(pending_events,pid);
+	if(!e) return;
+
+	debug(D_PROCESS,"pid %d handling its early event",pid);
+	handle_event(pid,e->status,e->usage);
+	free(e);
+}
+
+void discard_pending_events()
+{
+	UINT64_T pid;
+	struct pending_event *e;
+
+	if(!pending_events || itable_size(pending_events)==0) return;
+	if(pfs_process_forking()) return;
+
+	itable_firstkey(pending_events);
+	while(itable_nextkey(pending_events,&pid,(void**)&e)) {
+		debug(D_PROCESS,"killing unexpected pid %d",(int)pid);
+		kill(pid,SIGKILL);
+		free(e);
+	}
+	itable_delete(pending_events);
+	pending_events = 0;
+}
+
 static void handle_event( pid_t pid, int status, struct rusage usage )
 {
 	struct pfs_process *p;
 	int signum;
+	int syscall_stop;
 
 	p = pfs_process_lookup(pid);
 	if(!p) {
+		if(pfs_trace_forks && pfs_process_forking()) {
+			struct pending_event *e;
+			if(!pending_events) pending_events = itable_create(0);
+			e = (struct pending_event *) itable_lookup(pending_events,pid);
+			if(!e) {
+				e = (struct pending_event *) xxmalloc(sizeof(*e));
+				itable_insert(pending_events,pid,e);
+			}
+			e->status = status;
+			e->usage = usage;
+			debug(D_PROCESS,"pid %d reported before its parent's fork returned",pid);
+			return;
+		}
 		debug(D_PROCESS,"killing unexpected pid %d",pid);
 		kill(pid,SIGKILL);
 		return;
@@ -358,7 +434,28 @@ static void handle_event( pid_t pid, int status, struct rusage usage )
 		if(pid==root_pid) root_exitstatus = status;
 	} else if(WIFSTOPPED(status)) {
 		signum = WSTOPSIG(status);
-		if(signum==SIGTRAP) {
+		if(pfs_trace_forks) {
+			switch(tracer_stop_type(status)) {
+				case TRACER_STOP_EVENT:
+					debug(D_PROCESS,"pid %d ptrace event %d",pid,status>>16);
+					tracer_resume(p->tracer);
+					return;
+				case TRACER_STOP_GROUP:
+					debug(D_PROCESS,"pid %d stopped by signal %d (%s)",pid,signum,string_signal(signum));
+					tracer_listen(p->tracer);
+					return;
+				case TRACER_STOP_SYSCALL:
+					syscall_stop = 1;
+					break;
+				default:
+					syscall_stop = 0;
+					break;
+			}
+		} else {
+			syscall_stop = (signum==SIGTRAP);
+		}
+		if(syscall_stop) {
+			tracer_seccomp_event(p->tracer,status);
 			p->nsyscalls++;
 			pfs_dispatch(p,0);
 		} else {
@@ -370,6 +467,9 @@ static void handle_event( pid_t pid, int status, struct rusage usage )
 				tcsetpgrp(1,pid);
 				tcsetpgrp(2,pid);
 				tracer_continue(p->tracer,SIGCONT);
+			} else if(signum==SIGSTOP && p->nsyscalls==0 && pfs_trace_forks) {
+				/* a seized process does not need its first stop delivered */
+				tracer_continue(p->tracer,0);
 			} else {
 				tracer_continue(p->tracer,signum);
 				if(signum==SIGSTOP && p->nsyscalls==0) {
@@ -543,11 +643,23 @@ int main( int argc, char *argv[] )
 
 	sprintf(pfs_temp_dir,"/tmp/parrot.%d",getuid());
 
-	while((c=getopt(argc,argv,"+hA:ab:B:c:Cd:DE:FfG:Hi:kKl:m:M:N:o:g:r:O:p:QR:sSt:T:U:u:vw:WYZ"))!=(char)-1) {
+	while((c=getopt(argc,argv,"+hA:ab:B:c:Cd:De:E:FfG:Hi:kKl:m:M:nN:o:g:r:O:p:QR:sSt:T:U:u:vw:Wx:XYZ"))!=(char)-1) {
 		switch(c) {
 		case 'g':
 			gremlin_log_file = optarg;
 			break;
+		case 'e':
+			gremlin_schedule = optarg;
+			break;
+		case 'x':
+			gremlin_stats_file = optarg;
+			break;
+		case 'X':
+			pfs_use_seccomp = 1;
+			break;
+		case 'n':
+			pfs_trace_forks = 1;
+			break;
 		case 'r':
 			gremlin_replay_file = optarg;
 			break;
@@ -655,6 +767,7 @@ int main( int argc, char *argv[] )
 		case 'W':
 			pfs_syscall_totals32 = (int*) calloc(SYSCALL32_MAX,sizeof(int));
 			pfs_syscall_totals64 = (int*) calloc(SYSCALL64_MAX,sizeof(int));
+			gremlin_stats = true;
 			break;
 		case 'Z':
 			pfs_auto_gzip = 1;
@@ -706,14 +819,71 @@ int main( int argc, char *argv[] )
 		::ioctl(0,TIOCNOTTY,0);
 	}
 
+	/*
+	In seccomp mode, the child installs a filter that lets the
+	syscalls we never touch run without stopping.  The list is
+	worked out here, since the child must not wait on us for it.
+	*/
+
+	int untraced[SYSCALL64_MAX];
+	int nuntraced = 0;
+
+	if(pfs_use_seccomp) {
+		if(tracer_seccomp_available()) {
+			nuntraced = pfs_dispatch64_untraced(untraced,SYSCALL64_MAX);
+			tracer_seccomp_enable();
+			debug(D_PROCESS,"seccomp filter lets %d syscalls run untraced",nuntraced);
+		} else {
+			debug(D_NOTICE,"seccomp filters are not available here, so every syscall will be traced");
+			pfs_use_seccomp = 0;
+		}
+	}
+
+	/*
+	When tracking forks natively, the child waits on a pipe until
+	we have seized it, and only then stops itself for us.
+	*/
+
+	int seize_pipe[2];
+
+	if(pfs_trace_forks) {
+		if(tracer_fork_available() && pipe(seize_pipe)==0) {
+			fcntl(seize_pipe[0],F_SETFD,FD_CLOEXEC);
+			fcntl(seize_pipe[1],F_SETFD,FD_CLOEXEC);
+			tracer_fork_enable();
+		} else {
+			debug(D_NOTICE,"ptrace fork tracking is not available here, so forks will be rewritten");
+			pfs_trace_forks = 0;
+		}
+	}
+
 	if(pid==0) {
 		pid = fork();
 		if(pid>0) {
 			debug(D_PROCESS,"pid %d started",pid);
+			if(pfs_trace_forks) {
+				if(!tracer_seize(pid)) {
+					kill(pid,SIGKILL);
+					fatal("unable to seize pid %d: %s",pid,strerror(errno));
+				}
+				close(seize_pipe[0]);
+				close(seize_pipe[1]);
+			}
 		} else if(pid==0) {
 			setpgrp();
-			tracer_prepare();
+			if(pfs_trace_forks) {
+				char c;
+				close(seize_pipe[1]);
+				while(read(seize_pipe[0],&c,1)<0 && errno==EINTR) {}
+				close(seize_pipe[0]);
+			} else {
+				tracer_prepare();
+			}
 			kill(getpid(),SIGSTOP);
+			if(pfs_use_seccomp && !tracer_seccomp_install(untraced,nuntraced)) {
+				debug(D_NOTICE,"unable to install seccomp filter: %s",strerror(errno));
+				_exit(1);
+			}
 			getpid();
 			// This call is necessary to force the kernel to report the current heap
 			// size, so that Parrot can observe it in order to rewrite the following exec.
@@ -768,6 +938,12 @@ int main( int argc, char *argv[] )
 		if(pfs_process_count()>0) pfs_poll_sleep();
 	}
 
+	controller_report();
+	tracer_report();
+	pfs_pathcache_report();
+	pfs_resolve_report();
+	pfs_dircache::report();
+
 	if(pfs_syscall_totals32) {
 		printf("\nParrot System Call Summary:\n");
 		printf("%lld syscalls\n",pfs_syscall_count);
@@ -791,6 +967,9 @@ int main( int argc, char *argv[] )
 		}
 
 		#endif
+
+		controller_print_stats(stdout);
+		pfs_pathcache_print_stats(stdout);
 	}
 
 	if(WIFEXITED(root_exitstatus)) {
@@ -0,0 +1,216 @@
+/*
+Copyright (C) 2003-2004 Douglas Thain and the University of Wisconsin
+Copyright (C) 2005- The University of Notre Dame
+This software is distributed under the GNU General Public License.
+See the file COPYING for details.
+*/
+
+#include "pfs_pathcache.h"
+
+extern "C" {
+#include "debug.h"
+#include "hash_table.h"
+#include "xmalloc.h"
+}
+
+#include <limits.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+
+#define PATHCACHE_MAX 4096
+
+/*
+Each cached path is also linked into a list of all the paths that
+resolve to the same target, so that a file can be forgotten under
+all of its names without looking at the rest of the cache.
+*/
+
+struct pathcache_entry {
+	char *path;
+	char *canonical;
+	struct pathcache_entry *next;
+};
+
+static struct hash_table *cache = 0;
+static struct hash_table *targets = 0;
+
+static long long cache_hits = 0;
+static long long cache_misses = 0;
+static long long cache_invalidations = 0;
+static long long cache_flushes = 0;
+
+static void pathcache_entry_delete( struct pathcache_entry *e )
+{
+	free(e->path);
+	free(e->canonical);
+	free(e);
+}
+
+void pfs_pathcache_flush()
+{
+	char *key;
+	void *value;
+
+	if(!cache || hash_table_size(cache)==0) return;
+
+	hash_table_firstkey(cache);
+	while(hash_table_nextkey(cache,&key,&value)) {
+		pathcache_entry_delete((struct pathcache_entry *)value);
+	}
+	hash_table_delete(cache);
+	hash_table_delete(targets);
+	cache = 0;
+	targets = 0;
+
+	cache_flushes++;
+}
+
+static void pathcache_insert( const char *path, const char *canonical )
+{
+	struct pathcache_entry *e;
+
+	if(cache && hash_table_size(cache)>=PATHCACHE_MAX) pfs_pathcache_flush();
+	if(!cache) {
+		cache = hash_table_create(0,0);
+		targets = hash_table_create(0,0);
+	}
+
+	e = (struct pathcache_entry *) xxmalloc(sizeof(*e));
+	e->path = xstrdup(path);
+	e->canonical = xstrdup(canonical);
+	e->next = (struct pathcache_entry *) hash_table_remove(targets,canonical);
+
+	hash_table_insert(cache,path,e);
+	hash_table_insert(targets,canonical,e);
+}
+
+/* Forget one path, unlinking it from the list of its target. */
+
+static void pathcache_remove( const char *path )
+{
+	struct pathcache_entry *e, *head, **ep;
+
+	e = (struct pathcache_entry *) hash_table_remove(cache,path);
+	if(!e) return;
+
+	head = (struct pathcache_entry *) hash_table_remove(targets,e->canonical);
+	for(ep=&head;*ep && *ep!=e;ep=&(*ep)->next) {}
+	if(*ep) *ep = e->next;
+	if(head) hash_table_insert(targets,e->canonical,head);
+
+	pathcache_entry_delete(e);
+	cache_invalidations++;
+}
+
+/*
+Resolve path as its directory's canonical path plus its last
+component, if that component is neither a symlink nor a dot.
+Otherwise, or if the path ends in a slash, leave it to realpath.
+*/
+
+static int pathcache_resolve( const char *path, char *canonical )
+{
+	char dir[PATH_MAX];
+	char dircanonical[PATH_MAX];
+	struct stat info;
+	const char *base;
+
+	base = strrchr(path,'/');
+	if(!base || base==path) return realpath(path,canonical)!=0;
+	base++;
+
+	if(!base[0] || !strcmp(base,".") || !strcmp(base,"..")) return realpath(path,canonical)!=0;
+	if(lstat(path,&info)!=0) return 0;
+	if(S_ISLNK(info.st_mode)) return realpath(path,canonical)!=0;
+
+	if((size_t)(base-path)>=sizeof(dir)) return realpath(path,canonical)!=0;
+	memcpy(dir,path,base-path-1);
+	dir[base-path-1] = 0;
+
+	if(!pfs_pathcache_realpath(dir,dircanonical)) return 0;
+	if(strlen(dircanonical)+strlen(base)+2>PATH_MAX) return realpath(path,canonical)!=0;
+
+	if(!strcmp(dircanonical,"/")) {
+		sprintf(canonical,"/%s",base);
+	} else {
+		sprintf(canonical,"%s/%s",dircanonical,base);
+	}
+
+	return 1;
+}
+
+int pfs_pathcache_realpath( const char *path, char *canonical )
+{
+	struct pathcache_entry *e;
+
+	if(path[0]!='/') return realpath(path,canonical)!=0;
+
+	if(cache) {
+		e = (struct pathcache_entry *) hash_table_lookup(cache,path);
+		if(e) {
+			cache_hits++;
+			strcpy(canonical,e->canonical);
+			return 1;
+		}
+	}
+
+	cache_misses++;
+
+	if(!pathcache_resolve(path,canonical)) return 0;
+
+	pathcache_insert(path,canonical);
+
+	return 1;
+}
+
+/*
+Removing or replacing a plain file only affects the paths that
+resolve to it.  A directory or a symlink may be part of the way
+to any other entry, so changing one empties the whole cache.
+The target is found with realpath itself, so as not to put the
+path back into the cache that it is being removed from.
+*/
+
+void pfs_pathcache_invalidate( const char *path )
+{
+	char canonical[PATH_MAX];
+	struct stat info;
+	struct pathcache_entry *e, *next;
+
+	if(!cache || hash_table_size(cache)==0) return;
+
+	if(lstat(path,&info)!=0) {
+		pathcache_remove(path);
+		return;
+	}
+
+	if(S_ISDIR(info.st_mode) || S_ISLNK(info.st_mode) || !realpath(path,canonical)) {
+		debug(D_CACHE,"pathcache: %s changes, flushing",path);
+		pfs_pathcache_flush();
+		return;
+	}
+
+	pathcache_remove(path);
+
+	for(e=(struct pathcache_entry *)hash_table_remove(targets,canonical);e;e=next) {
+		next = e->next;
+		hash_table_remove(cache,e->path);
+		pathcache_entry_delete(e);
+		cache_invalidations++;
+	}
+}
+
+void pfs_pathcache_report()
+{
+	long long total = cache_hits+cache_misses;
+	debug(D_DEBUG,"pathcache: %lld hits, %lld misses (%.1f%% hit rate), %lld invalidations, %lld flushes",cache_hits,cache_misses,total ? 100.0*cache_hits/total : 0.0,cache_invalidations,cache_flushes);
+}
+
+void pfs_pathcache_print_stats( FILE *file )
+{
+	long long total = cache_hits+cache_misses;
+	fprintf(file,"\nPath Cache Summary:\n");
+	fprintf(file,"%lld hits, %lld misses (%.1f%% hit rate)\n",cache_hits,cache_misses,total ? 100.0*cache_hits/total : 0.0);
+	fprintf(file,"%lld invalidations, %lld flushes\n",cache_invalidations,cache_flushes);
+}
@@ -0,0 +1,28 @@
+/*
+Copyright (C) 2003-2004 Douglas Thain and the University of Wisconsin
+Copyright (C) 2005- The University of Notre Dame
+This software is distributed under the GNU General Public License.
+See the file COPYING for details.
+*/
+
+#ifndef PFS_PATHCACHE_H
+#define PFS_PATHCACHE_H
+
+#include <stdio.h>
+
+/*
+A cache of canonical paths, keyed by absolute path, so that the
+names given to gremlin constraints cost a realpath only the first
+time a path is seen.  Directories are entries like any other, so
+a new file in a known directory costs a single lstat.  Anything
+that changes the namespace must call pfs_pathcache_invalidate
+on each path it removes or replaces, before doing so.
+*/
+
+int  pfs_pathcache_realpath( const char *path, char *canonical );
+void pfs_pathcache_invalidate( const char *path );
+void pfs_pathcache_flush();
+void pfs_pathcache_report();
+void pfs_pathcache_print_stats( FILE *file );
+
+#endif
@@ -12,51 +12,80 @@ See the file COPYING for details.
 extern "C" {
 #include "macros.h"
 #include "debug.h"
+#include "itable.h"
+#include "xmalloc.h"
 }
 
 #include <string.h>
 #include <errno.h>
 #include <fcntl.h>
 #include <unistd.h>
-#include <sys/select.h>
+#include <stdlib.h>
 #include <stdio.h>
 #include <signal.h>
+#include <sys/time.h>
+#include <sys/epoll.h>
+#include <sys/signalfd.h>
 
 /*
-This code has a race condition that is unavoidable.
-We want to select on a number of file descriptors,
-but be woken up if a sigchild comes in.  Sadly, Linux
-has no atomic pselect.  To combat this, we put an
-upper bound on the select sleep time, and check an
-integer shortly before selecting.  Not much else
-to do.
+We sleep in epoll_pwait, which unblocks the usual signals for
+exactly as long as we wait, so a signal can no longer slip in
+between deciding to sleep and sleeping.  SIGCHLD stays blocked
+and is read from a signalfd instead, so that it wakes us even if
+someone else has replaced our handler, as the jvm linked with hdfs
+does.  POLL_TIME_MAX is only a backstop.
+
+Every fd that some process is blocked on is registered once with
+epoll, for the union of what its waiters want.  Sleeps are kept
+in a heap ordered by wakeup time.  Each process has a record of
+its waits, so that they can all be cleared at once when it wakes.
 */
 
 #define POLL_TIME_MAX 1
+#define POLL_EVENTS_MAX 256
 
-#define POLL_TABLE_MAX 4096
-#define SLEEP_TABLE_MAX 4096
+struct poll_fd;
 
-struct poll_entry {
-	int fd;
+struct poll_waiter {
 	pid_t pid;
 	int flags;
+	struct poll_fd *pfd;
+	struct poll_waiter *fd_next;
+	struct poll_waiter *pid_next;
+};
+
+struct poll_fd {
+	int fd;
+	int events;
+	struct poll_waiter *waiters;
 };
 
 struct sleep_entry {
 	struct timeval stoptime;
 	pid_t pid;
+	int heap_index;
+	struct sleep_entry *pid_next;
 };
 
-static struct poll_entry poll_table[POLL_TABLE_MAX];
-static struct sleep_entry sleep_table[SLEEP_TABLE_MAX];
+struct poll_pid {
+	struct poll_waiter *waiters;
+	struct sleep_entry *sleeps;
+};
 
-static int poll_table_size = 0;
-static int sleep_table_size = 0;
-static int poll_abort_now = 0;
+static int epoll_fd = -1;
+static int sigchld_fd = -1;
+
+static struct itable *poll_fds = 0;
+static struct itable *poll_pids = 0;
 
-extern void install_handler( int sig, void (*handler)(int sig));
-extern void handle_sigchld( int sig );
+/* waiters on fds that epoll cannot watch, which select saw as always ready */
+static struct poll_waiter *poll_unwatched = 0;
+
+static struct sleep_entry **sleep_heap = 0;
+static int sleep_heap_size = 0;
+static int sleep_heap_max = 0;
+
+static int poll_abort_now = 0;
 
 void pfs_poll_abort()
 {
@@ -65,183 +94,376 @@ void pfs_poll_abort()
 
 void pfs_poll_init()
 {
-	int i;
-	for(i=0;i<POLL_TABLE_MAX;i++) {
-		poll_table[i].pid = -1;
+	struct epoll_event ev;
+	sigset_t mask;
+
+	poll_fds = itable_create(0);
+	poll_pids = itable_create(0);
+
+	epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+	if(epoll_fd<0) fatal("couldn't create epoll fd: %s",strerror(errno));
+
+	sigemptyset(&mask);
+	sigaddset(&mask,SIGCHLD);
+	sigchld_fd = signalfd(-1,&mask,SFD_NONBLOCK|SFD_CLOEXEC);
+	if(sigchld_fd<0) fatal("couldn't create signalfd: %s",strerror(errno));
+
+	memset(&ev,0,sizeof(ev));
+	ev.events = EPOLLIN;
+	ev.data.u64 = (UINT64_T) -1;
+	if(epoll_ctl(epoll_fd,EPOLL_CTL_ADD,sigchld_fd,&ev)!=0) fatal("couldn't watch signalfd: %s",strerror(errno));
+}
+
+static struct poll_pid * poll_pid_lookup( pid_t pid, int create )
+{
+	struct poll_pid *pp = (struct poll_pid *) itable_lookup(poll_pids,pid);
+	if(!pp && create) {
+		pp = (struct poll_pid *) xxmalloc(sizeof(*pp));
+		pp->waiters = 0;
+		pp->sleeps = 0;
+		itable_insert(poll_pids,pid,pp);
 	}
-	for(i=0;i<SLEEP_TABLE_MAX;i++) {
-		sleep_table[i].pid = -1;
+	return pp;
+}
+
+static int poll_epoll_events( int flags )
+{
+	int events = 0;
+	if(flags&PFS_POLL_READ) events |= EPOLLIN;
+	if(flags&PFS_POLL_WRITE) events |= EPOLLOUT;
+	if(flags&PFS_POLL_EXCEPT) events |= EPOLLPRI;
+	return events;
+}
+
+/*
+Errors and hangups make an fd ready for everyone, as select would.
+*/
+
+static int poll_ready_flags( int events )
+{
+	int flags = 0;
+	if(events&(EPOLLIN|EPOLLHUP|EPOLLERR)) flags |= PFS_POLL_READ;
+	if(events&(EPOLLOUT|EPOLLHUP|EPOLLERR)) flags |= PFS_POLL_WRITE;
+	if(events&(EPOLLPRI|EPOLLHUP|EPOLLERR)) flags |= PFS_POLL_EXCEPT;
+	return flags;
+}
+
+/*
+Bring the epoll registration of this fd in line with its waiters.
+The kernel drops the registration by itself when the fd is closed,
+so a stale one may be gone when we go to change it.
+*/
+
+static int poll_fd_update( struct poll_fd *f )
+{
+	struct poll_waiter *w;
+	struct epoll_event ev;
+	int events = 0;
+
+	for(w=f->waiters;w;w=w->fd_next) events |= poll_epoll_events(w->flags);
+	if(events==f->events) return 1;
+
+	memset(&ev,0,sizeof(ev));
+	ev.events = events;
+	ev.data.u64 = f->fd;
+
+	if(events==0) {
+		epoll_ctl(epoll_fd,EPOLL_CTL_DEL,f->fd,&ev);
+	} else if(f->events==0) {
+		if(epoll_ctl(epoll_fd,EPOLL_CTL_ADD,f->fd,&ev)!=0) {
+			if(errno!=EEXIST || epoll_ctl(epoll_fd,EPOLL_CTL_MOD,f->fd,&ev)!=0) return 0;
+		}
+	} else {
+		if(epoll_ctl(epoll_fd,EPOLL_CTL_MOD,f->fd,&ev)!=0) {
+			if(errno!=ENOENT || epoll_ctl(epoll_fd,EPOLL_CTL_ADD,f->fd,&ev)!=0) return 0;
+		}
 	}
+
+	f->events = events;
+	return 1;
 }
 
-void pfs_poll_clear( int pid )
+static void sleep_heap_swap( int a, int b )
 {
-	int i;
-	for(i=0;i<poll_table_size;i++) {
-		if(poll_table[i].pid==pid) poll_table[i].pid = -1;
+	struct sleep_entry *s = sleep_heap[a];
+	sleep_heap[a] = sleep_heap[b];
+	sleep_heap[b] = s;
+	sleep_heap[a]->heap_index = a;
+	sleep_heap[b]->heap_index = b;
+}
+
+static void sleep_heap_up( int i )
+{
+	while(i>0) {
+		int parent = (i-1)/2;
+		if(!timercmp(&sleep_heap[i]->stoptime,&sleep_heap[parent]->stoptime,<)) break;
+		sleep_heap_swap(i,parent);
+		i = parent;
 	}
-	for(i=0;i<sleep_table_size;i++) {
-		if(sleep_table[i].pid==pid) sleep_table[i].pid = -1;
+}
+
+static void sleep_heap_down( int i )
+{
+	while(1) {
+		int least = i;
+		int left = 2*i+1;
+		int right = 2*i+2;
+		if(left<sleep_heap_size && timercmp(&sleep_heap[left]->stoptime,&sleep_heap[least]->stoptime,<)) least = left;
+		if(right<sleep_heap_size && timercmp(&sleep_heap[right]->stoptime,&sleep_heap[least]->stoptime,<)) least = right;
+		if(least==i) break;
+		sleep_heap_swap(i,least);
+		i = least;
 	}
 }
 
-void pfs_poll_sleep()
+static void sleep_heap_remove( struct sleep_entry *s )
 {
-	struct timeval curtime;
-	struct timeval stoptime;
-	struct timeval sleeptime;
-	fd_set rfds, wfds, efds;
+	int i = s->heap_index;
+	sleep_heap_size--;
+	if(i!=sleep_heap_size) {
+		sleep_heap_swap(i,sleep_heap_size);
+		sleep_heap_up(i);
+		sleep_heap_down(i);
+	}
+}
+
+void pfs_poll_clear( int pid )
+{
+	struct poll_pid *pp;
+	struct poll_waiter *w, **wp;
 	struct sleep_entry *s;
-	struct poll_entry *p;
-	int maxfd=0, i;
-	int result;
 
-	FD_ZERO(&rfds);
-	FD_ZERO(&wfds);
-	FD_ZERO(&efds);
+	pp = (struct poll_pid *) itable_remove(poll_pids,pid);
+	if(!pp) return;
+
+	while((w=pp->waiters)) {
+		pp->waiters = w->pid_next;
+		if(w->pfd) {
+			struct poll_fd *f = w->pfd;
+			for(wp=&f->waiters;*wp!=w;wp=&(*wp)->fd_next) {}
+			*wp = w->fd_next;
+			poll_fd_update(f);
+			if(!f->waiters) {
+				itable_remove(poll_fds,f->fd);
+				free(f);
+			}
+		} else {
+			for(wp=&poll_unwatched;*wp!=w;wp=&(*wp)->fd_next) {}
+			*wp = w->fd_next;
+		}
+		free(w);
+	}
 
-	poll_abort_now = 0;
+	while((s=pp->sleeps)) {
+		pp->sleeps = s->pid_next;
+		sleep_heap_remove(s);
+		free(s);
+	}
 
-	gettimeofday(&curtime,0);
-	stoptime = curtime;
-	stoptime.tv_sec += POLL_TIME_MAX;
-
-	for(i=0;i<poll_table_size;i++) {
-		p = &poll_table[i];
-		if(p->pid>=0) {
-			maxfd = MAX(p->fd+1,maxfd);
-			if(p->flags&PFS_POLL_READ) FD_SET(p->fd,&rfds);
-			if(p->flags&PFS_POLL_WRITE) FD_SET(p->fd,&wfds);
-			if(p->flags&PFS_POLL_EXCEPT) FD_SET(p->fd,&efds);
+	free(pp);
+}
+
+/*
+Waking a process may run it far enough that it clears or adds
+other waits, so the pids to wake are gathered before any is woken.
+*/
+
+static pid_t *wake_list = 0;
+static int wake_list_max = 0;
+
+static int poll_gather( struct poll_waiter *w, int flags, int n )
+{
+	for(;w;w=w->fd_next) {
+		if(!(w->flags&flags)) continue;
+		if(n>=wake_list_max) {
+			wake_list_max = wake_list_max ? wake_list_max*2 : 64;
+			wake_list = (pid_t *) realloc(wake_list,wake_list_max*sizeof(pid_t));
+			if(!wake_list) fatal("out of memory");
 		}
+		wake_list[n++] = w->pid;
 	}
-	for(i=0;i<sleep_table_size;i++) {
-		s = &sleep_table[i];
-		if(s->pid>=0) {
-			if(timercmp(&stoptime,&s->stoptime,>)) {
-				stoptime = s->stoptime;
-			}
-		}
+	return n;
+}
+
+static void poll_wake_fd( int fd, int flags )
+{
+	struct poll_fd *f = (struct poll_fd *) itable_lookup(poll_fds,fd);
+	int i, n;
+
+	if(!f) return;
+	n = poll_gather(f->waiters,flags,0);
+	for(i=0;i<n;i++) {
+		debug(D_POLL,"waking pid %d because of fd %d",wake_list[i],fd);
+		pfs_poll_clear(wake_list[i]);
+		pfs_process_wake(wake_list[i]);
 	}
+}
 
-	sleeptime.tv_sec = stoptime.tv_sec - curtime.tv_sec;
-	sleeptime.tv_usec = stoptime.tv_usec - curtime.tv_usec;
+/*
+The kernel drops the epoll registration of a closed fd without
+telling us, so anyone waiting on it would sleep until the next
+timer.  Wake them now, while the number still means the same file,
+so that they can find out for themselves.
+*/
 
-	while(sleeptime.tv_usec<0) {
-		sleeptime.tv_usec += 1000000;
-		sleeptime.tv_sec -= 1;
+void pfs_poll_closed( int fd )
+{
+	struct poll_fd *f = (struct poll_fd *) itable_lookup(poll_fds,fd);
+	int i, n;
+
+	if(!f) return;
+	n = poll_gather(f->waiters,PFS_POLL_READ|PFS_POLL_WRITE|PFS_POLL_EXCEPT,0);
+	for(i=0;i<n;i++) {
+		debug(D_POLL,"waking pid %d because fd %d is being closed",wake_list[i],fd);
+		pfs_poll_clear(wake_list[i]);
+		pfs_process_wake(wake_list[i]);
 	}
+}
 
-	CRITICAL_END
+void pfs_poll_sleep()
+{
+	struct epoll_event events[POLL_EVENTS_MAX];
+	struct signalfd_siginfo info;
+	struct timeval curtime;
+	struct timeval sleeptime;
+	sigset_t mask;
+	int timeout;
+	int result, i, n;
 
-	if(!poll_abort_now && sleeptime.tv_sec>0) usleep(1);
+	gettimeofday(&curtime,0);
 
-	if(sleeptime.tv_sec<0 || poll_abort_now) {
-		sleeptime.tv_sec = 0;
-		sleeptime.tv_usec = 0;
+	if(poll_abort_now || poll_unwatched) {
+		timeout = 0;
+	} else if(sleep_heap_size>0) {
+		timersub(&sleep_heap[0]->stoptime,&curtime,&sleeptime);
+		if(sleeptime.tv_sec<0) {
+			timeout = 0;
+		} else if(sleeptime.tv_sec>=POLL_TIME_MAX) {
+			timeout = POLL_TIME_MAX*1000;
+		} else {
+			/* round up, so that we do not wake just short of the timer */
+			timeout = sleeptime.tv_sec*1000 + (sleeptime.tv_usec+999)/1000;
+		}
+	} else {
+		timeout = POLL_TIME_MAX*1000;
 	}
 
-	result = select(maxfd,&rfds,&wfds,&efds,&sleeptime);
+	poll_abort_now = 0;
 
-	CRITICAL_BEGIN
+	/* the same signals as CRITICAL_END, but SIGCHLD comes through the signalfd */
+	sigemptyset(&mask);
+	sigaddset(&mask,SIGPIPE);
+	sigaddset(&mask,SIGCHLD);
+
+	result = epoll_pwait(epoll_fd,events,POLL_EVENTS_MAX,timeout,&mask);
 
 	if(result>0) {
-		for(i=0;i<poll_table_size;i++) {
-			p = &poll_table[i];
-			if(p->pid>=0) {
-				if(
-					(p->flags&PFS_POLL_READ && FD_ISSET(p->fd,&rfds)) ||
-					(p->flags&PFS_POLL_WRITE && FD_ISSET(p->fd,&wfds)) ||
-					(p->flags&PFS_POLL_EXCEPT && FD_ISSET(p->fd,&efds))
-				) {
-					pid_t pid = p->pid;
-					debug(D_POLL,"waking pid %d because of fd %d",pid,p->fd);
-					pfs_poll_clear(pid);
-					pfs_process_wake(pid);
-				}
-			}
-		}
-	} else if(result==0) {
-		// select timed out, which should never happen, except
-		// that it does when the jvm linked with hdfs sets up its
-		// signal handlers to avoid sigchld.  In that case, re-install
-		install_handler(SIGCHLD,handle_sigchld);
-
-		gettimeofday(&curtime,0);
-
-		for(i=0;i<sleep_table_size;i++) {
-			s = &sleep_table[i];
-			if(s->pid>=0) {
-				if(timercmp(&curtime,&s->stoptime,>)) {
-					pid_t pid = s->pid;
-					debug(D_POLL,"waking pid %d because time expired",pid);
-					pfs_poll_clear(pid);
-					pfs_process_wake(pid);
-				}
+		for(i=0;i<result;i++) {
+			if(events[i].data.u64==(UINT64_T)-1) {
+				while(read(sigchld_fd,&info,sizeof(info))==sizeof(info)) {}
+			} else {
+				poll_wake_fd((int)events[i].data.u64,poll_ready_flags(events[i].events));
 			}
 		}
-	} else if(errno==EBADF) {
-		debug(D_POLL,"select returned EBADF, which really shouldn't happen.");
-		debug(D_POLL,"waking up all processes to clean up and try again.");
-
-		for(i=0;i<poll_table_size;i++) {
-			p = &poll_table[i];
-			if(p->pid>=0) {
-				pid_t pid = p->pid;
-				debug(D_POLL,"waking pid %d",pid);
-				pfs_poll_clear(pid);
-				pfs_process_wake(pid);
-			}
+	}
+
+	if(poll_unwatched) {
+		n = poll_gather(poll_unwatched,PFS_POLL_READ|PFS_POLL_WRITE|PFS_POLL_EXCEPT,0);
+		for(i=0;i<n;i++) {
+			debug(D_POLL,"waking pid %d because its fd cannot be polled",wake_list[i]);
+			pfs_poll_clear(wake_list[i]);
+			pfs_process_wake(wake_list[i]);
 		}
 	}
 
+	/*
+	Check the timers no matter what ended the wait: while other
+	processes are busy, SIGCHLD may interrupt it long before it
+	would have timed out.
+	*/
+
+	gettimeofday(&curtime,0);
+
+	while(sleep_heap_size>0 && timercmp(&curtime,&sleep_heap[0]->stoptime,>)) {
+		pid_t pid = sleep_heap[0]->pid;
+		debug(D_POLL,"waking pid %d because time expired",pid);
+		pfs_poll_clear(pid);
+		pfs_process_wake(pid);
+	}
 }
 
 void pfs_poll_wakeon( int fd, int flags )
 {
-	struct poll_entry *p;
-	int i;
+	struct poll_pid *pp;
+	struct poll_fd *f;
+	struct poll_waiter *w;
 
 	debug(D_POLL,"wake on fd %d flags %s",fd,pfs_poll_string(flags));
 
-	for(i=0;i<POLL_TABLE_MAX;i++) {
-		p = &poll_table[i];
-		if(p->pid<0) {
-			p->fd = fd;
-			p->pid = pfs_process_getpid();
-			p->flags = flags;
-			if(i>=poll_table_size) poll_table_size=i+1;
-			return;
-		}
+	pp = poll_pid_lookup(pfs_process_getpid(),1);
+
+	w = (struct poll_waiter *) xxmalloc(sizeof(*w));
+	w->pid = pfs_process_getpid();
+	w->flags = flags;
+	w->pid_next = pp->waiters;
+	pp->waiters = w;
+
+	f = (struct poll_fd *) itable_lookup(poll_fds,fd);
+	if(!f) {
+		f = (struct poll_fd *) xxmalloc(sizeof(*f));
+		f->fd = fd;
+		f->events = 0;
+		f->waiters = 0;
+		itable_insert(poll_fds,fd,f);
 	}
 
-	fatal("ran out of poll table space!");
+	w->pfd = f;
+	w->fd_next = f->waiters;
+	f->waiters = w;
+
+	if(!poll_fd_update(f)) {
+		/* regular files and bad fds cannot be watched, but select called them ready */
+		debug(D_POLL,"cannot poll fd %d: %s",fd,strerror(errno));
+		f->waiters = w->fd_next;
+		if(!f->waiters) {
+			itable_remove(poll_fds,fd);
+			free(f);
+		}
+		w->pfd = 0;
+		w->fd_next = poll_unwatched;
+		poll_unwatched = w;
+	}
 }
 
 void pfs_poll_wakein( struct timeval tv )
 {
+	struct poll_pid *pp;
 	struct sleep_entry *s;
-	int i;
 
 	debug(D_POLL,"wake in time %d.%06d",tv.tv_sec,tv.tv_usec);
 
-	for(i=0;i<SLEEP_TABLE_MAX;i++) {
-		s = &sleep_table[i];
-		if(s->pid<0) {
-			s->pid = pfs_process_getpid();
-			gettimeofday(&s->stoptime,0);
-			s->stoptime.tv_sec += tv.tv_sec;
-			s->stoptime.tv_usec += tv.tv_usec;
-			while(s->stoptime.tv_usec>1000000) {
-				s->stoptime.tv_sec++;
-				s->stoptime.tv_usec-=1000000;
-			}
-			if(i>=sleep_table_size) sleep_table_size=i+1;
-			return;
-		}
+	pp = poll_pid_lookup(pfs_process_getpid(),1);
+
+	s = (struct sleep_entry *) xxmalloc(sizeof(*s));
+	s->pid = pfs_process_getpid();
+	gettimeofday(&s->stoptime,0);
+	s->stoptime.tv_sec += tv.tv_sec;
+	s->stoptime.tv_usec += tv.tv_usec;
+	while(s->stoptime.tv_usec>1000000) {
+		s->stoptime.tv_sec++;
+		s->stoptime.tv_usec-=1000000;
 	}
+	s->pid_next = pp->sleeps;
+	pp->sleeps = s;
 
-	fatal("ran out of sleep table space!");
+	if(sleep_heap_size>=sleep_heap_max) {
+		sleep_heap_max = sleep_heap_max ? sleep_heap_max*2 : 64;
+		sleep_heap = (struct sleep_entry **) realloc(sleep_heap,sleep_heap_max*sizeof(*sleep_heap));
+		if(!sleep_heap) fatal("out of memory");
+	}
+	s->heap_index = sleep_heap_size;
+	sleep_heap[sleep_heap_size++] = s;
+	sleep_heap_up(s->heap_index);
 }
 
 char * pfs_poll_string( int flags )
@@ -265,4 +487,3 @@ char * pfs_poll_string( int flags )
 	str[3] = 0;
 	return str;
 }
-
@@ -21,6 +21,9 @@ void pfs_poll_sleep();
 /* Wake when this fd becomes active */
 void pfs_poll_wakeon( int fd, int which );
 
+/* Wake everyone waiting on this fd, which is about to be closed */
+void pfs_poll_closed( int fd );
+
 /* Wake after this interval */
 void pfs_poll_wakein( struct timeval tv );
 
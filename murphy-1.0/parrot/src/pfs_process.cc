@@ -71,16 +71,13 @@ void pfs_process_sigio()
 void pfs_process_wake( pid_t pid )
 {
 	struct pfs_process *p = pfs_process_lookup(pid);
-	if(p && (p->state==PFS_PROCESS_STATE_WAITREAD || p->state==PFS_PROCESS_STATE_WAITWRITE) ) {
+	if(p && (p->state==PFS_PROCESS_STATE_WAITREAD || p->state==PFS_PROCESS_STATE_WAITWRITE || p->state==PFS_PROCESS_STATE_WAITSLEEP) ) {
 		debug(D_PROCESS,"pid %d woken from wait state",p->pid);
 		pfs_dispatch(p,0);
 	}
 }
 
 
-unsigned int intmapper(const int &index) {return index;}
-
-
 /*
 Note that a new process really has two kinds of parents:
 - The 'actual parent' process is the process that called fork or clone to create the child process.  From this parent, the child inherits the file table and other properties.
@@ -112,6 +109,7 @@ struct pfs_process * pfs_process_create( pid_t pid, pid_t actual_ppid, pid_t not
 	child->cwdlongpath_len = 0;
 	child->readone_s_remainder = 0;
 	child->writeone_s_remainder = 0;
+	memset(child->gremlins,0,sizeof(child->gremlins));
 	child->ppid = notify_ppid;
 	child->tgid = pid;
 	child->state = PFS_PROCESS_STATE_KERNEL;
@@ -121,6 +119,12 @@ struct pfs_process * pfs_process_create( pid_t pid, pid_t actual_ppid, pid_t not
 	child->syscall_dummy = 0;
 	child->syscall_result = 0;
 	child->syscall_args_changed = 0;
+	child->native_io = 0;
+	child->native_io_reserved = 0;
+	child->native_closes = 0;
+	child->native_close_count = 0;
+	child->native_close_max = 0;
+	memset(child->decoded,0,sizeof(child->decoded));
 	child->exit_status = 0;
 	child->exit_signal = exit_signal;
 	/* to prevent accidental copy out */
@@ -129,8 +133,10 @@ struct pfs_process * pfs_process_create( pid_t pid, pid_t actual_ppid, pid_t not
 	child->interrupted = 0;
 	child->did_stream_warning = 0;
 	child->nsyscalls = 0;
+	child->forking = 0;
 	child->heap_address = 0;
 	child->break_address = 0;
+	child->io_channel_length = 0;
 
 	actual_parent = pfs_process_lookup(actual_ppid);
 
@@ -140,7 +146,7 @@ struct pfs_process * pfs_process_create( pid_t pid, pid_t actual_ppid, pid_t not
 		child->cwdlongpath_len = actual_parent->cwdlongpath_len;
 		child->readone_s_remainder = actual_parent->readone_s_remainder;
 		child->writeone_s_remainder = actual_parent->writeone_s_remainder;
-		child->filenames = new HashTable<int,MyString>(*(actual_parent->filenames));
+		child->filenames = actual_parent->filenames->share();
 
 		child->flags |= actual_parent->flags;
 		if(share_table) {
@@ -148,16 +154,23 @@ struct pfs_process * pfs_process_create( pid_t pid, pid_t actual_ppid, pid_t not
 			child->table->addref();
 		} else {
 			child->table = actual_parent->table->fork();
+			/* the child has its own copies of any native fds still to be closed */
+			if(actual_parent->native_close_count>0) {
+				child->native_close_max = actual_parent->native_close_count;
+				child->native_close_count = actual_parent->native_close_count;
+				child->native_closes = (int*) xxmalloc(sizeof(int)*child->native_close_count);
+				memcpy(child->native_closes,actual_parent->native_closes,sizeof(int)*child->native_close_count);
+			}
 		}
 		strcpy(child->name,actual_parent->name);
 		child->umask = actual_parent->umask;
 		strcpy(child->tty,actual_parent->tty);
 		memcpy(child->signal_interruptible,actual_parent->signal_interruptible,sizeof(child->signal_interruptible));
 	} else {
-		child->filenames = new HashTable<int,MyString>(41,intmapper,updateDuplicateKeys);
-		child->filenames->insert(0, "<stdin>");
-		child->filenames->insert(1, "<stdout>");
-		child->filenames->insert(2, "<stderr>");
+		child->filenames = new pfs_filenames;
+		child->filenames = child->filenames->insert(0, "<stdin>");
+		child->filenames = child->filenames->insert(1, "<stdout>");
+		child->filenames = child->filenames->insert(2, "<stderr>");
 
 		child->table = new pfs_table;
 
@@ -167,10 +180,19 @@ struct pfs_process * pfs_process_create( pid_t pid, pid_t actual_ppid, pid_t not
 		int *flags = (int*)malloc(sizeof(int)*count);
 		int i;
 
-		/* Scan through the known file descriptors */
+		/*
+		Scan through the known file descriptors, passing over
+		those that are close-on-exec: the child would not have
+		inherited them, and they include Murphy's own event fds.
+		*/
 
 		for(int i=0;i<count;i++) {
-			flags[i] = fcntl(i,F_GETFL);
+			int fdflags = fcntl(i,F_GETFD);
+			if(fdflags<0 || (fdflags&FD_CLOEXEC)) {
+				flags[i] = -1;
+			} else {
+				flags[i] = fcntl(i,F_GETFL);
+			}
 		}
 
 		/* If valid, duplicate and attach them to the child process. */
@@ -209,9 +231,43 @@ void pfs_process_delete( struct pfs_process *p )
 	/* The file table was deleted in pfs_process_stop */
 	itable_remove(pfs_process_table,p->pid);
 	tracer_detach(p->tracer);
+	if(p->io_channel_length) pfs_channel_free(p->io_channel_offset);
 	free(p);
 }
 
+/*
+Nearly every diverted read and write in a process asks for about
+the same amount of channel space, so each process keeps the space
+of its last one for the next, unless it is unusually large.
+*/
+
+#define PFS_PROCESS_CHANNEL_KEEP (256*1024)
+
+int pfs_process_channel_alloc( struct pfs_process *p, pfs_size_t length )
+{
+	pfs_size_t page_size = getpagesize();
+
+	length = MAX(length,1);
+	length = page_size*((length+page_size-1)/page_size);
+
+	if(p->io_channel_length) {
+		if(length<=p->io_channel_length) return 1;
+		pfs_channel_free(p->io_channel_offset);
+		p->io_channel_length = 0;
+	}
+	if(!pfs_channel_alloc(length,&p->io_channel_offset)) return 0;
+	p->io_channel_length = length;
+	return 1;
+}
+
+void pfs_process_channel_free( struct pfs_process *p )
+{
+	if(p->io_channel_length>PFS_PROCESS_CHANNEL_KEEP) {
+		pfs_channel_free(p->io_channel_offset);
+		p->io_channel_length = 0;
+	}
+}
+
 /*
 Cause this parent process to wake up, reporting
 the status of the given child process.  If the
@@ -326,9 +382,13 @@ void pfs_process_stop( struct pfs_process *child, int status, struct rusage usag
 			child->table = 0;
 		}
 		if(child->filenames) {
-			delete child->filenames;
+			child->filenames->delref();
+			if(!child->filenames->refs()) delete child->filenames;
 			child->filenames = 0;
 		}
+		free(child->native_closes);
+		child->native_closes = 0;
+		child->native_close_count = child->native_close_max = 0;
 	} else {
 		child->state = PFS_PROCESS_STATE_WAITPID;
 	}
@@ -407,6 +467,22 @@ int pfs_process_count()
 	return nprocs;
 }
 
+/* Is any process between entering and returning from a fork? */
+
+int pfs_process_forking()
+{
+	UINT64_T pid;
+	struct pfs_process *p;
+
+	if(!pfs_process_table) return 0;
+
+	itable_firstkey(pfs_process_table);
+	while(itable_nextkey(pfs_process_table,&pid,(void**)&p)) {
+		if(p && p->forking) return 1;
+	}
+	return 0;
+}
+
 extern "C" int pfs_process_getpid()
 {
 	if(pfs_current) {
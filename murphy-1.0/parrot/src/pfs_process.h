@@ -11,7 +11,8 @@ See the file COPYING for details.
 #include "pfs_types.h"
 #include "pfs_table.h"
 #include "pfs_sysdeps.h"
-#include "HashTable.h"
+#include "pfs_filenames.h"
+#include "controller.h"
 
 extern "C" {
 #include "tracer.h"
@@ -30,9 +31,17 @@ extern "C" {
 #define PFS_PROCESS_STATE_WAITREAD 3
 #define PFS_PROCESS_STATE_WAITWRITE 4
 #define PFS_PROCESS_STATE_DONE 5
+#define PFS_PROCESS_STATE_WAITSLEEP 6
 
 #define PFS_SCRATCH_SIZE 4096
 
+/* path arguments of a syscall that may be decoded once per stop */
+#define PFS_PROCESS_DECODED_ARGS 2
+
+#define PFS_DECODED_PATH      1
+#define PFS_DECODED_FULL_PATH 2
+#define PFS_DECODED_REAL_PATH 4
+
 struct pfs_process {
 	char name[PFS_PATH_MAX];
 	char new_logical_name[PFS_PATH_MAX];
@@ -44,7 +53,8 @@ struct pfs_process {
 	int  cwdlongpath_len;
 	int  readone_s_remainder;
 	int  writeone_s_remainder;
-	HashTable<int,MyString> *filenames;
+	pfs_filenames *filenames;
+	struct gremlin_entry gremlins[GREMLIN_MAX];
 
 	mode_t umask;
 	pid_t  pid, ppid, tgid;
@@ -55,6 +65,7 @@ struct pfs_process {
 	struct timeval seltime;
 
 	pfs_size_t io_channel_offset;
+	pfs_size_t io_channel_length;
 	PTRINT_T heap_address;
 	PTRINT_T break_address;
 
@@ -64,8 +75,19 @@ struct pfs_process {
 	INT64_T syscall_result;
 	INT64_T syscall_args[TRACER_ARGS_MAX];
 	INT64_T syscall_args_changed;
+	int native_io;
+	pfs_off_t native_io_offset;
+	pfs_size_t native_io_reserved;
+	int *native_closes;
+	int native_close_count;
+	int native_close_max;
 	INT64_T actual_result;
 
+	int  decoded[PFS_PROCESS_DECODED_ARGS];
+	char decoded_path[PFS_PROCESS_DECODED_ARGS][PFS_PATH_MAX];
+	char decoded_full_path[PFS_PROCESS_DECODED_ARGS][PFS_PATH_MAX];
+	char decoded_real_path[PFS_PROCESS_DECODED_ARGS][PATH_MAX];
+
 	int did_stream_warning;
 	int diverted_length;
 	int signal_interruptible[256];
@@ -80,6 +102,7 @@ struct pfs_process {
 	int 	       exit_signal;
 	int            interrupted;
 	int            nsyscalls;
+	int            forking;
 };
 
 struct pfs_process * pfs_process_create( pid_t pid, pid_t actual_ppid, pid_t notify_ppid, int share_table, int exit_signal );
@@ -93,6 +116,7 @@ int pfs_process_waitpid( struct pfs_process *p, pid_t wait_pid, int *wait_ustatu
 void pfs_process_sigio();
 void pfs_process_wake( pid_t pid );
 int  pfs_process_count();
+int  pfs_process_forking();
 int  pfs_process_raise( pid_t pid, int sig, int really_sendit );
 
 extern "C" int  pfs_process_getpid();
@@ -103,6 +127,9 @@ extern "C" void pfs_process_killall();
 PTRINT_T pfs_process_heap_address( struct pfs_process *p );
 PTRINT_T pfs_process_scratch_address( struct pfs_process *p );
 
+int  pfs_process_channel_alloc( struct pfs_process *p, pfs_size_t length );
+void pfs_process_channel_free( struct pfs_process *p );
+
 extern struct pfs_process *pfs_current;
 
 #endif
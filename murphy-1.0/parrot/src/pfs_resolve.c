@@ -23,22 +23,92 @@ See the file COPYING for details.
 
 extern char pfs_temp_dir[PFS_PATH_MAX];
 
+/*
+The mount list is compiled as it is loaded.  Plain prefixes go
+into a trie with one node per character, so that a single walk
+down a logical name finds every prefix that covers it.  Entries
+with glob characters are kept in a separate list, newest first.
+As before, the entry added last wins when several match; order
+records that.
+*/
+
 struct mount_entry {
 	char prefix[PFS_PATH_MAX];
 	char redirect[PFS_PATH_MAX];
+	int order;
 	struct mount_entry *next;
 };
 
-static struct mount_entry * mount_list = 0;
+struct mount_node {
+	char c;
+	struct mount_entry *entry;
+	struct mount_node *child;
+	struct mount_node *sibling;
+};
+
+static struct mount_node mount_trie;
+static struct mount_entry *pattern_list = 0;
+static int mount_count = 0;
+static int pattern_count = 0;
+
+/*
+Resolved names are kept in a cache bounded by memory, and the
+least recently used are dropped first.  Names that are denied or
+missing are cached as well, so that a program polling for a file
+does not search the mount list every time.
+*/
+
+#define RESOLVE_CACHE_MAX (4*1024*1024)
+
+struct resolve_entry {
+	pfs_resolve_t result;
+	int size;
+	char *physical_name;
+	struct resolve_entry *prev;
+	struct resolve_entry *next;
+	char logical_name[1];
+};
+
 static struct hash_table *resolve_cache = 0;
+static struct resolve_entry *lru_head = 0;
+static struct resolve_entry *lru_tail = 0;
+static INT64_T resolve_cache_size = 0;
+
+static INT64_T resolve_hits = 0;
+static INT64_T resolve_negative_hits = 0;
+static INT64_T resolve_misses = 0;
+static INT64_T resolve_evictions = 0;
 
 static void add_mount_entry( const char *prefix, const char *redirect )
 {
 	struct mount_entry * m = xxmalloc(sizeof(*m));
 	strcpy(m->prefix,prefix);
 	strcpy(m->redirect,redirect);
-	m->next = mount_list;
-	mount_list = m;
+	m->order = mount_count++;
+
+	if(!prefix[0] || strpbrk(prefix,"*?[\\")) {
+		m->next = pattern_list;
+		pattern_list = m;
+		pattern_count++;
+	} else {
+		struct mount_node *n = &mount_trie;
+		const char *s;
+		for(s=prefix;*s;s++) {
+			struct mount_node *c;
+			for(c=n->child;c && c->c!=*s;c=c->sibling) {}
+			if(!c) {
+				c = xxmalloc(sizeof(*c));
+				c->c = *s;
+				c->entry = 0;
+				c->child = 0;
+				c->sibling = n->child;
+				n->child = c;
+			}
+			n = c;
+		}
+		m->next = n->entry;
+		n->entry = m;
+	}
 }
 
 void pfs_resolve_manual_config( const char *str )
@@ -122,21 +192,15 @@ int pfs_resolve_external( const char *logical_name, const char *prefix, const ch
 }
 
 /*
-Compare a logical name to a mountlist entry and
-determine what to do with it.
+Decide whether a mountlist entry applies to a logical name:
+either the pattern matches it, or the prefix covers it.
 */
 
-static pfs_resolve_t mount_entry_check( const char *logical_name, const char *prefix, const char *redirect, char *physical_name )
+static int mount_entry_match( const char *logical_name, const char *prefix )
 {
-	pfs_resolve_t result;
-	const char *prefix_sep, *local_prefix, *remote_prefix;
-	int local_prefix_len;
-	struct stat64 statbuf;
-
 	int plen = strlen(prefix);
-	int llen = strlen(logical_name);
 
-	if(
+	return
 		/* match patterns to logical name */
 		!fnmatch(prefix,logical_name,0)
 		||
@@ -146,61 +210,102 @@ static pfs_resolve_t mount_entry_check( const char *logical_name, const char *pr
 			(
 				prefix[plen-1]=='/' ||
 				logical_name[plen]=='/' ||
-				plen==llen
+				plen==(int)strlen(logical_name)
 			)
-		)
-	) {
-		if(!strcmp(redirect,"DENY")) {
-			result = PFS_RESOLVE_DENIED;
-		} else if(!strcmp(redirect,"ENOENT")) {
-			result = PFS_RESOLVE_ENOENT;
-		} else if(!strcmp(redirect,"LOCAL")) {
+		);
+}
+
+/*
+Find the mountlist entry that applies to a logical name.  The
+trie yields the newest prefix that covers the name, and only the
+patterns newer than that one need to be tried.
+*/
+
+static struct mount_entry * mount_list_match( const char *logical_name )
+{
+	struct mount_node *n = &mount_trie;
+	struct mount_entry *best = 0;
+	struct mount_entry *e;
+	const char *s = logical_name;
+
+	while(*s) {
+		for(n=n->child;n && n->c!=*s;n=n->sibling) {}
+		if(!n) break;
+		s++;
+		if(n->entry && (s[-1]=='/' || *s=='/' || !*s)) {
+			if(!best || n->entry->order>best->order) best = n->entry;
+		}
+	}
+
+	for(e=pattern_list;e && (!best || e->order>best->order);e=e->next) {
+		if(mount_entry_match(logical_name,e->prefix)) return e;
+	}
+
+	return best;
+}
+
+/*
+Apply a matching mountlist entry to a logical name.
+*/
+
+static pfs_resolve_t mount_entry_apply( const char *logical_name, const char *prefix, const char *redirect, char *physical_name )
+{
+	pfs_resolve_t result;
+	const char *prefix_sep, *local_prefix, *remote_prefix;
+	int local_prefix_len;
+	struct stat64 statbuf;
+
+	int plen = strlen(prefix);
+	int llen = strlen(logical_name);
+
+	if(!strcmp(redirect,"DENY")) {
+		result = PFS_RESOLVE_DENIED;
+	} else if(!strcmp(redirect,"ENOENT")) {
+		result = PFS_RESOLVE_ENOENT;
+	} else if(!strcmp(redirect,"LOCAL")) {
+		strcpy(physical_name,logical_name);
+		result = PFS_RESOLVE_CHANGED;
+	} else if(!strncmp(redirect,"resolver:",9)) {
+		result = pfs_resolve_external(logical_name,prefix,&redirect[9],physical_name);
+	} else if(!strncmp(redirect,"lcache:",7) &&
+		  (prefix_sep = strchr(redirect, '|'))) {
+		/* redirect entry is in the format lcache:/local/path|/remote/path */
+		local_prefix = &redirect[7];
+		local_prefix_len = (int)(prefix_sep-local_prefix);
+		/* anything in the local_prefix tree and the PFS cache is local */
+		if ((!strncmp(logical_name, local_prefix, local_prefix_len)) || 
+                            (!strncmp(logical_name, pfs_temp_dir, strlen(pfs_temp_dir))) )
+		{
 			strcpy(physical_name,logical_name);
 			result = PFS_RESOLVE_CHANGED;
-		} else if(!strncmp(redirect,"resolver:",9)) {
-			result = pfs_resolve_external(logical_name,prefix,&redirect[9],physical_name);
-		} else if(!strncmp(redirect,"lcache:",7) &&
-			  (prefix_sep = strchr(redirect, '|'))) {
-			/* redirect entry is in the format lcache:/local/path|/remote/path */
-			local_prefix = &redirect[7];
-			local_prefix_len = (int)(prefix_sep-local_prefix);
-			/* anything in the local_prefix tree and the PFS cache is local */
-			if ((!strncmp(logical_name, local_prefix, local_prefix_len)) || 
-                            (!strncmp(logical_name, pfs_temp_dir, strlen(pfs_temp_dir))) )
-			{
-				strcpy(physical_name,logical_name);
-				result = PFS_RESOLVE_CHANGED;
-			} else {
-				int retstat;
-				strncpy(physical_name, local_prefix, local_prefix_len);
-				physical_name[local_prefix_len] = '\000';
-				if(llen>plen) {
-					strcat(physical_name,"/");
-					strcat(physical_name,&logical_name[plen]);
-				}
-				retstat = stat64(physical_name, &statbuf);
-				/* All directories and all missing files are to be handled remotely */
-				if (retstat < 0 || (retstat >= 0 && S_ISDIR(statbuf.st_mode))) {
-					remote_prefix = prefix_sep+1;
-					strcpy(physical_name,remote_prefix);
-					if(llen>plen) {
-						strcat(physical_name,"/");
-						strcat(physical_name,&logical_name[plen]);
-						
-					}
-				}
-				result = PFS_RESOLVE_CHANGED;
-			}
 		} else {
-			strcpy(physical_name,redirect);
+			int retstat;
+			strncpy(physical_name, local_prefix, local_prefix_len);
+			physical_name[local_prefix_len] = '\000';
 			if(llen>plen) {
 				strcat(physical_name,"/");
 				strcat(physical_name,&logical_name[plen]);
 			}
+			retstat = stat64(physical_name, &statbuf);
+			/* All directories and all missing files are to be handled remotely */
+			if (retstat < 0 || (retstat >= 0 && S_ISDIR(statbuf.st_mode))) {
+				remote_prefix = prefix_sep+1;
+				strcpy(physical_name,remote_prefix);
+				if(llen>plen) {
+					strcat(physical_name,"/");
+					strcat(physical_name,&logical_name[plen]);
+					
+				}
+			}
 			result = PFS_RESOLVE_CHANGED;
 		}
 	} else {
-		result = PFS_RESOLVE_UNCHANGED;
+		strcpy(physical_name,redirect);
+		if(llen>plen) {
+			strcat(physical_name,"/");
+			strcat(physical_name,&logical_name[plen]);
+		}
+		result = PFS_RESOLVE_CHANGED;
 	}
 
 	return result;
@@ -239,31 +344,105 @@ void clean_up_path( char *path )
 	}
 }
 
-pfs_resolve_t pfs_resolve( const char *logical_name, char *physical_name, time_t stoptime )
+static void lru_unlink( struct resolve_entry *e )
 {
-	pfs_resolve_t result = PFS_RESOLVE_UNCHANGED;
-	struct mount_entry *e;
-	const char *t;
+	if(e->prev) e->prev->next = e->next; else lru_head = e->next;
+	if(e->next) e->next->prev = e->prev; else lru_tail = e->prev;
+}
+
+static void lru_push( struct resolve_entry *e )
+{
+	e->prev = 0;
+	e->next = lru_head;
+	if(lru_head) lru_head->prev = e; else lru_tail = e;
+	lru_head = e;
+}
+
+static struct resolve_entry * resolve_cache_lookup( const char *logical_name )
+{
+	struct resolve_entry *e;
+
+	if(!resolve_cache) return 0;
+
+	e = hash_table_lookup(resolve_cache,logical_name);
+	if(e && e!=lru_head) {
+		lru_unlink(e);
+		lru_push(e);
+	}
+
+	return e;
+}
+
+static void resolve_cache_insert( const char *logical_name, pfs_resolve_t result, const char *physical_name )
+{
+	struct resolve_entry *e;
+	int llen = strlen(logical_name);
+	int plen = strlen(physical_name);
 
 	if(!resolve_cache) resolve_cache = hash_table_create(0,0);
 
-	t = hash_table_lookup(resolve_cache,logical_name);
-	if(t) {
-		strcpy(physical_name,t);
-		result = PFS_RESOLVE_CHANGED;
+	while(lru_tail && resolve_cache_size>=RESOLVE_CACHE_MAX) {
+		e = lru_tail;
+		lru_unlink(e);
+		hash_table_remove(resolve_cache,e->logical_name);
+		resolve_cache_size -= e->size;
+		resolve_evictions++;
+		free(e);
+	}
+
+	e = xxmalloc(sizeof(*e)+llen+plen+1);
+	e->result = result;
+	e->size = sizeof(*e)+2*llen+plen+1;
+	strcpy(e->logical_name,logical_name);
+	e->physical_name = &e->logical_name[llen+1];
+	strcpy(e->physical_name,physical_name);
+
+	hash_table_insert(resolve_cache,logical_name,e);
+	lru_push(e);
+	resolve_cache_size += e->size;
+}
+
+pfs_resolve_t pfs_resolve( const char *logical_name, char *physical_name, time_t stoptime )
+{
+	pfs_resolve_t result;
+	struct resolve_entry *c;
+	struct mount_entry *e;
+
+	c = resolve_cache_lookup(logical_name);
+	if(c) {
+		result = c->result;
+		strcpy(physical_name,c->physical_name);
+		if(result==PFS_RESOLVE_CHANGED || result==PFS_RESOLVE_UNCHANGED) {
+			resolve_hits++;
+		} else {
+			resolve_negative_hits++;
+		}
 	} else {
-		for(e=mount_list;e;e=e->next) {
-			result = mount_entry_check(logical_name,e->prefix,e->redirect,physical_name);
-			if(result!=PFS_RESOLVE_UNCHANGED) break;
+		resolve_misses++;
+		e = mount_list_match(logical_name);
+		if(e) {
+			result = mount_entry_apply(logical_name,e->prefix,e->redirect,physical_name);
+		} else {
+			result = PFS_RESOLVE_UNCHANGED;
+		}
+
+		if(result==PFS_RESOLVE_UNCHANGED) {
+			strcpy(physical_name,logical_name);
+		} else if(result==PFS_RESOLVE_CHANGED) {
+			clean_up_path(physical_name);
+		} else {
+			physical_name[0] = 0;
+		}
+
+		if(result!=PFS_RESOLVE_FAILED) {
+			resolve_cache_insert(logical_name,result,physical_name);
 		}
 	}
 
 	switch(result) {
 		case PFS_RESOLVE_UNCHANGED:
-			strcpy(physical_name,logical_name);
-			break;
 		case PFS_RESOLVE_CHANGED:
-			clean_up_path(physical_name);
+			debug(D_RESOLVE,"%s = %s",logical_name,physical_name);
 			break;
 		case PFS_RESOLVE_FAILED:
 			debug(D_RESOLVE,"%s failed",logical_name);
@@ -276,14 +455,11 @@ pfs_resolve_t pfs_resolve( const char *logical_name, char *physical_name, time_t
 			break;
 	}
 
-	if(result==PFS_RESOLVE_UNCHANGED || result==PFS_RESOLVE_CHANGED) {
-		debug(D_RESOLVE,"%s = %s",logical_name,physical_name);
-		if(!hash_table_lookup(resolve_cache,logical_name)) {
-			hash_table_insert(resolve_cache,logical_name,xstrdup(physical_name));
-		}
-	}
-
 	return result;
 }
 
-
+void pfs_resolve_report()
+{
+	debug(D_DEBUG,"resolve: %d mount prefixes, %d mount patterns",mount_count-pattern_count,pattern_count);
+	debug(D_DEBUG,"resolve: %lld hits, %lld negative hits, %lld misses, %lld evictions, %lld bytes cached",(long long)resolve_hits,(long long)resolve_negative_hits,(long long)resolve_misses,(long long)resolve_evictions,(long long)resolve_cache_size);
+}
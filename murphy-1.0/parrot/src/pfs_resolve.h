@@ -22,6 +22,7 @@ void pfs_resolve_file_config( const char *mountfile );
 void pfs_resolve_manual_config( const char *string );
 
 pfs_resolve_t pfs_resolve( const char *logical_name, char *physical_name, time_t stoptime );
+void pfs_resolve_report();
 
 #endif
 
@@ -5,6 +5,7 @@ This software is distributed under the GNU General Public License.
 See the file COPYING for details.
 */
 
+#include "pfs_dircache.h"
 #include "pfs_table.h"
 #include "pfs_service.h"
 #include "pfs_location.h"
@@ -15,7 +16,6 @@ extern "C" {
 #include "debug.h"
 #include "xmalloc.h"
 #include "macros.h"
-#include "hash_table.h"
 }
 
 #include <string.h>
@@ -34,66 +34,20 @@ extern int pfs_enable_small_file_optimizations;
 
 char chirp_rootpath[] = "/";
 
-static struct hash_table * chirp_dircache = 0;
-static char * chirp_dircache_path = 0;
-
-static void chirp_dircache_invalidate()
-{
-	char *key;
-	void *value;
-
-	if(chirp_dircache) {
-		hash_table_firstkey(chirp_dircache);
-		while(hash_table_nextkey(chirp_dircache,&key,&value)) {
-			hash_table_remove(chirp_dircache,key);
-			free(value);
-		}
-	}
+/*
+Listings carry the attributes of each entry, so that a traversal
+costs one round trip per directory rather than one per file.
+*/
 
-	if(chirp_dircache_path) {
-		free(chirp_dircache_path);
-		chirp_dircache_path = 0;
-	}
-}
+#define CHIRP_DIRCACHE_TTL 5
 
-static void chirp_dircache_begin( const char *path )
-{
-	chirp_dircache_invalidate();
-	chirp_dircache_path = xstrdup(path);
-}
+static pfs_dircache chirp_dircache(CHIRP_DIRCACHE_TTL);
 
 static void chirp_dircache_insert( const char *name, struct chirp_stat *info, void *arg )
 {
-	char path[CHIRP_PATH_MAX];
-
-	if(!chirp_dircache) chirp_dircache = hash_table_create(0,0);
-
-	pfs_dir *dir = (pfs_dir *)arg;
-	dir->append(name);
-
-	struct chirp_stat *copy_info = (struct chirp_stat *)malloc(sizeof(*info));
-	*copy_info = *info;
-
-	sprintf(path,"%s/%s",chirp_dircache_path,name);
-
-	hash_table_insert(chirp_dircache,path,copy_info);
-}
-
-static int chirp_dircache_lookup( const char *path, struct chirp_stat *info )
-{
-	struct chirp_stat *value;
-
-	if(!chirp_dircache) chirp_dircache = hash_table_create(0,0);
-
-	value = (struct chirp_stat*) hash_table_lookup(chirp_dircache,path);
-	if(value) {
-		*info = *value;
-		hash_table_remove(chirp_dircache,path);
-		free(value);
-		return 1;
-	} else {
-		return 0;
-	}
+	struct pfs_stat buf;
+	COPY_CSTAT(*info,buf);
+	chirp_dircache.insert(name,&buf,(pfs_dir *)arg);
 }
 
 static void add_to_dir( const char *name, void *arg )
@@ -121,7 +75,7 @@ public:
 	}
 
 	virtual pfs_ssize_t write( const void *data, pfs_size_t length, pfs_off_t offset ) {
-		chirp_dircache_invalidate();
+		chirp_dircache.invalidate(name.path);
 		return chirp_global_pwrite(file,data,length,offset,time(0)+pfs_master_timeout);
 	}
 
@@ -142,22 +96,22 @@ public:
 	}
 
 	virtual int ftruncate( pfs_size_t length ) {
-		chirp_dircache_invalidate();
+		chirp_dircache.invalidate(name.path);
 		return chirp_global_ftruncate(file,length,time(0)+pfs_master_timeout);
 	}
 
 	virtual int fchmod( mode_t mode ) {
-		chirp_dircache_invalidate();
+		chirp_dircache.invalidate(name.path);
 		return chirp_global_fchmod(file,mode,time(0)+pfs_master_timeout);
 	}
 
 	virtual int fchown( uid_t uid, gid_t gid ) {
-		chirp_dircache_invalidate();
+		chirp_dircache.invalidate(name.path);
 		return chirp_global_fchown(file,uid,gid,time(0)+pfs_master_timeout);
 	}
 
 	virtual int fsync() {
-		chirp_dircache_invalidate();
+		chirp_dircache.invalidate(name.path);
 		return chirp_global_flush(file,time(0)+pfs_master_timeout)>=0 ? 0 : -1;
 	}
 
@@ -182,7 +136,9 @@ class pfs_service_chirp : public pfs_service {
 public:
 	virtual pfs_file * open( pfs_name *name, int flags, mode_t mode ) {
 		struct chirp_file *file;		
-		chirp_dircache_invalidate();
+		if((flags&O_ACCMODE)!=O_RDONLY || (flags&(O_CREAT|O_TRUNC))) {
+			chirp_dircache.invalidate(name->path);
+		}
 		file = chirp_global_open(name->hostport,name->rest,flags,mode,time(0)+pfs_master_timeout);
 		if(file) {
 			return new pfs_file_chirp(name,file);
@@ -196,15 +152,19 @@ public:
 		pfs_dir *dir = new pfs_dir(name);
 
 		if(pfs_enable_small_file_optimizations) {
-			chirp_dircache_begin(name->path);
+			chirp_dircache.begin(name->path);
 			result = chirp_global_getlongdir(name->hostport,name->rest,chirp_dircache_insert,dir,time(0)+pfs_master_timeout);
+			if(result>=0) {
+				chirp_dircache.end();
+			} else {
+				chirp_dircache.invalidate(name->path);
+			}
 		} else {
 			result = -1;
 			errno = EINVAL;
 		}
 
 		if(result<0 && (errno==EINVAL||errno==ENOSYS)) {
-			chirp_dircache_invalidate();
 			result = chirp_global_getdir(name->hostport,name->rest,add_to_dir,dir,time(0)+pfs_master_timeout);
 		}
 
@@ -227,12 +187,9 @@ public:
 	virtual int stat( pfs_name *name, struct pfs_stat *buf ) {
 		struct chirp_stat cbuf;
 		int result;
-		if(chirp_dircache_lookup(name->path,&cbuf)) {
-			if(!S_ISLNK(cbuf.cst_mode)) {
-				COPY_CSTAT(cbuf,*buf);
-				return 0;
-			}
-		}
+		result = chirp_dircache.lookup(name->path,buf);
+		if(result<0) return -1;
+		if(result>0 && !S_ISLNK(buf->st_mode)) return 0;
 		result = chirp_global_stat(name->hostport,name->rest,&cbuf,time(0)+pfs_master_timeout); /* BUG: was _lstat */
 		if(result==0) COPY_CSTAT(cbuf,*buf);
 		return result;
@@ -241,18 +198,21 @@ public:
 	virtual int lstat( pfs_name *name, struct pfs_stat *buf ) {
 		struct chirp_stat cbuf;
 		int result;
-		if(chirp_dircache_lookup(name->path,&cbuf)) {
+		result = chirp_dircache.lookup(name->path,buf);
+		if(result!=0) return result>0 ? 0 : -1;
+		result = chirp_global_lstat(name->hostport,name->rest,&cbuf,time(0)+pfs_master_timeout);
+		if(result==0) {
 			COPY_CSTAT(cbuf,*buf);
-			return 0;
+			chirp_dircache.insert(name->path,buf);
+		} else if(errno==ENOENT) {
+			chirp_dircache.insert_missing(name->path);
 		}
-		result = chirp_global_lstat(name->hostport,name->rest,&cbuf,time(0)+pfs_master_timeout);
-		if(result==0) COPY_CSTAT(cbuf,*buf);
 		return result;
 	}
 
 	virtual int unlink( pfs_name *name ) {
 		int result;
-		chirp_dircache_invalidate();
+		chirp_dircache.invalidate_tree(name->path);
 		if(pfs_enable_small_file_optimizations) {
 			result = chirp_global_rmall(name->hostport,name->rest,time(0)+pfs_master_timeout);
 			if(result<0 && errno==ENOSYS) {
@@ -270,26 +230,27 @@ public:
 	}
 
 	virtual int chmod( pfs_name *name, mode_t mode ) {
-		chirp_dircache_invalidate();
+		chirp_dircache.invalidate(name->path);
 		return chirp_global_chmod(name->hostport,name->rest,mode,time(0)+pfs_master_timeout);
 	}
 
 	virtual int chown( pfs_name *name, uid_t uid, gid_t gid ) {
-		chirp_dircache_invalidate();
+		chirp_dircache.invalidate(name->path);
 		return chirp_global_chown(name->hostport,name->rest,uid,gid,time(0)+pfs_master_timeout);
 	}
 
 	virtual int lchown( pfs_name *name, uid_t uid, gid_t gid ) {
-		chirp_dircache_invalidate();
+		chirp_dircache.invalidate(name->path);
 		return chirp_global_lchown(name->hostport,name->rest,uid,gid,time(0)+pfs_master_timeout);
 	}
 
 	virtual int truncate( pfs_name *name, pfs_off_t length ) {
-		chirp_dircache_invalidate();
+		chirp_dircache.invalidate(name->path);
 		return chirp_global_truncate(name->hostport,name->rest,length,time(0)+pfs_master_timeout);
 	}
 
 	virtual int utime( pfs_name *name, struct utimbuf *t ) {
+		chirp_dircache.invalidate(name->path);
 		return chirp_global_utime(name->hostport,name->rest,t->actime,t->modtime,time(0)+pfs_master_timeout);
 	}
 
@@ -297,7 +258,8 @@ public:
 		INT64_T result;
 		time_t stoptime = time(0) + pfs_master_timeout;
 
-		chirp_dircache_invalidate();
+		chirp_dircache.invalidate_tree(name->path);
+		chirp_dircache.invalidate_tree(newname->path);
 
 		if(!strcmp(name->hostport,newname->hostport)) {
 			result = chirp_global_rename(name->hostport,name->rest,newname->rest,stoptime);
@@ -330,12 +292,12 @@ public:
 	}
 
 	virtual int link( pfs_name *name, pfs_name *newname ) {
-		chirp_dircache_invalidate();
+		chirp_dircache.invalidate(newname->path);
 		return chirp_global_link(name->hostport,name->rest,newname->rest,time(0)+pfs_master_timeout);
 	}
 
 	virtual int symlink( const char *linkname, pfs_name *newname ) {
-		chirp_dircache_invalidate();
+		chirp_dircache.invalidate(newname->path);
 		return chirp_global_symlink(newname->hostport,linkname,newname->rest,time(0)+pfs_master_timeout);
 	}
 
@@ -344,13 +306,13 @@ public:
 	}
 
 	virtual int mkdir( pfs_name *name, mode_t mode ) {
-		chirp_dircache_invalidate();
+		chirp_dircache.invalidate(name->path);
 		return chirp_global_mkdir(name->hostport,name->rest,mode,time(0)+pfs_master_timeout);
 	}
 
 	virtual int rmdir( pfs_name *name ) {
 		int result;
-		chirp_dircache_invalidate();
+		chirp_dircache.invalidate_tree(name->path);
 		if(pfs_enable_small_file_optimizations) {
 			result = chirp_global_rmall(name->hostport,name->rest,time(0)+pfs_master_timeout);
 			if(result<0 && errno==ENOSYS) {
@@ -363,12 +325,11 @@ public:
 	}
 
 	virtual int mkalloc( pfs_name *name, pfs_ssize_t size, mode_t mode ) {
-		chirp_dircache_invalidate();
+		chirp_dircache.invalidate(name->path);
 		return chirp_global_mkalloc(name->hostport,name->rest,size,mode,time(0)+pfs_master_timeout);
 	}
 
 	virtual int lsalloc( pfs_name *name, char *alloc_name, pfs_ssize_t *size, pfs_ssize_t *inuse ) {
-		chirp_dircache_invalidate();
 		return chirp_global_lsalloc(name->hostport,name->rest,alloc_name,size,inuse,time(0)+pfs_master_timeout);
 	}
 
@@ -378,7 +339,7 @@ public:
 		FILE *sourcefile;
 		pfs_ssize_t result;
 
-		chirp_dircache_invalidate();
+		chirp_dircache.invalidate(target->path);
 
 		sourcefile = fopen(source->logical_name,"r");
 		if(!sourcefile) return -1;
@@ -403,8 +364,6 @@ public:
 		pfs_ssize_t result;
 		int save_errno;
 
-		chirp_dircache_invalidate();
-
 		targetfile = fopen(target->logical_name,"w");
 		if(!targetfile) return -1;
 
@@ -422,7 +381,7 @@ public:
 	{
 		pfs_ssize_t result;
 
-		chirp_dircache_invalidate();
+		chirp_dircache.invalidate(target->path);
 
 		result = chirp_global_thirdput(source->hostport,source->rest,target->hostport,target->rest,time(0)+pfs_master_timeout);
 		if(result>=0) {
@@ -434,26 +393,23 @@ public:
 
 	virtual int md5( pfs_name *path, unsigned char *digest )
 	{
-		chirp_dircache_invalidate();
 		return chirp_global_md5(path->hostport,path->rest,digest,time(0)+pfs_master_timeout);
 	}
 
 	virtual int whoami( pfs_name *name, char *buf, int size ) {
-		chirp_dircache_invalidate();
 		return chirp_global_whoami(name->hostport,name->rest,buf,size,time(0)+pfs_master_timeout);
 	}
 
 	virtual int getacl( pfs_name *name, char *buf, int size ) {
 		int result;
 		buf[0] = 0;
-		chirp_dircache_invalidate();
 		result = chirp_global_getacl(name->hostport,name->rest,add_to_acl,buf,time(0)+pfs_master_timeout);
 		if(result==0) result = strlen(buf);
 		return result;
 	}
 
 	virtual int setacl( pfs_name *name, const char *subject, const char *rights ) {
-		chirp_dircache_invalidate();
+		chirp_dircache.invalidate(name->path);
 		return chirp_global_setacl(name->hostport,name->rest,subject,rights,time(0)+pfs_master_timeout);
 	}
 	
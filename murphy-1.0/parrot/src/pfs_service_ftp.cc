@@ -5,6 +5,7 @@ This software is distributed under the GNU General Public License.
 See the file COPYING for details.
 */
 
+#include "pfs_dircache.h"
 #include "pfs_table.h"
 #include "pfs_service.h"
 
@@ -29,6 +30,14 @@ extern "C" {
 
 enum ftp_type_t { ANONYMOUS, USERPASS, GLOBUS_GSS };
 
+/*
+A stat costs a CWD and a SIZE, so remember the answers for a while.
+*/
+
+#define FTP_DIRCACHE_TTL 30
+
+static pfs_dircache ftp_dircache(FTP_DIRCACHE_TTL);
+
 class pfs_file_ftp : public pfs_file
 {
 private:
@@ -42,6 +51,7 @@ public:
 	}
 
 	virtual int close() {
+		ftp_dircache.invalidate(name.path);
 		fclose(stream);
 		ftp_lite_done(server);
 		pfs_service_disconnect_cache(&name,server,0);
@@ -53,6 +63,7 @@ public:
 	}
 
 	virtual pfs_ssize_t write( const void *d, pfs_size_t length, pfs_off_t offset ) {
+		ftp_dircache.invalidate(name.path);
 		return ::full_fwrite(stream,d,length);
 	}
 };
@@ -139,6 +150,7 @@ public:
 		FILE *stream=0;
 		pfs_file *result=0;
 		struct ftp_lite_server *server = (struct ftp_lite_server*) pfs_service_connect_cache(name);
+		if((flags&O_ACCMODE)!=O_RDONLY) ftp_dircache.invalidate(name->path);
 		if(server) {
 			if((flags&O_ACCMODE)==O_RDONLY) {
 				stream = ftp_lite_get(server,name->rest,0);
@@ -199,7 +211,10 @@ public:
 	*/
 
 	virtual int stat( pfs_name *name, struct pfs_stat *buf ) {
-		INT64_T result=-1;
+		INT64_T result;
+		result = ftp_dircache.lookup(name->path,buf);
+		if(result!=0) return result>0 ? 0 : -1;
+		result = -1;
 		struct ftp_lite_server *server = (struct ftp_lite_server *)pfs_service_connect_cache(name);
 		if(server) {
 			pfs_service_emulate_stat(name,buf);
@@ -218,6 +233,11 @@ public:
 					result = -1;
 				}
 			}
+			if(result==0) {
+				ftp_dircache.insert(name->path,buf);
+			} else if(errno==ENOENT) {
+				ftp_dircache.insert_missing(name->path);
+			}
 			int invalid = (errno==ECONNRESET);
 			pfs_service_disconnect_cache(name,(void*)server,invalid);
 		}
@@ -257,6 +277,7 @@ public:
 
 	virtual int unlink( pfs_name *name ) {
 		int result=-1;
+		ftp_dircache.invalidate_tree(name->path);
 		struct ftp_lite_server *server = (struct ftp_lite_server *)pfs_service_connect_cache(name);
 		if(server) {
 			if(ftp_lite_delete(server,name->rest)) {
@@ -272,6 +293,8 @@ public:
 
 	virtual int rename( pfs_name *name, pfs_name *newname ) {
 		int result=-1;
+		ftp_dircache.invalidate_tree(name->path);
+		ftp_dircache.invalidate_tree(newname->path);
 		struct ftp_lite_server *server = (struct ftp_lite_server *)pfs_service_connect_cache(name);
 		if(server) {
 			if(ftp_lite_rename(server,name->rest,newname->rest)) {
@@ -287,6 +310,7 @@ public:
 
 	virtual int mkdir( pfs_name *name, mode_t mode ) {
 		int result=-1;
+		ftp_dircache.invalidate(name->path);
 		struct ftp_lite_server *server = (struct ftp_lite_server *)pfs_service_connect_cache(name);
 		if(server) {
 			if(ftp_lite_make_dir(server,name->rest)) {
@@ -302,6 +326,7 @@ public:
 
 	virtual int rmdir( pfs_name *name ) {
 		int result=-1;
+		ftp_dircache.invalidate_tree(name->path);
 		struct ftp_lite_server *server = (struct ftp_lite_server *)pfs_service_connect_cache(name);
 		if(server) {
 			if(ftp_lite_delete_dir(server,name->rest)) {
@@ -38,7 +38,9 @@ extern int pfs_enable_small_file_optimizations;
 
 #define HDFS_END debug(D_HDFS,"= %d %s",(int)result,((result>=0) ? "" : strerror(errno))); return result;
 
-static pfs_dircache hdfs_dircache;
+#define HDFS_DIRCACHE_TTL 5
+
+static pfs_dircache hdfs_dircache(HDFS_DIRCACHE_TTL);
 
 class pfs_file_hdfs : public pfs_file
 {
@@ -64,7 +66,7 @@ public:
 	virtual int fsync() {
 		int result; 
 
-		hdfs_dircache.invalidate();
+		hdfs_dircache.invalidate(name.path);
 
 		debug(D_HDFS, "flushing file %s ", name.rest);
 		result = hdfs->flush(fs, handle);
@@ -82,7 +84,7 @@ public:
 	virtual pfs_ssize_t write( const void *data, pfs_size_t length, pfs_off_t offset ) {
 		pfs_ssize_t result;
 
-		hdfs_dircache.invalidate();
+		hdfs_dircache.invalidate(name.path);
 
 		/* Ignore offset since HDFS does not support seekable writes. */
 		debug(D_HDFS, "writing to file %s ", name.rest);
@@ -220,7 +222,9 @@ public:
 		HDFS_CHECK_INIT(0)
 		HDFS_CHECK_FS(0)
 
-		hdfs_dircache.invalidate();
+		if ((flags&O_ACCMODE) != O_RDONLY || (flags&(O_CREAT|O_TRUNC))) {
+			hdfs_dircache.invalidate(name->path);
+		}
 
 		switch (flags&O_ACCMODE) {
 			case O_RDONLY:
@@ -275,10 +279,6 @@ public:
 		HDFS_CHECK_INIT(0)
 		HDFS_CHECK_FS(0)
 
-		if (pfs_enable_small_file_optimizations) {
-			hdfs_dircache.begin(name->path);
-		}
-
 		debug(D_HDFS, "checking if directory %s exists", name->rest);
 		if (hdfs->exists(fs, name->rest) < 0) {
 			errno = EINVAL;
@@ -286,6 +286,10 @@ public:
 			return 0;
 		}
 
+		if (pfs_enable_small_file_optimizations) {
+			hdfs_dircache.begin(name->path);
+		}
+
 		debug(D_HDFS, "getting directory of %s", name->rest);
 		file_list = hdfs->listdir(fs, name->rest, &num_entries);
 		struct pfs_stat buf;
@@ -300,6 +304,9 @@ public:
 			}
 			
 			hdfs->free_stat(file_list, num_entries);
+			hdfs_dircache.end();
+		} else {
+			hdfs_dircache.invalidate(name->path);
 		}
 		
 		pfs_service_disconnect_cache(name, (void*)fs, (errno == HDFS_EINTERNAL));
@@ -340,16 +347,19 @@ public:
 		int result;
 		hdfsFileInfo *file_info = 0;
 
-		if (hdfs_dircache.lookup(name->rest, buf)) {
+		result = hdfs_dircache.lookup(name->path, buf);
+		if (result > 0) {
 			result = 0;
-		} else {
+		} else if (result == 0) {
 			file_info = hdfs->stat(fs, name->rest);
 
 			if (file_info != NULL) {
 				hdfs_copy_fileinfo(name, file_info, buf);
 				hdfs->free_stat(file_info, 1);
+				hdfs_dircache.insert(name->path, buf);
 				result = 0;
 			} else {
+				hdfs_dircache.insert_missing(name->path);
 				errno = ENOENT;
 				result = -1;
 			}
@@ -402,7 +412,7 @@ public:
 		HDFS_CHECK_INIT(-1)
 		HDFS_CHECK_FS(-1)
 		
-		hdfs_dircache.invalidate();
+		hdfs_dircache.invalidate(name->path);
 		
 		debug(D_HDFS, "mkdir %s", name->rest);
 		result = hdfs->mkdir(fs, name->rest);
@@ -418,7 +428,7 @@ public:
 		HDFS_CHECK_INIT(-1)
 		HDFS_CHECK_FS(-1)
 		
-		hdfs_dircache.invalidate();
+		hdfs_dircache.invalidate_tree(name->path);
 		
 		debug(D_HDFS, "rmdir %s", name->rest);
 		result = hdfs->unlink(fs, name->rest,1);
@@ -434,7 +444,7 @@ public:
 		HDFS_CHECK_INIT(-1)
 		HDFS_CHECK_FS(-1)
 
-		hdfs_dircache.invalidate();
+		hdfs_dircache.invalidate_tree(name->path);
 		
 		debug(D_HDFS, "unlink %s", name->rest);
 		result = hdfs->unlink(fs, name->rest,0);
@@ -450,7 +460,8 @@ public:
 		HDFS_CHECK_INIT(-1)
 		HDFS_CHECK_FS(-1)
 
-		hdfs_dircache.invalidate();
+		hdfs_dircache.invalidate_tree(name->path);
+		hdfs_dircache.invalidate_tree(newname->path);
 		
 		debug(D_HDFS, "rename %s to %s", name->rest, newname->rest);
 		result = hdfs->rename(fs, name->rest, newname->rest);
@@ -5,6 +5,7 @@ This software is distributed under the GNU General Public License.
 See the file COPYING for details.
 */
 
+#include "pfs_dircache.h"
 #include "pfs_service.h"
 
 extern "C" {
@@ -29,9 +30,14 @@ extern "C" {
 #define HTTP_LINE_MAX 4096
 #define HTTP_PORT 80
 #define HTTP_FILE_MODE (S_IFREG | 0555)
+#define HTTP_DIRCACHE_TTL 60
 
 extern int pfs_master_timeout;
 
+/* Remember the answer to each HEAD, including 404. */
+
+static pfs_dircache http_dircache(HTTP_DIRCACHE_TTL);
+
 static struct link * http_fetch( pfs_name *name, const char *action, INT64_T *size )
 {
 	char url[HTTP_LINE_MAX];
@@ -105,6 +111,10 @@ public:
 	virtual int stat( pfs_name *name, struct pfs_stat *buf ) {
 		struct link *link;
 		INT64_T size;
+		int result;
+
+		result = http_dircache.lookup(name->path,buf);
+		if(result!=0) return result>0 ? 0 : -1;
 
 		link = http_fetch(name,"HEAD",&size);
 		if(link) {
@@ -112,8 +122,10 @@ public:
 			pfs_service_emulate_stat(name,buf);
 			buf->st_mode = HTTP_FILE_MODE;
 			buf->st_size = size;
+			http_dircache.insert(name->path,buf);
 			return 0;
 		} else {
+			if(errno==ENOENT) http_dircache.insert_missing(name->path);
 			return -1;
 		}	
 	}
@@ -259,6 +259,13 @@ process to sleep and wait for actual input to become ready.
 		return 0;
 	}
 
+	virtual int get_native_name( char *n )
+	{
+		if(is_a_pipe) return -1;
+		strcpy(n,name.rest);
+		return 0;
+	}
+
 	virtual int is_seekable()
 	{
 		return !is_a_pipe;
@@ -112,6 +112,9 @@ struct pfs_kernel_iovec {
 	UINT64_T  iov_len;
 };
 
+/* the kernel refuses vectored I/O on more iovecs than this */
+#define PFS_IOV_MAX 1024
+
 /*
 Note that the typical libc sigaction places the
 sa_mask field as the second value. This is hard to expand,
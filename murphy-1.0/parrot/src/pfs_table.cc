@@ -17,11 +17,14 @@ See the file COPYING for details.
 #include "pfs_process.h"
 #include "pfs_file_cache.h"
 #include "pfs_file_gzip.h"
+#include "pfs_pathcache.h"
+#include "pfs_poll.h"
 
 extern "C" {
 #include "debug.h"
 #include "stringtools.h"
 #include "macros.h"
+#include "xmalloc.h"
 #include "full_io.h"
 #include "get_canonical_path.h"
 #include "pfs_resolve.h"
@@ -55,44 +58,112 @@ extern int pfs_enable_small_file_optimizations;
 
 extern const char * pfs_initial_working_directory;
 
-pfs_table::pfs_table()
+/*
+The descriptor table is sparse: descriptors are grouped in chunks
+of PFS_FD_CHUNK, and a chunk exists only while one of its
+descriptors is open, so that memory tracks the open descriptors
+rather than the descriptor limit.  Each chunk has a bit per open
+descriptor, and the table a bit per full chunk, so that the lowest
+free descriptor is found by a bit scan.  After fork, parent and
+child share their chunks, and a chunk is copied only when one of
+them changes it.  A chunk, rather than a table, holds a reference
+to each of its pointers and files.
+*/
+
+#define PFS_FD_CHUNK 64
+
+struct pfs_fd_slot {
+	pfs_pointer *pointer;
+	int flags;
+	int native_fd;
+};
+
+class pfs_fd_chunk : public pfs_refcount {
+public:
+	pfs_fd_chunk() {
+		used = 0;
+		for(int i=0;i<PFS_FD_CHUNK;i++) {
+			slots[i].pointer = 0;
+			slots[i].flags = 0;
+			slots[i].native_fd = -1;
+		}
+	}
+
+	UINT64_T used;
+	struct pfs_fd_slot slots[PFS_FD_CHUNK];
+};
+
+static int pointer_release( pfs_pointer *p )
 {
-	int i;
+	pfs_file *f = p->file;
+	int result = 0;
+
+	if(f->refs()==1) {
+		int rfd = f->get_real_fd();
+		if(rfd>=0) pfs_poll_closed(rfd);
+		result = f->close();
+		delete f;
+	} else {
+		f->delref();
+	}
+
+	if(p->refs()==1) {
+		delete p;
+	} else {
+		p->delref();
+	}
+
+	return result;
+}
+
+static void chunk_release( pfs_fd_chunk *c )
+{
+	if(c->refs()>1) {
+		c->delref();
+		return;
+	}
 
+	for(int i=0;i<PFS_FD_CHUNK;i++) {
+		if(c->slots[i].pointer) pointer_release(c->slots[i].pointer);
+	}
+	delete c;
+}
+
+pfs_table::pfs_table()
+{
 	if(pfs_initial_working_directory) {
 		strcpy(working_dir,pfs_initial_working_directory);
 	} else {
 		::getcwd(working_dir,sizeof(working_dir));
 	}
-	pointer_count = sysconf(_SC_OPEN_MAX);
-	pointers = new pfs_pointer* [pointer_count];
-	fd_flags = new int[pointer_count];
-
-	for( i=0; i<pointer_count; i++ ) {
-		pointers[i] = 0;
-		fd_flags[i] = 0;
-  	}
+	fd_limit = sysconf(_SC_OPEN_MAX);
+	chunk_count = 0;
+	chunks = 0;
+	full_chunks = 0;
 }
 
 pfs_table::~pfs_table()
 {
-	for(int i=0;i<pointer_count;i++) {
-		this->close(i);
+	for(int i=0;i<chunk_count;i++) {
+		if(chunks[i]) chunk_release(chunks[i]);
 	}
-	delete [] pointers;
-	delete [] fd_flags;
+	free(chunks);
+	free(full_chunks);
 }
 
 pfs_table * pfs_table::fork()
 {
 	pfs_table *table = new pfs_table;
 
-	for(int i=0;i<pointer_count;i++) {
-		if(this->pointers[i]) {
-			table->fd_flags[i] = this->fd_flags[i];
-			table->pointers[i] = this->pointers[i];
-			this->pointers[i]->addref();
-			this->pointers[i]->file->addref();
+	if(chunk_count>0) {
+		int words = (chunk_count+63)/64;
+		table->chunk_count = chunk_count;
+		table->chunks = (pfs_fd_chunk **) xxmalloc(sizeof(*chunks)*chunk_count);
+		table->full_chunks = (UINT64_T *) xxmalloc(sizeof(*full_chunks)*words);
+		memcpy(table->chunks,chunks,sizeof(*chunks)*chunk_count);
+		memcpy(table->full_chunks,full_chunks,sizeof(*full_chunks)*words);
+		for(int i=0;i<chunk_count;i++) {
+			if(chunks[i]) chunks[i]->addref();
 		}
 	}
 
@@ -101,14 +172,123 @@ pfs_table * pfs_table::fork()
 	return table;
 }
 
+pfs_pointer * pfs_table::get_pointer( int fd )
+{
+	struct pfs_fd_slot *s = get_slot(fd);
+	return s ? s->pointer : 0;
+}
+
+struct pfs_fd_slot * pfs_table::get_slot( int fd )
+{
+	pfs_fd_chunk *c;
+
+	if(fd<0 || fd>=chunk_count*PFS_FD_CHUNK) return 0;
+	c = chunks[fd/PFS_FD_CHUNK];
+	if(!c) return 0;
+	return &c->slots[fd%PFS_FD_CHUNK];
+}
+
+/*
+Return the slot for fd in a chunk that only this table refers to,
+creating the chunk or copying a shared one as needed.
+*/
+
+struct pfs_fd_slot * pfs_table::writable_slot( int fd )
+{
+	int n = fd/PFS_FD_CHUNK;
+	pfs_fd_chunk *c;
+
+	if(n>=chunk_count) {
+		int count = chunk_count ? chunk_count : 1;
+		while(count<=n) count *= 2;
+		int words = (chunk_count+63)/64;
+		int newwords = (count+63)/64;
+		chunks = (pfs_fd_chunk **) xxrealloc(chunks,sizeof(*chunks)*count);
+		full_chunks = (UINT64_T *) xxrealloc(full_chunks,sizeof(*full_chunks)*newwords);
+		memset(&chunks[chunk_count],0,sizeof(*chunks)*(count-chunk_count));
+		memset(&full_chunks[words],0,sizeof(*full_chunks)*(newwords-words));
+		chunk_count = count;
+	}
+
+	c = chunks[n];
+	if(!c) {
+		c = chunks[n] = new pfs_fd_chunk;
+	} else if(c->refs()>1) {
+		pfs_fd_chunk *copy = new pfs_fd_chunk;
+		copy->used = c->used;
+		memcpy(copy->slots,c->slots,sizeof(c->slots));
+		for(int i=0;i<PFS_FD_CHUNK;i++) {
+			pfs_pointer *p = copy->slots[i].pointer;
+			if(p) {
+				p->addref();
+				p->file->addref();
+			}
+		}
+		c->delref();
+		c = chunks[n] = copy;
+	}
+
+	return &c->slots[fd%PFS_FD_CHUNK];
+}
+
+/*
+Put a pointer in slot fd, or empty it if p is null, with fresh
+flags.  The caller must already have released what was there.
+*/
+
+void pfs_table::set_pointer( int fd, pfs_pointer *p )
+{
+	int n = fd/PFS_FD_CHUNK;
+	UINT64_T bit = ((UINT64_T)1)<<(fd%PFS_FD_CHUNK);
+	struct pfs_fd_slot *s;
+	pfs_fd_chunk *c;
+
+	if(fd<0 || fd>=fd_limit) return;
+	if(!p && !get_slot(fd)) return;
+
+	s = writable_slot(fd);
+	s->pointer = p;
+	s->flags = 0;
+	s->native_fd = -1;
+
+	c = chunks[n];
+	if(p) {
+		c->used |= bit;
+	} else {
+		c->used &= ~bit;
+	}
+
+	if(c->used==~(UINT64_T)0) {
+		full_chunks[n/64] |= ((UINT64_T)1)<<(n%64);
+	} else {
+		full_chunks[n/64] &= ~(((UINT64_T)1)<<(n%64));
+	}
+
+	if(!c->used) {
+		delete c;
+		chunks[n] = 0;
+	}
+}
+
 void pfs_table::close_on_exec()
 {
-	int i;
-	for(i=0;i<pointer_count;i++) {
-		if(this->pointers[i]) {
-			if((this->fd_flags[i])&FD_CLOEXEC) {
-				this->close(i);
+	for(int n=0;n<chunk_count;n++) {
+		pfs_fd_chunk *c = chunks[n];
+		if(!c) continue;
+		UINT64_T used = c->used;
+		while(used) {
+			int i = __builtin_ctzll(used);
+			int fd = n*PFS_FD_CHUNK+i;
+			struct pfs_fd_slot *s = &c->slots[i];
+			used &= used-1;
+			if(s->flags&FD_CLOEXEC) {
+				this->close(fd);
+			} else if(s->native_fd>=0) {
+				/* the tracee opens its native descriptors close-on-exec */
+				writable_slot(fd)->native_fd = -1;
 			}
+			c = chunks[n];
+			if(!c) break;
 		}
 	}
 }
@@ -120,8 +300,7 @@ to this physical file descriptor in the tracing process.
 
 void pfs_table::attach( int logical, int physical, int flags, mode_t mode, const char *name )
 {
-	pointers[logical] = new pfs_pointer(pfs_file_bootstrap(physical,name),flags,mode);
-	fd_flags[logical] = 0;
+	set_pointer(logical,new pfs_pointer(pfs_file_bootstrap(physical,name),flags,mode));
 }
 
 
@@ -129,14 +308,53 @@ void pfs_table::attach( int logical, int physical, int flags, mode_t mode, const
 
 int pfs_table::find_empty( int lowest )
 {
-	int fd;
+	int n, fd;
 
-	for( fd=lowest; fd<pointer_count; fd++ ) {
-		if( !pointers[fd] ) {
-			return fd;
+	if(lowest<0) lowest = 0;
+	n = lowest/PFS_FD_CHUNK;
+
+	if(n>=chunk_count || !chunks[n]) {
+		fd = lowest;
+	} else {
+		UINT64_T free_fds = ~chunks[n]->used & (~(UINT64_T)0 << (lowest%PFS_FD_CHUNK));
+		if(free_fds) {
+			fd = n*PFS_FD_CHUNK + __builtin_ctzll(free_fds);
+		} else {
+			fd = chunk_count*PFS_FD_CHUNK;
+			for(n=n+1;n<chunk_count;) {
+				UINT64_T open_chunks = ~full_chunks[n/64] & (~(UINT64_T)0 << (n%64));
+				if(open_chunks) {
+					n = (n/64)*64 + __builtin_ctzll(open_chunks);
+					if(n<chunk_count) {
+						fd = n*PFS_FD_CHUNK;
+						if(chunks[n]) fd += __builtin_ctzll(~chunks[n]->used);
+					}
+					break;
+				}
+				n = (n/64+1)*64;
+			}
 		}
 	}
 
+	if(fd>=fd_limit) return -1;
+	return fd;
+}
+
+/* Chose the lowest numbered file descriptor that is open, or -1 if none. */
+
+int pfs_table::next_open( int lowest )
+{
+	int n;
+
+	if(lowest<0) lowest = 0;
+
+	for(n=lowest/PFS_FD_CHUNK;n<chunk_count;n++) {
+		if(!chunks[n]) continue;
+		UINT64_T open_fds = chunks[n]->used;
+		if(n==lowest/PFS_FD_CHUNK) open_fds &= ~(UINT64_T)0 << (lowest%PFS_FD_CHUNK);
+		if(open_fds) return n*PFS_FD_CHUNK + __builtin_ctzll(open_fds);
+	}
+
 	return -1;
 }
 
@@ -381,7 +599,7 @@ int pfs_table::open( const char *lname, int flags, mode_t mode, int force_cache
 	if(result>=0) {
 		file = open_object(lname,flags,mode,force_cache);
 		if(file) {
-			pointers[result] = new pfs_pointer(file,flags,mode);
+			set_pointer(result,new pfs_pointer(file,flags,mode));
 			if(flags&O_APPEND) this->lseek(result,0,SEEK_END);
 		} else {
 			result = -1;
@@ -395,8 +613,6 @@ int pfs_table::open( const char *lname, int flags, mode_t mode, int force_cache
 		strcpy(pfs_current->tty,lname);
 	}
 
-	if(result>=0) fd_flags[result] = 0;
-
 	return result;
 }
 
@@ -413,11 +629,8 @@ int pfs_table::pipe( int *fds )
 		::fcntl(rfds[0],F_SETFL,O_NONBLOCK);
 		::fcntl(rfds[1],F_SETFL,O_NONBLOCK);
 
-		pointers[fds[0]] = new pfs_pointer(pfs_file_bootstrap(rfds[0],"rpipe"),O_RDONLY,0777);
-		pointers[fds[1]] = new pfs_pointer(pfs_file_bootstrap(rfds[1],"wpipe"),O_WRONLY,0777);
-
-		fd_flags[fds[0]] = 0;
-		fd_flags[fds[1]] = 0;
+		set_pointer(fds[0],new pfs_pointer(pfs_file_bootstrap(rfds[0],"rpipe"),O_RDONLY,0777));
+		set_pointer(fds[1],new pfs_pointer(pfs_file_bootstrap(rfds[1],"wpipe"),O_WRONLY,0777));
 	}
 
 	return result;
@@ -425,33 +638,85 @@ int pfs_table::pipe( int *fds )
 
 int pfs_table::get_real_fd( int fd )
 {
-	if( (fd<0) || (fd>=pointer_count) || (pointers[fd]==0) ) {
+	if( !get_pointer(fd) ) {
 		errno = EBADF;
 		return -1;
 	}
 
-	return pointers[fd]->file->get_real_fd();
+	return get_pointer(fd)->file->get_real_fd();
 }
 
 int pfs_table::get_full_name( int fd, char *name )
 {
-	if( (fd<0) || (fd>=pointer_count) || (pointers[fd]==0) ) {
+	if( !get_pointer(fd) ) {
 		errno = EBADF;
 		return -1;
 	}
 
-	strcpy(name,pointers[fd]->file->get_name()->path);
+	strcpy(name,get_pointer(fd)->file->get_name()->path);
 	return 0;
 }
 
 int pfs_table::get_local_name( int fd, char *name )
 {
-	if( (fd<0) || (fd>=pointer_count) || (pointers[fd]==0) ) {
+	if( !get_pointer(fd) ) {
 		errno = EBADF;
 		return -1;
 	}
 
-	return pointers[fd]->file->get_local_name(name);
+	return get_pointer(fd)->file->get_local_name(name);
+}
+
+int pfs_table::get_native_name( int fd, char *name )
+{
+	if( !get_pointer(fd) ) {
+		errno = EBADF;
+		return -1;
+	}
+
+	return get_pointer(fd)->file->get_native_name(name);
+}
+
+/*
+A tracee may hold a descriptor of its own for a plain local file
+that it opened through us.  Reads and writes on the logical fd
+may then be carried out by the tracee directly on that descriptor,
+at the offset kept here.  The mapping is dropped whenever the
+logical fd is closed or replaced, and is not given to duplicates,
+since the tracee holds just one native descriptor for it.
+*/
+
+int pfs_table::get_native_fd( int fd )
+{
+	if( !get_pointer(fd) ) {
+		return -1;
+	}
+
+	return get_slot(fd)->native_fd;
+}
+
+void pfs_table::set_native_fd( int fd, int nfd )
+{
+	if( !get_pointer(fd) ) {
+		return;
+	}
+
+	writable_slot(fd)->native_fd = nfd;
+}
+
+/*
+The offset of fd may be moved by another process at the same time
+if its pointer is shared with a duplicate, with a child that has
+not yet parted from us, or with a thread sharing this table.
+*/
+
+int pfs_table::is_pointer_shared( int fd )
+{
+	struct pfs_fd_slot *s = get_slot(fd);
+
+	if(!s || !s->pointer) return 0;
+
+	return refs()>1 || chunks[fd/PFS_FD_CHUNK]->refs()>1 || s->pointer->refs()>1;
 }
 
 /*
@@ -471,20 +736,25 @@ int pfs_table::select( int n, fd_set *r, fd_set *w, fd_set *e, struct timeval *t
 	FD_ZERO(&out_w);
 	FD_ZERO(&out_e);
 
-	if(n>pointer_count) n = pointer_count;
+	if(n>fd_limit) n = fd_limit;
 
 	for(i=0;i<n;i++) {
-		if(!pointers[i]) continue;
-
 		int wantflags = 0;
 		if(r && FD_ISSET(i,r)) wantflags|=PFS_POLL_READ;
 		if(w && FD_ISSET(i,w)) wantflags|=PFS_POLL_WRITE;
 		if(e && FD_ISSET(i,e)) wantflags|=PFS_POLL_EXCEPT;
 		if(!wantflags) continue;
+
+		/* as in the kernel, and how a waiter learns that another thread closed its fd */
+		if(!get_pointer(i)) {
+			pfs_current->seltime.tv_sec=0;
+			errno = EBADF;
+			return -1;
+		}
 		debug(D_POLL,"fd %d want  %s",i,pfs_poll_string(wantflags));
 
-		int flags = pointers[i]->file->poll_ready();
-		pfs_file *f = pointers[i]->file;
+		int flags = get_pointer(i)->file->poll_ready();
+		pfs_file *f = get_pointer(i)->file;
 		debug(D_POLL,"fd %d ready %s %s",i,pfs_poll_string(flags),f->get_name()->path);
 
 		if(wantflags&PFS_POLL_READ && flags&PFS_POLL_READ) {
@@ -557,12 +827,12 @@ int pfs_table::select( int n, fd_set *r, fd_set *w, fd_set *e, struct timeval *t
 			if(e) FD_ZERO(e);
 		} else {
 			for(i=0;i<n;i++) {
-				if(!pointers[i]) continue;
+				if(!get_pointer(i)) continue;
 				int flags=0;
 				if(r && FD_ISSET(i,r)) flags|=PFS_POLL_READ;
 				if(w && FD_ISSET(i,w)) flags|=PFS_POLL_WRITE;
 				if(e && FD_ISSET(i,e)) flags|=PFS_POLL_EXCEPT;
-				if(flags) pointers[i]->file->poll_register(flags);
+				if(flags) get_pointer(i)->file->poll_register(flags);
 			}
 		}
 	}
@@ -589,7 +859,7 @@ int pfs_table::poll( struct pollfd *ufds, unsigned int nfds, int timeout )
 
 	for(i=0;i<nfds;i++) {
 		int fd = ufds[i].fd;
-		if(fd<0 || fd>=pointer_count || pointers[fd]==0) {
+		if(!get_pointer(fd)) {
 			continue;
 			/* will fill in POLLNVAL later */
 		} else {
@@ -612,7 +882,7 @@ int pfs_table::poll( struct pollfd *ufds, unsigned int nfds, int timeout )
 		for(i=0;i<nfds;i++) {
 			int fd = ufds[i].fd;
 			ufds[i].revents = 0;
-			if(fd<0 || fd>=pointer_count || pointers[fd]==0) {
+			if(!get_pointer(fd)) {
 				ufds[i].revents |= POLLNVAL;
 				continue;
 			}
@@ -638,30 +908,13 @@ int pfs_table::close( int fd )
 {
 	int result = -1;
 
-	if( (fd<0) || (fd>=pointer_count) || (pointers[fd]==0) ) {
+	if( !get_pointer(fd) ) {
 		result = -1;
 		errno = EBADF;
 	} else {
-		pfs_pointer *p = pointers[fd];
-		pfs_file *f = p->file;
-
-		result = 0;
-
-		if(f->refs()==1) {
-			result = f->close();
-			delete f;
-		} else {
-			f->delref();
-		}
-
-		if(p->refs()==1) {
-			delete p;
-		} else {
-			p->delref();
-		}
-
-		pointers[fd]=0;
-		fd_flags[fd]=0;
+		pfs_pointer *p = get_pointer(fd);
+		set_pointer(fd,0);
+		result = pointer_release(p);
 	}
 	return result;
 }
@@ -670,12 +923,12 @@ pfs_ssize_t pfs_table::read( int fd, void *data, pfs_size_t nbyte )
 {
 	pfs_ssize_t result = -1;
 
-	if( (fd<0) || (fd>=pointer_count) || (pointers[fd]==0) ) {
+	if( !get_pointer(fd) ) {
 		errno = EBADF;
 		result = -1;
 	} else {
-		result = this->pread(fd,data,nbyte,pointers[fd]->tell());
-		if(result>0) pointers[fd]->bump(result);
+		result = this->pread(fd,data,nbyte,get_pointer(fd)->tell());
+		if(result>0) get_pointer(fd)->bump(result);
 	}
 
 	return result;
@@ -685,12 +938,12 @@ pfs_ssize_t pfs_table::write( int fd, const void *data, pfs_size_t nbyte )
 {
 	pfs_ssize_t result = -1;
 
-	if( (fd<0) || (fd>=pointer_count) || (pointers[fd]==0) ) {
+	if( !get_pointer(fd) ) {
 		errno = EBADF;
 		result = -1;
 	} else {
-		result = this->pwrite(fd,data,nbyte,pointers[fd]->tell());
-		if(result>0) pointers[fd]->bump(result);
+		result = this->pwrite(fd,data,nbyte,get_pointer(fd)->tell());
+		if(result>0) get_pointer(fd)->bump(result);
 	}
 
 	return result;
@@ -709,14 +962,14 @@ static void stream_warning( pfs_file *f )
 
 pfs_off_t pfs_table::get_fd_offset( int fd )
 {
-	return pointers[fd]->file->get_last_offset();
+	return get_pointer(fd)->file->get_last_offset();
 }
 
 pfs_ssize_t pfs_table::pread( int fd, void *data, pfs_size_t nbyte, pfs_off_t offset )
 {
 	pfs_ssize_t result = -1;
 
-	if( (fd<0) || (fd>=pointer_count) || (pointers[fd]==0) ) {
+	if( !get_pointer(fd) ) {
 		errno = EBADF;
 		result = -1;
 	} else if( (!data) || (nbyte<0) ) {
@@ -725,7 +978,7 @@ pfs_ssize_t pfs_table::pread( int fd, void *data, pfs_size_t nbyte, pfs_off_t of
 	} else if( nbyte==0 ) {
 		result = 0;
 	} else {
-		pfs_file *f = pointers[fd]->file;
+		pfs_file *f = get_pointer(fd)->file;
 		if(!f->is_seekable() && f->get_last_offset()!=offset) {
 			stream_warning(f);
 			errno = ESPIPE;
@@ -743,7 +996,7 @@ pfs_ssize_t pfs_table::pwrite( int fd, const void *data, pfs_size_t nbyte, pfs_o
 {
 	pfs_ssize_t result = -1;
 
-	if( (fd<0) || (fd>=pointer_count) || (pointers[fd]==0) ) {
+	if( !get_pointer(fd) ) {
 		errno = EBADF;
 		result = -1;
 	} else if( (!data) || (nbyte<0) ) {
@@ -752,7 +1005,7 @@ pfs_ssize_t pfs_table::pwrite( int fd, const void *data, pfs_size_t nbyte, pfs_o
 	} else if( nbyte==0 ) {
 		result = 0;
 	} else {
-		pfs_file *f = pointers[fd]->file;
+		pfs_file *f = get_pointer(fd)->file;
 		if(!f->is_seekable() && f->get_last_offset()!=offset) {
 			stream_warning(f);
 			errno = ESPIPE;
@@ -806,11 +1059,11 @@ pfs_off_t pfs_table::lseek( int fd, pfs_off_t offset, int whence )
 	pfs_pointer *p;
 	pfs_off_t result = -1;
 
-	if( (fd<0) || (fd>=pointer_count) || (pointers[fd]==0) ) {
+	if( !get_pointer(fd) ) {
 		errno = EBADF;
 		result = -1;
 	} else {
-		p = pointers[fd];
+		p = get_pointer(fd);
 		f = p->file;
 		if(!f->is_seekable()) {
 			errno = ESPIPE;
@@ -832,15 +1085,14 @@ int pfs_table::search_dup2( int fd, int search )
 {
 	int i;
 
-	if( (fd<0) || (fd>=pointer_count) || (pointers[fd]==0) || (search<0) || (search>=pointer_count) ) {
+	if( !get_pointer(fd) || (search<0) || (search>=fd_limit) ) {
 		errno = EBADF;
 		return -1;
 	}
 
-	for( i=search; i<pointer_count; i++ )
-		if(!pointers[i]) break;
+	i = find_empty(search);
 
-	if( i==pointer_count ) {
+	if( i<0 ) {
 		errno = EMFILE;
 		return -1;
 	} else {
@@ -852,10 +1104,10 @@ int pfs_table::dup2( int ofd, int nfd )
 {
 	int result=-1;
 
-	if( (nfd<0) || (nfd>=pointer_count) ) {
+	if( (nfd<0) || (nfd>=fd_limit) ) {
 		errno = EBADF;
 		result = -1;
-	} else if( (ofd<0) || (ofd>=pointer_count) || (pointers[ofd]==0) ) {
+	} else if( !get_pointer(ofd) ) {
 		errno = EBADF;
 		result = -1;
 	} else if( ofd==nfd ) {
@@ -866,17 +1118,17 @@ int pfs_table::dup2( int ofd, int nfd )
 		// But, close _can_ fail!  If that happens,
 		// abort the dup with the errno from the close.
 
-		if( pointers[nfd]!=0 ) {
+		if( get_pointer(nfd) ) {
 			result = this->close(nfd);
 		} else {
 			result = 0;
 		}
 
 		if(result==0) {
-			pointers[nfd] = pointers[ofd];
-			pointers[nfd]->addref();
-			pointers[nfd]->file->addref();
-			fd_flags[nfd] = 0;
+			pfs_pointer *p = get_pointer(ofd);
+			p->addref();
+			p->file->addref();
+			set_pointer(nfd,p);
 			result = nfd;
 		}
 	}
@@ -888,11 +1140,11 @@ int pfs_table::fchdir( int fd )
 {
 	int result = -1;
 
-	if( (fd<0) || (fd>=pointer_count) || (pointers[fd]==0) ) {
+	if( !get_pointer(fd) ) {
 		errno = EBADF;
 		result = -1;
 	} else {
-		pfs_name *pname = pointers[fd]->file->get_name();
+		pfs_name *pname = get_pointer(fd)->file->get_name();
 		result = this->chdir(pname->path);
 	}
 
@@ -903,14 +1155,14 @@ int pfs_table::ftruncate( int fd, pfs_off_t size )
 {
 	int result = -1;
 
-	if( (fd<0) || (fd>=pointer_count) || (pointers[fd]==0) ) {
+	if( !get_pointer(fd) ) {
 		errno = EBADF;
 		result = -1;
 	} else {
 		if( size<0 ) {
 			result = 0;
 		} else {
-			result = pointers[fd]->file->ftruncate(size);
+			result = get_pointer(fd)->file->ftruncate(size);
 		}
 	}
 
@@ -921,11 +1173,11 @@ int pfs_table::fstat( int fd, struct pfs_stat *b )
 {
 	int result;
 
-	if( (fd<0) || (fd>=pointer_count) || (pointers[fd]==0) ) {
+	if( !get_pointer(fd) ) {
 		errno = EBADF;
 		result = -1;
 	} else {
-		pfs_file *file = pointers[fd]->file;
+		pfs_file *file = get_pointer(fd)->file;
 		result = file->fstat(b);
 		if(result>=0) {
 			b->st_blksize = pfs_service_get_block_size();
@@ -940,11 +1192,11 @@ int pfs_table::fstatfs( int fd, struct pfs_statfs *buf )
 {
 	int result;
 
-	if( (fd<0) || (fd>=pointer_count) || (pointers[fd]==0) ) {
+	if( !get_pointer(fd) ) {
 		errno = EBADF;
 		result = -1;
 	} else {
-		result = pointers[fd]->file->fstatfs(buf);
+		result = get_pointer(fd)->file->fstatfs(buf);
 	}
 
 
@@ -956,11 +1208,11 @@ int pfs_table::fsync( int fd )
 {
 	int result;
 
-	if( (fd<0) || (fd>=pointer_count) || (pointers[fd]==0) ) {
+	if( !get_pointer(fd) ) {
 		errno = EBADF;
 		result = -1;
 	} else {
-		result = pointers[fd]->file->fsync();
+		result = get_pointer(fd)->file->fsync();
 	}
 
 
@@ -971,11 +1223,11 @@ int pfs_table::flock( int fd, int op )
 {
 	int result = -1;
 
-	if( (fd<0) || (fd>=pointer_count) || (pointers[fd]==0) ) {
+	if( !get_pointer(fd) ) {
 		errno = EBADF;
 		result = -1;
 	} else {
-       		result = pointers[fd]->file->flock(op);
+       		result = get_pointer(fd)->file->flock(op);
 	}
 
 
@@ -987,25 +1239,25 @@ int pfs_table::fcntl( int fd, int cmd, void *arg )
 	int result;
 	int flags;
 
-	if( (fd<0) || (fd>=pointer_count) || (pointers[fd]==0) ) {
+	if( !get_pointer(fd) ) {
 		errno = EBADF;
 		result = -1;
 	} else switch(cmd) {
 		case F_GETFD:
-			result = fd_flags[fd];
+			result = get_slot(fd)->flags;
 			break;
 		case F_SETFD:
-			fd_flags[fd] = (PTRINT_T)arg;
+			writable_slot(fd)->flags = (PTRINT_T)arg;
 			result = 0;
 			break;
 		case F_GETFL:
-			result = pointers[fd]->flags;
+			result = get_pointer(fd)->flags;
 			break;
 		case F_SETFL:
 			flags = (PTRINT_T)arg;
-			pointers[fd]->flags = flags;
+			get_pointer(fd)->flags = flags;
 			flags |= O_NONBLOCK;
-			pointers[fd]->file->fcntl(cmd,(void*)(PTRINT_T)flags);
+			get_pointer(fd)->file->fcntl(cmd,(void*)(PTRINT_T)flags);
 			result = 0;
 			break;
 
@@ -1058,7 +1310,7 @@ int pfs_table::fcntl( int fd, int cmd, void *arg )
 		#endif
 
 		default:
-			result = pointers[fd]->file->fcntl(cmd,arg);
+			result = get_pointer(fd)->file->fcntl(cmd,arg);
 			break;
 	}
 
@@ -1070,11 +1322,11 @@ int pfs_table::ioctl( int fd, int cmd, void *arg )
 {
 	int result;
 
-	if( (fd<0) || (fd>=pointer_count) || (pointers[fd]==0) ) {
+	if( !get_pointer(fd) ) {
 		errno = EBADF;
 		result = -1;
 	} else {
-		result = pointers[fd]->file->ioctl(cmd,arg);
+		result = get_pointer(fd)->file->ioctl(cmd,arg);
 	}
 
 
@@ -1085,11 +1337,11 @@ int pfs_table::fchmod( int fd, mode_t mode )
 {
 	int result;
 
-	if( (fd<0) || (fd>=pointer_count) || (pointers[fd]==0) ) {
+	if( !get_pointer(fd) ) {
 		errno = EBADF;
 		result = -1;
 	} else {
-		result = pointers[fd]->file->fchmod(mode);
+		result = get_pointer(fd)->file->fchmod(mode);
 	}
 
 	return result;
@@ -1102,11 +1354,11 @@ int pfs_table::fchown( int fd, uid_t uid, gid_t gid )
 {
 	int result;
 
-	if( (fd<0) || (fd>=pointer_count) || (pointers[fd]==0) ) {
+	if( !get_pointer(fd) ) {
 		errno = EBADF;
 		result = -1;
 	} else {
-		result = pointers[fd]->file->fchown(uid,gid);
+		result = get_pointer(fd)->file->fchown(uid,gid);
 	}
 
 	/*
@@ -1257,6 +1509,7 @@ int pfs_table::unlink( const char *n )
 	int result = -1;
 
 	if(resolve_name(n,&pname,false)) {
+		pfs_pathcache_invalidate(pname.logical_name);
 		result = pname.service->unlink(&pname);
 		if(result==0) pfs_cache_invalidate(&pname);
 	}
@@ -1321,6 +1574,8 @@ int pfs_table::rename( const char *n1, const char *n2 )
 
 	if(resolve_name(n1,&p1,false) && resolve_name(n2,&p2,false)) {
 		if(p1.service==p2.service) {
+			pfs_pathcache_invalidate(p1.logical_name);
+			pfs_pathcache_invalidate(p2.logical_name);
 			result = p1.service->rename(&p1,&p2);
 			if(result==0) {
 				pfs_cache_invalidate(&p1);
@@ -1365,6 +1620,7 @@ int pfs_table::symlink( const char *n1, const char *n2 )
 	*/
 
 	if(resolve_name(n2,&pname,false)) {
+		pfs_pathcache_invalidate(pname.logical_name);
 		result = pname.service->symlink(n1,&pname);
 	}
 
@@ -1431,6 +1687,7 @@ int pfs_table::rmdir( const char *n )
 	int result=-1;
 
 	if(resolve_name(n,&pname,false)) {
+		pfs_pathcache_invalidate(pname.logical_name);
 		result = pname.service->rmdir(&pname);
 	}
 
@@ -1441,12 +1698,12 @@ struct dirent * pfs_table::fdreaddir( int fd )
 {
 	struct dirent * result;
 
-	if( (fd<0) || (fd>=pointer_count) || (pointers[fd]==0) ) {
+	if( !get_pointer(fd) ) {
 		errno = EBADF;
 		result = 0;
 	} else {
 		pfs_off_t next_offset;
-		pfs_pointer *fp = pointers[fd];
+		pfs_pointer *fp = get_pointer(fd);
 		result = fp->file->fdreaddir(fp->tell(),&next_offset);
 		if(result) fp->seek(next_offset,SEEK_SET);
 	}
@@ -1464,8 +1721,7 @@ int pfs_table::socket( int domain, int type, int protocol )
 	if(rfd>=0) {
 		::fcntl(rfd,F_SETFL,O_NONBLOCK);
 		result = find_empty(0);
-		pointers[result] = new pfs_pointer(pfs_file_bootstrap(rfd,"socket"),O_RDWR,0777);
-		fd_flags[result] = 0;
+		set_pointer(result,new pfs_pointer(pfs_file_bootstrap(rfd,"socket"),O_RDWR,0777));
 	} else {
 		result = -1;
 	}
@@ -1487,11 +1743,8 @@ int pfs_table::socketpair( int domain, int type, int protocol, int *fds )
 		::fcntl(rfds[0],F_SETFL,O_NONBLOCK);
 		::fcntl(rfds[1],F_SETFL,O_NONBLOCK);
 
-		pointers[fds[0]] = new pfs_pointer(pfs_file_bootstrap(rfds[0],"socketpair"),O_RDWR,0777);
-		pointers[fds[1]] = new pfs_pointer(pfs_file_bootstrap(rfds[1],"socketpair"),O_RDWR,0777);
-
-		fd_flags[fds[0]] = 0;
-		fd_flags[fds[1]] = 0;
+		set_pointer(fds[0],new pfs_pointer(pfs_file_bootstrap(rfds[0],"socketpair"),O_RDWR,0777));
+		set_pointer(fds[1],new pfs_pointer(pfs_file_bootstrap(rfds[1],"socketpair"),O_RDWR,0777));
 	}
 
 	return result;
@@ -1505,9 +1758,8 @@ int pfs_table::accept( int fd, struct sockaddr *addr, int *addrlen )
 	rfd = ::accept(get_real_fd(fd),addr,(socklen_t*)addrlen);
 	if(rfd>=0) {
 		result = find_empty(0);
-		pointers[result] = new pfs_pointer(pfs_file_bootstrap(rfd,"socket"),O_RDWR,0777);
+		set_pointer(result,new pfs_pointer(pfs_file_bootstrap(rfd,"socket"),O_RDWR,0777));
 		::fcntl(rfd,F_SETFL,O_NONBLOCK);
-		fd_flags[rfd] = 0;
 	} else {
 		result = -1;
 	}
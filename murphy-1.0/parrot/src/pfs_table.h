@@ -15,6 +15,8 @@ See the file COPYING for details.
 class pfs_file;
 class pfs_pointer;
 class pfs_service;
+class pfs_fd_chunk;
+struct pfs_fd_slot;
 
 #define PFS_MAX_RESOLVE_DEPTH	8
 
@@ -62,8 +64,14 @@ public:
 	int	get_real_fd( int fd );
 	int	get_full_name( int fd, char *name );
 	int	get_local_name( int fd, char *name );
+	int	get_native_name( int fd, char *name );
 	pfs_off_t get_fd_offset( int fd );
 
+	/* descriptors that the tracee also holds in its own table */
+	int	get_native_fd( int fd );
+	void	set_native_fd( int fd, int nfd );
+	int	is_pointer_shared( int fd );
+
 
 	/* operations on services */
 	int	stat( const char *name, struct pfs_stat *buf );
@@ -108,6 +116,7 @@ public:
 	pfs_file * open_object( const char *path, int flags, mode_t mode, int force_cache );
 
 	int find_empty( int lowest );
+	int next_open( int lowest );
 	void complete_at_path( int dirfd, const char *short_path, char *long_path );
 private:
 	int search_dup2( int ofd, int search );
@@ -115,12 +124,18 @@ private:
 	int count_pointer_uses( pfs_pointer *p );
 	int count_file_uses( pfs_file *f );
 
+	pfs_pointer * get_pointer( int fd );
+	struct pfs_fd_slot * get_slot( int fd );
+	struct pfs_fd_slot * writable_slot( int fd );
+	void set_pointer( int fd, pfs_pointer *p );
+
 	void collapse_path( const char *short_path, char *long_path, int remove_dotdot );
 	void complete_path( const char *short_path, char *long_path );
 
-	int         pointer_count;
-	pfs_pointer **pointers;
-	int         *fd_flags;
+	int         fd_limit;
+	int         chunk_count;
+	pfs_fd_chunk **chunks;
+	UINT64_T    *full_chunks;
 	char        working_dir[PFS_PATH_MAX];
 };
 
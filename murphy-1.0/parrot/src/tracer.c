@@ -23,6 +23,24 @@ See the file COPYING for details.
 
 #include <sys/wait.h>
 #include <sys/ptrace.h>
+#include <sys/uio.h>
+#include <sys/syscall.h>
+#include <sys/prctl.h>
+#include <sys/utsname.h>
+
+#ifdef CCTOOLS_CPU_X86_64
+#include <stddef.h>
+#include <linux/filter.h>
+#include <linux/seccomp.h>
+#include <linux/audit.h>
+#if defined(PR_SET_NO_NEW_PRIVS) && defined(SECCOMP_MODE_FILTER)
+#define TRACER_SECCOMP
+#endif
+#endif
+
+#ifdef PTRACE_SEIZE
+#define TRACER_SEIZE
+#endif
 
 #define FATAL fatal("tracer: %d %s",t->pid,strerror(errno));
 
@@ -58,13 +76,32 @@ struct tracer {
 	pid_t pid;
 	int memory_file;
 	int gotregs;
+	int dirtyregs;
 	union {
 		struct i386_registers regs32;
 		struct x86_64_registers regs64;
 	} regs;
 	int has_args5_bug;
+	int options_set;
+	int resume_request;
+	int in_syscall;
 };
 
+/*
+In seccomp mode, a tracee runs with PTRACE_CONT until its filter
+stops it at the entry of a syscall that we must see.  From there,
+PTRACE_SYSCALL carries it to the exit of that syscall, and then it
+runs freely again.
+*/
+
+static int seccomp_mode = 0;
+
+/*
+Every tracee gets these ptrace options before it first runs.
+*/
+
+static int trace_options = 0;
+
 void tracer_prepare()
 {
 	ptrace(PTRACE_TRACEME,0,0,0);
@@ -74,21 +111,19 @@ void tracer_prepare()
 struct tracer * tracer_attach( pid_t pid )
 {
 	struct tracer *t;
-	char path[PATH_MAX];
 
 	t = malloc(sizeof(*t));
 	if(!t) return 0;
 
 	t->pid = pid;
 	t->gotregs = 0;
+	t->dirtyregs = 0;
 	t->has_args5_bug = 0;
+	t->options_set = 0;
+	t->resume_request = seccomp_mode ? PTRACE_CONT : PTRACE_SYSCALL;
+	t->in_syscall = 0;
 
-	sprintf(path,"/proc/%d/mem",pid);
-	t->memory_file = open64(path,O_RDWR);
-	if(t->memory_file<0) {
-		free(t);
-		return 0;
-	}
+	t->memory_file = -1;
 
 	memset(&t->regs,0,sizeof(t->regs));
 
@@ -109,17 +144,255 @@ int tracer_is_64bit( struct tracer *t )
 	}
 }
 
+/*
+Changes to the registers are only made to our copy, and written
+back once, just before the tracee runs again.  These count how
+many PTRACE_SETREGS that saves.
+*/
+
+static INT64_T regs_changed = 0;
+static INT64_T regs_flushed = 0;
+
+static void tracer_regs_changed( struct tracer *t )
+{
+	t->dirtyregs = 1;
+	regs_changed++;
+}
+
+void tracer_flush( struct tracer *t )
+{
+	if(t->dirtyregs) {
+		if(ptrace(PTRACE_SETREGS,t->pid,0,&t->regs)!=0) FATAL;
+		t->dirtyregs = 0;
+		regs_flushed++;
+	}
+}
+
+void tracer_report()
+{
+	debug(D_DEBUG,"tracer: %lld register changes written back in %lld PTRACE_SETREGS, %lld saved",(long long)regs_changed,(long long)regs_flushed,(long long)(regs_changed-regs_flushed));
+}
+
 void tracer_detach( struct tracer *t )
 {
+	tracer_flush(t);
 	ptrace(PTRACE_DETACH,t->pid,0,0);
-	close(t->memory_file);
+	if(t->memory_file>=0) close(t->memory_file);
 	free(t);
 }
 
+static void tracer_restart( struct tracer *t, int request, int signum )
+{
+	tracer_flush(t);
+	if(trace_options && !t->options_set) {
+		if(ptrace(PTRACE_SETOPTIONS,t->pid,0,trace_options)!=0) FATAL;
+		t->options_set = 1;
+	}
+	ptrace(request,t->pid,0,signum);
+	t->resume_request = request;
+	t->gotregs = 0;
+}
+
 void tracer_continue( struct tracer *t, int signum )
 {
-	ptrace(PTRACE_SYSCALL,t->pid,0,signum);
+#ifdef TRACER_SECCOMP
+	if(seccomp_mode) {
+		if(t->in_syscall) {
+			t->in_syscall = 0;
+			tracer_restart(t,PTRACE_SYSCALL,signum);
+		} else {
+			tracer_restart(t,PTRACE_CONT,signum);
+		}
+		return;
+	}
+#endif
+	tracer_restart(t,PTRACE_SYSCALL,signum);
+}
+
+/*
+A fork, clone or exec event stop comes between the entry and the
+exit of a syscall, so the tracee must go on exactly as it was last
+continued, or the exit would be missed in seccomp mode.
+*/
+
+void tracer_resume( struct tracer *t )
+{
+	tracer_restart(t,t->resume_request,0);
+}
+
+/*
+A seized tracee in group-stop must stay stopped until it gets
+SIGCONT, but still report to us when it does.
+*/
+
+void tracer_listen( struct tracer *t )
+{
+#ifdef TRACER_SEIZE
+	tracer_flush(t);
+	ptrace(PTRACE_LISTEN,t->pid,0,0);
 	t->gotregs = 0;
+#endif
+}
+
+static int kernel_at_least( int want_major, int want_minor )
+{
+	struct utsname name;
+	int major, minor;
+
+	if(uname(&name)!=0) return 0;
+	if(sscanf(name.release,"%d.%d",&major,&minor)!=2) return 0;
+	return major>want_major || (major==want_major && minor>=want_minor);
+}
+
+/*
+In fork tracking mode, the root tracee is seized rather than asking
+to be traced, and the kernel attaches every process it creates to
+us before that process runs.  Forks then need not be rewritten,
+nor the tracer wait on one pid until the fork returns.  Seized
+children first report a PTRACE_EVENT_STOP instead of a real SIGSTOP.
+PTRACE_O_EXITKILL, which cleans up if we die, came with Linux 3.8.
+*/
+
+int tracer_fork_available()
+{
+#ifdef TRACER_SEIZE
+	return kernel_at_least(3,8);
+#else
+	return 0;
+#endif
+}
+
+void tracer_fork_enable()
+{
+#ifdef TRACER_SEIZE
+	trace_options |= PTRACE_O_TRACESYSGOOD|PTRACE_O_TRACEFORK|PTRACE_O_TRACEVFORK|PTRACE_O_TRACECLONE|PTRACE_O_TRACEEXEC|PTRACE_O_EXITKILL;
+#endif
+}
+
+/*
+A seized process runs on untraced until it first stops, and is
+only put under PTRACE_SYSCALL when we continue it from there.
+*/
+
+int tracer_seize( pid_t pid )
+{
+#ifdef TRACER_SEIZE
+	return ptrace(PTRACE_SEIZE,pid,0,trace_options)==0;
+#else
+	errno = ENOSYS;
+	return 0;
+#endif
+}
+
+/*
+Classify a stop reported by wait, once the fork options are on.
+Syscall stops carry SIGTRAP|0x80, so that a plain SIGTRAP is only
+ever a real signal to be delivered.
+*/
+
+int tracer_stop_type( int status )
+{
+	int signum = WSTOPSIG(status);
+	int event = status>>16;
+
+	if(signum==(SIGTRAP|0x80)) return TRACER_STOP_SYSCALL;
+#ifdef TRACER_SECCOMP
+	if(signum==SIGTRAP && event==PTRACE_EVENT_SECCOMP) return TRACER_STOP_SYSCALL;
+#endif
+#ifdef TRACER_SEIZE
+	if(event==PTRACE_EVENT_STOP) {
+		if(signum==SIGTRAP) return TRACER_STOP_EVENT;
+		return TRACER_STOP_GROUP;
+	}
+#endif
+	if(event) return TRACER_STOP_EVENT;
+	return TRACER_STOP_SIGNAL;
+}
+
+/*
+The seccomp stop must behave like a syscall-entry stop, so that
+registers changed there are seen by the syscall and PTRACE_SYSCALL
+leads to its exit.  Linux only does that since 4.8.
+*/
+
+int tracer_seccomp_available()
+{
+#ifdef TRACER_SECCOMP
+	if(!kernel_at_least(4,8)) return 0;
+
+	/* With a null filter, this fails with EFAULT only if filters are supported. */
+	if(prctl(PR_SET_SECCOMP,SECCOMP_MODE_FILTER,0,0,0)==0) return 0;
+	return errno==EFAULT;
+#else
+	return 0;
+#endif
+}
+
+void tracer_seccomp_enable()
+{
+#ifdef TRACER_SECCOMP
+	seccomp_mode = 1;
+	trace_options |= PTRACE_O_TRACESECCOMP;
+#endif
+}
+
+/*
+Build and install the filter in the calling process, which is about
+to become a tracee.  x86_64 syscalls in the list run untraced, and
+everything else, including 32-bit and x32 syscalls, stops for the
+tracer.  A BPF jump reaches at most 255 instructions, so any syscalls
+beyond that are simply traced.
+*/
+
+int tracer_seccomp_install( const int *untraced, int count )
+{
+#ifdef TRACER_SECCOMP
+	struct sock_filter *filter;
+	struct sock_fprog prog;
+	int i, n = 0;
+	int result;
+
+	if(count>250) count = 250;
+
+	filter = malloc((count+6)*sizeof(*filter));
+	if(!filter) return 0;
+
+	filter[n++] = (struct sock_filter) BPF_STMT(BPF_LD|BPF_W|BPF_ABS,offsetof(struct seccomp_data,arch));
+	filter[n++] = (struct sock_filter) BPF_JUMP(BPF_JMP|BPF_JEQ|BPF_K,AUDIT_ARCH_X86_64,0,count+2);
+	filter[n++] = (struct sock_filter) BPF_STMT(BPF_LD|BPF_W|BPF_ABS,offsetof(struct seccomp_data,nr));
+	filter[n++] = (struct sock_filter) BPF_JUMP(BPF_JMP|BPF_JGE|BPF_K,0x40000000,count,0);
+	for(i=0;i<count;i++) {
+		filter[n++] = (struct sock_filter) BPF_JUMP(BPF_JMP|BPF_JEQ|BPF_K,untraced[i],count-i,0);
+	}
+	filter[n++] = (struct sock_filter) BPF_STMT(BPF_RET|BPF_K,SECCOMP_RET_TRACE);
+	filter[n++] = (struct sock_filter) BPF_STMT(BPF_RET|BPF_K,SECCOMP_RET_ALLOW);
+
+	prog.len = n;
+	prog.filter = filter;
+
+	/* Unprivileged processes may only install a filter under no_new_privs. */
+	result = prctl(PR_SET_SECCOMP,SECCOMP_MODE_FILTER,&prog,0,0);
+	if(result!=0 && errno==EACCES) {
+		if(prctl(PR_SET_NO_NEW_PRIVS,1,0,0,0)==0) {
+			result = prctl(PR_SET_SECCOMP,SECCOMP_MODE_FILTER,&prog,0,0);
+		}
+	}
+
+	free(filter);
+	return result==0;
+#else
+	errno = ENOSYS;
+	return 0;
+#endif
+}
+
+void tracer_seccomp_event( struct tracer *t, int status )
+{
+#ifdef TRACER_SECCOMP
+	if((status>>16)==PTRACE_EVENT_SECCOMP) {
+		t->in_syscall = 1;
+	}
+#endif
 }
 
 int tracer_args_get( struct tracer *t, INT64_T *syscall, INT64_T args[TRACER_ARGS_MAX] )
@@ -209,7 +482,7 @@ int tracer_args_set( struct tracer *t, INT64_T syscall, INT64_T args[TRACER_ARGS
 	}
 #endif
 
-	if(ptrace(PTRACE_SETREGS,t->pid,0,&t->regs)!=0) FATAL;
+	tracer_regs_changed(t);
 
 	return 1;
 }
@@ -230,6 +503,22 @@ int tracer_result_get( struct tracer *t, INT64_T *result )
 	return 1;
 }
 
+int tracer_stack_get( struct tracer *t, INT64_T *sp )
+{
+	if(!t->gotregs) {
+		if(ptrace(PTRACE_GETREGS,t->pid,0,&t->regs)!=0) FATAL;
+		t->gotregs = 1;
+	}
+
+#ifdef CCTOOLS_CPU_I386
+	*sp = t->regs.regs32.esp;
+#else
+	*sp = t->regs.regs64.rsp;
+#endif
+
+	return 1;
+}
+
 int tracer_result_set( struct tracer *t, INT64_T result )
 {
 	if(!t->gotregs) {
@@ -243,11 +532,60 @@ int tracer_result_set( struct tracer *t, INT64_T result )
 	t->regs.regs64.rax = result;
 #endif
 
-	if(ptrace(PTRACE_SETREGS,t->pid,0,&t->regs)!=0) FATAL;
+	tracer_regs_changed(t);
 
 	return 1;
 }
 
+/*
+Data moves in and out of the tracee with process_vm_readv and
+process_vm_writev where the kernel has them: one syscall per copy,
+and no file descriptor per tracee.  They fail on pages that the
+tracee itself may not access, so /proc/X/mem, which may, is still
+kept as a fallback and opened the first time it is needed.  Where
+neither works, we are left with peeking and poking words.
+*/
+
+static int has_vm_copy = 1;
+
+#ifndef IOV_MAX
+#define IOV_MAX 1024
+#endif
+
+static int tracer_vm_copy( struct tracer *t, const struct iovec *local, int nlocal, const struct iovec *remote, int nremote, int write )
+{
+#ifdef SYS_process_vm_readv
+	int result;
+
+	if(!has_vm_copy) return -1;
+
+	if(write) {
+		result = syscall(SYS_process_vm_writev,t->pid,local,nlocal,remote,nremote,0);
+	} else {
+		result = syscall(SYS_process_vm_readv,t->pid,local,nlocal,remote,nremote,0);
+	}
+
+	if(result<0 && (errno==ENOSYS || errno==EPERM)) {
+		has_vm_copy = 0;
+		debug(D_SYSCALL,"process_vm_readv/writev failed (%s), falling back to /proc/X/mem",strerror(errno));
+	}
+
+	return result;
+#else
+	return -1;
+#endif
+}
+
+static int tracer_memory_file( struct tracer *t )
+{
+	if(t->memory_file<0) {
+		char path[PATH_MAX];
+		sprintf(path,"/proc/%d/mem",t->pid);
+		t->memory_file = open64(path,O_RDWR);
+	}
+	return t->memory_file;
+}
+
 /*
 Be careful here:
 Note that the amount of data moved around in a PEEKDATA or POKEDATA
@@ -298,9 +636,18 @@ int tracer_copy_out( struct tracer *t, const void *data, const void *uaddr, int
 	if(!tracer_is_64bit(t)) iuaddr &= 0xffffffff;
 #endif
 
+	if(has_vm_copy) {
+		struct iovec local, remote;
+		local.iov_base = (void*)data;
+		local.iov_len = length;
+		remote.iov_base = (void*)iuaddr;
+		remote.iov_len = length;
+		if(tracer_vm_copy(t,&local,1,&remote,1,1)==length) return length;
+	}
+
 	if(has_fast_write) {
-		result = full_pwrite64(t->memory_file,data,length,iuaddr);
-		if( result!=length && errno==EINVAL ) {
+		result = full_pwrite64(tracer_memory_file(t),data,length,iuaddr);
+		if( result!=length && (errno==EINVAL || errno==EBADF) ) {
 			has_fast_write = 0;
 			debug(D_SYSCALL,"writing to /proc/X/mem failed, falling back to slow ptrace write");
 		} else {
@@ -340,7 +687,7 @@ static int tracer_copy_in_slow( struct tracer *t, const void *data, const void *
 	return length;		
 }
 
-int tracer_copy_in_string( struct tracer *t, char *str, const void *uaddr, int length )
+static int tracer_copy_in_string_slow( struct tracer *t, char *str, const void *uaddr, int length )
 {
 	UINT8_T *bdata = (UINT8_T *)str;
 	UINT8_T *buaddr = (UINT8_T *)uaddr;
@@ -368,6 +715,49 @@ int tracer_copy_in_string( struct tracer *t, char *str, const void *uaddr, int l
 	return total;
 }
 
+/*
+Copy a string a page at a time, so that a short string at the end
+of a mapping does not fault on the page after it, and so that a
+long buffer is only read as far as the terminator.  Returns the
+length copied, including the terminator if there was room for it.
+*/
+
+int tracer_copy_in_string( struct tracer *t, char *str, const void *uaddr, int length )
+{
+	static UPTRINT_T pagesize = 0;
+	UPTRINT_T addr = (UPTRINT_T)uaddr;
+	int total = 0;
+
+	if(!pagesize) pagesize = getpagesize();
+
+	while(has_vm_copy && total<length) {
+		struct iovec local, remote;
+		int chunk = pagesize - (addr+total)%pagesize;
+		int result;
+		char *end;
+
+		if(chunk>length-total) chunk = length-total;
+
+		local.iov_base = &str[total];
+		local.iov_len = chunk;
+		remote.iov_base = (void*)(addr+total);
+		remote.iov_len = chunk;
+
+		result = tracer_vm_copy(t,&local,1,&remote,1,0);
+		if(result<=0) break;
+
+		end = memchr(&str[total],0,result);
+		if(end) return end-str+1;
+
+		total += result;
+		if(result<chunk) break;
+	}
+
+	if(total==length) return total;
+
+	return tracer_copy_in_string_slow(t,str,uaddr,length);
+}
+
 /*
 Tidbit:
 The reason we must have pread64 here is that the target address
@@ -384,13 +774,24 @@ int tracer_copy_in( struct tracer *t, void *data, const void *uaddr, int length
 
 	UPTRINT_T iuaddr = (UPTRINT_T)uaddr;
 
+	if(length==0) return 0;
+
 #if !defined(CCTOOLS_CPU_I386)
 	if(!tracer_is_64bit(t)) iuaddr &= 0xffffffff;
 #endif
 
+	if(has_vm_copy) {
+		struct iovec local, remote;
+		local.iov_base = data;
+		local.iov_len = length;
+		remote.iov_base = (void*)iuaddr;
+		remote.iov_len = length;
+		if(tracer_vm_copy(t,&local,1,&remote,1,0)==length) return length;
+	}
+
 	if(has_fast_read) {
-		result = full_pread64(t->memory_file,data,length,iuaddr);
-		if( result<=0 && errno==EINVAL ) {
+		result = full_pread64(tracer_memory_file(t),data,length,iuaddr);
+		if( result<=0 && (errno==EINVAL || errno==EBADF) ) {
 			has_fast_read = 0;
 			debug(D_SYSCALL,"reading from /proc/X/mem failed, falling back to slow ptrace read");
 		} else {
@@ -403,13 +804,52 @@ int tracer_copy_in( struct tracer *t, void *data, const void *uaddr, int length
 	return result;
 }
 
+/*
+Scatter/gather copies: move each local buffer to or from the user
+buffer of the same length at the same index, in one call when the
+kernel allows.  Otherwise, or if part of it fails, each pair is
+copied on its own, so the result is that of a loop of single copies.
+*/
+
+static int tracer_copy_vector( struct tracer *t, const struct iovec *local, const struct iovec *remote, int count, int write )
+{
+	int i, total = 0;
+
+	for(i=0;i<count;i++) total += local[i].iov_len;
+	if(total==0) return 0;
+
+	if(has_vm_copy && count<=IOV_MAX && tracer_is_64bit(t)) {
+		if(tracer_vm_copy(t,local,count,remote,count,write)==total) return total;
+	}
+
+	for(i=0;i<count;i++) {
+		if(write) {
+			tracer_copy_out(t,local[i].iov_base,remote[i].iov_base,local[i].iov_len);
+		} else {
+			tracer_copy_in(t,local[i].iov_base,remote[i].iov_base,local[i].iov_len);
+		}
+	}
+
+	return total;
+}
+
+int tracer_copy_in_vector( struct tracer *t, const struct iovec *local, const struct iovec *remote, int count )
+{
+	return tracer_copy_vector(t,local,remote,count,0);
+}
+
+int tracer_copy_out_vector( struct tracer *t, const struct iovec *local, const struct iovec *remote, int count )
+{
+	return tracer_copy_vector(t,local,remote,count,1);
+}
+
 #include "tracer.table.c"
 #include "tracer.table64.c"
 
 
 const char * tracer_syscall32_name( int syscall )
 {
-	if( syscall<0 || syscall>SYSCALL32_MAX ) {
+	if( syscall<0 || syscall>=SYSCALL32_MAX ) {
 		return "unknown";
 	} else {
 		return syscall32_names[syscall];
@@ -418,7 +858,7 @@ const char * tracer_syscall32_name( int syscall )
 
 const char * tracer_syscall64_name( int syscall )
 {
-	if( syscall<0 || syscall>SYSCALL64_MAX ) {
+	if( syscall<0 || syscall>=SYSCALL64_MAX ) {
 		return "unknown";
 	} else {
 		return syscall64_names[syscall];
@@ -9,15 +9,33 @@ See the file COPYING for details.
 #define TRACER_H
 
 #include <sys/types.h>
+#include <sys/uio.h>
 #include "int_sizes.h"
 
 #define TRACER_ARGS_MAX 8
 
+#define TRACER_STOP_SYSCALL 1
+#define TRACER_STOP_SIGNAL  2
+#define TRACER_STOP_EVENT   3
+#define TRACER_STOP_GROUP   4
+
 void tracer_prepare();
 
 struct tracer * tracer_attach( pid_t pid );
 void            tracer_detach( struct tracer *t );
 void		tracer_continue( struct tracer *t, int signum );
+void		tracer_resume( struct tracer *t );
+void		tracer_listen( struct tracer *t );
+void		tracer_flush( struct tracer *t );
+void		tracer_report();
+int		tracer_seccomp_available();
+void		tracer_seccomp_enable();
+int		tracer_seccomp_install( const int *untraced, int count );
+void		tracer_seccomp_event( struct tracer *t, int status );
+int		tracer_fork_available();
+void		tracer_fork_enable();
+int		tracer_seize( pid_t pid );
+int		tracer_stop_type( int status );
 
 int             tracer_args_get( struct tracer *t, INT64_T *syscall, INT64_T args[TRACER_ARGS_MAX] );
 int             tracer_args_set( struct tracer *t, INT64_T syscall, INT64_T args[TRACER_ARGS_MAX], int nargs );
@@ -26,10 +44,13 @@ void		tracer_has_args5_bug( struct tracer *t );
 
 int             tracer_result_get( struct tracer *t, INT64_T *result );
 int             tracer_result_set( struct tracer *t, INT64_T result );
+int             tracer_stack_get( struct tracer *t, INT64_T *sp );
 
 int             tracer_copy_out( struct tracer *t, const void *data, const void *uaddr, int length );
 int             tracer_copy_in( struct tracer *t, void *data, const void *uaddr, int length );
 int             tracer_copy_in_string( struct tracer *t, char *data, const void *uaddr, int maxlength );
+int             tracer_copy_in_vector( struct tracer *t, const struct iovec *local, const struct iovec *remote, int count );
+int             tracer_copy_out_vector( struct tracer *t, const struct iovec *local, const struct iovec *remote, int count );
 
 int             tracer_is_64bit( struct tracer *t );
 